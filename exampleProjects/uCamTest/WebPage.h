@@ -45,6 +45,8 @@ P(camBody) =
 "<option value='09'>128x128</option>"
 "<option value='08'>128x96</option>"
 "<option value='01'>80x60</option>"
+"<option value='05'>320x240</option>"
+"<option value='07'>640x480</option>"
 "</select>"
 "</td>"
 "<td width='10%'><label>JPG Resolution</label></td>"
@@ -7,10 +7,10 @@ http://4dsystems.com.au/product/uCAM_III/
 http://www.4dsystems.com.au/productpages/uCAM-III/downloads/uCAM-III_datasheet_R_1_0.pdf
 
 ## Overview:
-The library implements most functions the uCamIII provides according to datasheet, 
-only baudrate selection is omitted due to the fact that up to 115200 the autodetection 
-works fine and higher baudrates available for the camera are usually not supported by 
-the microcontrollers using this library.
+The library implements most functions the uCamIII provides according to datasheet.
+The link is established at an autodetected baudrate (up to 115200) via `init()`, 
+higher rates (up to 3686400 where the UART supports it) can then be negotiated via 
+`setBaudrate()` which falls back to the previous rate when the camera can't be synced.
 
 It also supports hardware and software serial ports (e.g. `ParticleSoftSerial` on the 
 Particle side or `SoftwareSerial` and `NewSoftSerial` for Arduino) by use of 
@@ -31,6 +31,10 @@ It will provide a `Particle.function("snap")` that can be triggered with paramet
 `GRAY8` (default for wrong parameters too), `RGB16`, `UYVY16` and `JPG` to take a pic and 
 send it via `Serial` or `TCP` (provided via `Particle.function("setTarget")`) where it 
 can be dumped into a file.
+`Particle.function("preview")` with a frame rate (e.g. `5`, `0` for as fast as the link 
+allows, `stop` to end it) streams 80x60 gray8 BMP frames to the same target continuously.
+All data goes through a uCamIII_Pipeline: the camera fills its ring while the target 
+drains it, a TCP connection that's backed up holds the camera off instead of busy-waiting.
 For the TCP data sink you need to be running a server like the provided 'imageReceiver.js'
 (run the server from its file location via `node ./imageReceiver.js`) and inform the 
 device of the IP and port for the server. This is done via `Particle.function("setServer")`
@@ -69,9 +73,11 @@ SOFTWARE.
 ************************************************************************************* */
 
 #include "uCamIII.h"
+#include "uCamIII_Converter.h"
+#include "uCamIII_Encoder.h"
+#include "uCamIII_Pipeline.h"
 #include "WebServer.h"
 #include "WebPage.h"
-#include "TCPClientX.h"
 
 // uncomment for debugging
 //SerialLogHandler traceLog(LOG_LEVEL_TRACE);
@@ -81,8 +87,8 @@ long prepareCam(uCamIII_SNAP_TYPE snap    = uCamIII_SNAP_RAW,
                 uCamIII_RES res           = uCamIII_80x60, 
                 uCamIII_CBE contrast      = uCamIII_DEFAULT,
                 uCamIII_CBE brightness    = uCamIII_DEFAULT,
-                uCamIII_CBE exposure      = uCamIII_DEFAULT,
-                uCamIII_callback callback = NULL);
+                uCamIII_CBE exposure      = uCamIII_DEFAULT);
+void setImageGeometry(uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res);
 
 uCamIII<USARTSerial> ucam(Serial1, A0, 500);                        // use HW Serial1 and A0 as reset pin for uCamIII
 // or
@@ -90,8 +96,13 @@ uCamIII<USARTSerial> ucam(Serial1, A0, 500);                        // use HW Se
 // or
 // ParticleSoftSerial pss(D0, D1);
 // uCamIII<ParticleSoftSerial> ucam(pss);
+uCamIII_Converter    rgb565(uCamIII_PIXEL_RGB565);                  // BMP wants 16bit pixels as little-endian RGB565
+uCamIII_Encoder      bmp(uCamIII_CONTAINER_BMP);                    // header + palette up front, then the rows
+uint8_t              bmpHeader[14 + 56 + 256 * 4];                  // BMP header with the gray8 palette
 
-uint8_t     imageBuffer[160*120*2 + 134];                           // max raw image 160x120x2byte + max BMP header size
+uint8_t     previewBuffer[80*60];                                   // one 80x60 gray8 frame for continuous capture
+uint8_t     imageBuffer[640*2*2];                                   // two rows of the widest raw image or a 512 byte 
+                                                                    // JPEG package
 int         imageSize     = 0;
 int         imageType     = uCamIII_TYPE_SNAPSHOT;                  // default for the demo 
                                                                     // alternative: _TYPE_RAW & _TYPE_JPEG
@@ -106,15 +117,11 @@ char        lIP[16];
 IPAddress   serverAddr;
 int         serverPort;
 char        nonce[34];
-#if Wiring_WiFi
-  TCPClientX client(1024, 100);
-#elif Wiring_Cellular
-  TCPClientX client( 512, 100);
-#endif
-uCamIII_callback snapTarget = callbackSerial;
-
-int         sendImageTCP(const uint8_t *buf, int len, int chunkSize = 512, uint32_t flushTime = 100);
-int         bmpHeader(uint8_t *buf, int len, int width, int height, int bits, int encoding = 0, int padding = 0);
+TCPClient        client;
+uint8_t          netRing[6144];                                     // takes a whole 80x60 gray8 BMP preview frame
+uCamIII_Pipeline snapPipe(netRing, sizeof(netRing), uCamIII_Sink(sinkSerial, &Serial));
+bool             snapClosing = false;                               // capture over, close once the ring is empty
+uCamIII_IMAGE_FORMAT snapFormat = uCamIII_RAW_8BIT;
 
 void setup() {
   Time.zone(+2.0);
@@ -122,6 +129,7 @@ void setup() {
   Particle.function("setServer", devicesHandler);
   Particle.function("setTarget", setSnapshotTarget);
   Particle.function("snap", takeSnapshot);
+  Particle.function("preview", startPreview);
 
   pinMode(D7, OUTPUT);
   ucam.init(115200);
@@ -138,7 +146,37 @@ void setup() {
 }
 
 void loop() {
-  static uint32_t msSend = 0;    
+  switch (ucam.poll())                                          // advance a running snapshot without blocking
+  {
+    case uCamIII_EVENT_IMAGE_SIZE:
+      imageSize = ucam.getImageSize();
+      Log.info("\r\nImageSize: %d", imageSize);
+      if (snapFormat != uCamIII_COMP_JPEG)                      // raw images get a BMP header first, the ring
+        snapPipe.write(bmpHeader, rawHeader());                 // is empty when a capture starts so it fits
+      break;
+    case uCamIII_EVENT_ERROR:
+      ucam.hardReset();                                         // start the next snapshot from a clean slate
+      // fall through
+    case uCamIII_EVENT_COMPLETE:
+      snapClosing = true;
+      break;
+    default:
+      break;
+  }
+
+  if (snapPipe.pump() < 0)                                      // target gone, drop the rest
+  {
+    snapPipe.reset();
+    ucam.abort();
+    snapClosing = true;
+  }
+  if (snapClosing && !snapPipe.available())
+  {
+    if (client.connected())                                     // if the TCP client would still be connected
+      client.stop();                                            // stop the connection
+    digitalWrite(D7, LOW);
+    snapClosing = false;
+  }
 
 #if Wiring_WiFi
   char buff[64];
@@ -165,83 +203,95 @@ int devicesHandler(String data)
 
 int setSnapshotTarget(String target)
 {
+  if (ucam.isBusy() || snapPipe.available()) return -5;    // not while an image is on its way
+
   if (target.equalsIgnoreCase("tcp"))
   {
-    snapTarget = callbackTCP;
+    snapPipe.setOutput(uCamIII_Sink(sinkTCP, &client));
     return 1;
   }
   else 
-    snapTarget = callbackSerial;                            // default to Serial
+    snapPipe.setOutput(uCamIII_Sink(sinkSerial, &Serial));  // default to Serial
     
   return 0;
 }
 
+int startPreview(String fps)
+{
+  Log.trace(__FUNCTION__); 
+
+  if (fps.equalsIgnoreCase("stop"))
+  {
+    ucam.endContinuous();
+    return 0;
+  }
+  if (ucam.isBusy() || snapPipe.available()) return -5;
+
+  setImageGeometry(uCamIII_RAW_8BIT, uCamIII_80x60);
+  snapFormat   = uCamIII_RAW_8BIT;
+  digitalWrite(D7, HIGH);
+  // the camera stays configured, frames are requested back to back (or at `fps`) by ucam.poll()
+  return ucam.beginContinuous(uCamIII_RAW_8BIT, uCamIII_80x60, previewBuffer, sizeof(previewBuffer), 
+                              callbackPreview, fps.toFloat()) ? 1 : -1;
+}
+
+// a frame goes into the ring as a whole BMP or not at all - one the target hasn't got room 
+// for yet is dropped rather than waited for
+int callbackPreview(uint8_t *frame, long size, uint32_t seq, uint32_t ms)
+{
+  int header = rawHeader();
+
+  Log.info("frame %lu @ %lu ms (%.1f fps)", seq, ms, ucam.getFps());
+  if (snapPipe.space() < header + size) return 0;
+  snapPipe.write(bmpHeader, header);
+  snapPipe.write(frame, size);
+  return 1;
+}
+
 int takeSnapshot(String format) 
 {
   Log.trace(__FUNCTION__); 
 
-  int retVal;
-  
+  uCamIII_IMAGE_FORMAT fmt = uCamIII_RAW_8BIT;                  // default to "GRAY8"
+  uCamIII_RES          res = uCamIII_160x120;
+
   if (format.equalsIgnoreCase("JPG") || format.equalsIgnoreCase("JPEG"))
-    retVal = prepareCam(uCamIII_SNAP_JPEG, uCamIII_COMP_JPEG, uCamIII_640x480, 
-                       uCamIII_DEFAULT, uCamIII_DEFAULT, uCamIII_DEFAULT, snapTarget);
+  {
+    fmt = uCamIII_COMP_JPEG;
+    res = uCamIII_640x480;
+  }
   else if (format.equalsIgnoreCase("RGB16"))
-    retVal = prepareCam(uCamIII_SNAP_RAW, uCamIII_RAW_16BIT_RGB565, uCamIII_160x120, 
-                       uCamIII_DEFAULT, uCamIII_DEFAULT, uCamIII_DEFAULT, snapTarget);
+    fmt = uCamIII_RAW_16BIT_RGB565;
   else if (format.equalsIgnoreCase("UYVY16") || format.equalsIgnoreCase("CrYCbY16"))
-    retVal = prepareCam(uCamIII_SNAP_RAW, uCamIII_RAW_16BIT_CRYCBY, uCamIII_160x120, 
-                       uCamIII_DEFAULT, uCamIII_DEFAULT, uCamIII_DEFAULT, snapTarget);
-  else // default to "GRAY8"
-    retVal = prepareCam(uCamIII_SNAP_RAW, uCamIII_RAW_8BIT, uCamIII_160x120, 
-                       uCamIII_DEFAULT, uCamIII_DEFAULT, uCamIII_DEFAULT, snapTarget);
-
-  if (retVal <= 0) return retVal;
-  
-  if (retVal = imageSize = ucam.getPicture((uCamIII_PIC_TYPE)imageType))
-  {
-    Log.info("\r\nImageSize: %d", imageSize);
+    fmt = uCamIII_RAW_16BIT_CRYCBY;
 
-    if (imageType == uCamIII_SNAP_JPEG)
-      for (int received = 0, chunk = 0; (received < imageSize) && (chunk = ucam.getJpegData(&imageBuffer[constrain(received, 0, sizeof(imageBuffer)-512)], 512, snapTarget)); received += chunk);
-    else if (imageSize <= sizeof(imageBuffer)) 
-    {
-      int offset = bmpHeader(imageBuffer, sizeof(imageBuffer), imageWidth, imageHeight, imagePxDepth);
-      retVal     = ucam.getRawData(&imageBuffer[offset], imageSize, NULL);
+  if (ucam.isBusy() || snapPipe.available()) return -5;         // previous image still on its way
 
-      if (imagePxDepth == 16) 
-      {
-        for (int i = offset; i < imageSize + offset; i += 2)    // raw image comes big-endian and upside down from cam,
-        {                                                       // this block corrects endianness
-          uint8_t dmy = imageBuffer[i];
-          imageBuffer[i] = imageBuffer[i+1];
-          imageBuffer[i+1] = dmy;
-        }
-      }
-      snapTarget(imageBuffer, imageSize + offset, 0);
-    }
-
-    if (client.connected())                                     // if the TCP client would still be connected
-      client.stop();                                            // stop the connection
+  setImageGeometry(fmt, res);
+  snapFormat = fmt;
+  imageTime  = Time.now();
+  digitalWrite(D7, HIGH);
 
+  // the capture itself is driven by ucam.poll() in loop()
+  if (!ucam.beginCapture(fmt, res, imageBuffer, (fmt == uCamIII_COMP_JPEG) ? 512 : sizeof(imageBuffer), 
+                         snapPipe.sink(), uCamIII_TYPE_SNAPSHOT, 512))
+  {
     digitalWrite(D7, LOW);
-
-    return retVal;
+    return -1;
   }
-
-  return 0;
+  return 1;
 }
 
 long prepareCam(uCamIII_SNAP_TYPE snap, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res, 
-                 uCamIII_CBE contrast, uCamIII_CBE brightness, uCamIII_CBE exposure,
-                 uCamIII_callback callback)
+                 uCamIII_CBE contrast, uCamIII_CBE brightness, uCamIII_CBE exposure)
 {
   int retVal = 0;
   
+  if (ucam.isBusy() || snapPipe.available()) return -5;         // a snapshot/preview has the camera
   digitalWrite(D7, HIGH);
 
-  ucam.hardReset();
-
-  if (!(retVal = ucam.sync())) return -1;
+  // only syncs (or resets) when the link may have been lost, unchanged settings aren't resent
+  if (!(retVal = ucam.ensureSync())) return -1;
   
   if (!(retVal = ucam.setImageFormat(fmt, res))) return -2;
   
@@ -257,7 +307,13 @@ long prepareCam(uCamIII_SNAP_TYPE snap, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES re
 
   // if we made it to here, we can set the global image variables accordingly 
   imageType = snap;             
+  setImageGeometry(fmt, res);
   
+  return retVal;
+}
+
+void setImageGeometry(uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res)
+{
   switch(res) 
   {
     case uCamIII_80x60:
@@ -300,41 +356,50 @@ long prepareCam(uCamIII_SNAP_TYPE snap, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES re
       imagePxDepth = 16;
       break;
     case uCamIII_RAW_8BIT:
-    defaut:
+    default:
       imagePxDepth = 8;
       break;
   }
-  
-  return retVal;
+  // RGB565/CrYCbY are converted while reading, gray8 has to pass as is (the converter would
+  // widen it to RGB565) and JPEG isn't touched anyway
+  ucam.setConverter(imagePxDepth == 16 ? &rgb565 : NULL);
 }
 
-int callbackSerial(uint8_t *buf, int len, int id)
+// BMP header (+ gray palette) for the current geometry into bmpHeader, returns its size
+int rawHeader()
+{
+  bmp.begin(imageWidth, imageHeight, imagePxDepth);
+  return bmp.header(bmpHeader, sizeof(bmpHeader));
+}
+
+// sinks return the bytes they took, uCamIII_SINK_BUSY to have the library hold off and
+// offer the data again or uCamIII_SINK_ABORT to stop the transfer
+int sinkSerial(void *context, uint8_t *buf, int len, int id)
 {
   Log.info("Package %d (%d Byte) -> Serial", id, len);
   
-  return Serial.write(buf, len);
+  return ((Stream*)context)->write(buf, len);
 }
 
-int callbackTCP(uint8_t *buf, int len, int id)
+int sinkTCP(void *context, uint8_t *buf, int len, int id)
 {
+  TCPClient *tcp = (TCPClient*)context;
+
   Log.info("Package %d (%d Byte) -> TCP %s:%d", id, len, (const char*)serverAddr.toString(), serverPort);
 
-  if (serverPort)
-  {
-    if (!client.connected()) 
-      client.connect(serverAddr, serverPort);
-    return client.write(buf, len);
-  }
-  
-  return 0;
+  if (!serverPort) return uCamIII_SINK_ABORT;                   // nobody to send the image to
+  if (!tcp->connected() && !tcp->connect(serverAddr, serverPort)) return uCamIII_SINK_ABORT;
+  int sent = tcp->write(buf, len);                              // no busy-waiting, the pipeline holds off instead
+  if (sent == -16) return uCamIII_SINK_BUSY;                    // TX buffer full
+  return sent < 0 ? uCamIII_SINK_ABORT : sent;
 }
 
 // ------------------------------------------------------------------------------------------------------------------------
 #if Wiring_WiFi // ---------------------------  only available for WiFi devices -------------------------------------------
 
-int callbackWebServer(uint8_t *buf, int len, int id) 
+int sinkWebServer(void *context, uint8_t *buf, int len, int id) 
 {
-  return webserver.write(buf, len);
+  return ((WebServer*)context)->write(buf, len);
 }
 
 void defaultCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
@@ -408,165 +473,29 @@ void imageCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail,
 {
   Log.trace(__FUNCTION__); 
 
+  uCamIII_Sink page(sinkWebServer, &server);
+
+  if (ucam.isBusy() || snapPipe.available()) return;            // a snapshot/preview has the camera
+
   if (imageSize = ucam.getPicture((uCamIII_PIC_TYPE)imageType))
   {
     Log.info("\r\nImageSize: %d", imageSize);
 
     if (imageType == uCamIII_SNAP_JPEG)
     {
-      Log.info("get JPEG chunks");
-      for (int received = 0, chunk = 0; (received < imageSize) && (chunk = ucam.getJpegData(&imageBuffer[constrain(received, 0, sizeof(imageBuffer)-512)], 512, callbackWebServer)); received += chunk);
+      Log.info("get JPEG chunks");                              // each package goes out before the next is requested
+      for (long received = 0, chunk = 0; (received < imageSize) && (chunk = ucam.getJpegData(imageBuffer, 512, page)); received += chunk);
     }
-    else if (imageSize <= sizeof(imageBuffer)) 
+    else
     {
       Log.info("get RAW image");
 
-      int offset = bmpHeader(imageBuffer, sizeof(imageBuffer), imageWidth, imageHeight, imagePxDepth);
-Log.trace("after bmpHeader (%d)", offset);
-      int size   = ucam.getRawData(&imageBuffer[offset], imageSize, NULL);
-Log.trace("after getRawData (%d)", size);
-
-      if (imagePxDepth == 16) 
-      {
-        for (int i = offset; i < imageSize + offset; i += 2)    // raw image comes big-endian and upside down from cam,
-        {                                                       // this block corrects endianness
-          uint8_t dmy = imageBuffer[i];
-          imageBuffer[i] = imageBuffer[i+1];
-          imageBuffer[i+1] = dmy;
-        }
-      }
-        
-Log.trace("before server write (%d + %d = %d / %d == %d)", imageSize, offset, imageSize + offset, imageSize, size);
-      server.write(imageBuffer, imageSize + offset);
-Log.trace("after server write (%d + %d = %d / %d == %d)", imageSize, offset, imageSize + offset, imageSize, size);
+      server.write(bmpHeader, rawHeader());
+      int size   = ucam.streamRawData(imageBuffer, sizeof(imageBuffer), page, ucam.getRowBytes());
+      Log.trace("streamed %d of %d bytes", size, imageSize);
     }
-else
-{
-Log.trace("raw too big for buffer %d <= %d", imageSize, sizeof(imageBuffer));
-}
     digitalWrite(D7, LOW);
   }
-  
-  //server.write(imageBuffer, imageSize);
 }
 #endif
 // ------------------------------------------------------------------------------------------------------------------------
-
-// -------------------------------------   helper function for bitmap headers   -------------------------------------------
-struct BITMAPFILEHEADER 
-{
-  uint16_t   bfType;            // file type BM (0x424d)                        [  0]
-  uint32_t   bfSize;            // file size all together                       [  2]
-  uint16_t   bfReserved1;       //                                              [  6]
-  uint16_t   bfReserved2;       //                                              [  8]
-  uint32_t   bfOffBits;         // offset of actual image data                  [ 10]
-} __attribute__((__packed__));  //                                              ( 14)
-
-// https://msdn.microsoft.com/en-us/library/windows/desktop/dd183381(v=vs.85).aspx
-struct BITMAPV5HEADER
-{
-  // --------------------------------------------------------------------------
-  // legacy BITMAPINFOHEADER: 
-  uint32_t Size;              // Size of this header in bytes               [  0][ 14]
-  int32_t  Width;             // Image width in pixels                      [  4][ 18]
-  int32_t  Height;            // Image height in pixels                     [  8][ 22]
-  uint16_t Planes;            // Number of color planes                     [ 12][ 26]
-  uint16_t BitsPerPixel;      // Number of bits per pixel                   [ 14][ 28]
-  uint32_t Compression;       // Compression methods used                   [ 16][ 30]
-  uint32_t SizeOfBitmap;      // Size of bitmap in bytes                    [ 20][ 34]
-  int32_t  HorzResolution;    // Horizontal resolution in pixels per meter  [ 24][ 38] 
-  int32_t  VertResolution;    // Vertical resolution in pixels per meter    [ 28][ 42]
-  uint32_t ColorsUsed;        // Number of colors in the image              [ 32][ 46]
-  uint32_t ColorsImportant;   // Minimum number of important colors         [ 36][ 50]
-  // --------------------------------------------------------------------   ( 40)( 54)
-  // Fields added for V2:
-  uint32_t RedMask;           // Mask identifying bits of red component     [ 40][ 54]
-  uint32_t GreenMask;         // Mask identifying bits of green component   [ 44][ 58]
-  uint32_t BlueMask;          // Mask identifying bits of blue component    [ 48][ 62]
-  // --------------------------------------------------------------------   ( 52)( 66)
-  // Fields added for V3:
-  uint32_t AlphaMask;         // Mask identifying bits of alpha component   [ 52][ 66]
-/*// --------------------------------------------------------------------   ( 56)( 70)
-  // Fields added for V4:
-  uint32_t CSType;            // Color space type                           [ 56][ 70]
-  int32_t  RedX;              // X coordinate of red endpoint               [ 60][ 74]
-  int32_t  RedY;              // Y coordinate of red endpoint               [ 64][ 78]
-  int32_t  RedZ;              // Z coordinate of red endpoint               [ 68][ 82]
-  int32_t  GreenX;            // X coordinate of green endpoint             [ 72][ 86]
-  int32_t  GreenY;            // Y coordinate of green endpoint             [ 76][ 90]
-  int32_t  GreenZ;            // Z coordinate of green endpoint             [ 80][ 94]
-  int32_t  BlueX;             // X coordinate of blue endpoint              [ 84][ 98]
-  int32_t  BlueY;             // Y coordinate of blue endpoint              [ 88][102]
-  int32_t  BlueZ;             // Z coordinate of blue endpoint              [ 92][106]
-  uint32_t GammaRed;          // Gamma red coordinate scale value           [ 96][110]
-  uint32_t GammaGreen;        // Gamma green coordinate scale value         [100][114]
-  uint32_t GammaBlue;         // Gamma blue coordinate scale value          [104][118]
-  // --------------------------------------------------------------------   (108)(122)
-  // Fields added for V5:
-  uint32_t Intent;            //                                            [108][122]
-  uint32_t ProfileData;       //                                            [112][126]
-  uint32_t ProfileSize;       //                                            [116][130]
-  uint32_t Reserved;          //                                            [120][134]
-*/
-} __attribute__((__packed__));
-
-int bmpHeader(uint8_t *buf, int len, int width, int height, int bits, int encoding, int padding)  
-{  
-  Log.trace(__FUNCTION__); 
-
-  uint32_t          headerSize      = sizeof(BITMAPFILEHEADER) 
-                                    + sizeof(BITMAPV5HEADER);
-  uint32_t          paletteSize     = (bits <= 8) ? (1 << (bits+2)) : 0;    // optional palette
-  uint32_t          pixelDataSize   = height * ((width * (bits / 8)) + padding);  
-
-  BITMAPFILEHEADER *bmpFileHeader   = (BITMAPFILEHEADER*)buf;
-  BITMAPV5HEADER   *bmpInfoHeader   = (BITMAPV5HEADER*)(buf + sizeof(BITMAPFILEHEADER));
-  uint8_t          *bmpPalette      = buf + headerSize; 
-
-  if (len < headerSize + paletteSize) return 0;
-
-  /// ToDo: where do we set encoding R5G6B5 vs. CrYCbY?
-
-  memset(bmpFileHeader, 0, sizeof(BITMAPFILEHEADER));
-  bmpFileHeader->bfType              = 0x4D42;                               // magic number "BM"
-  bmpFileHeader->bfSize              = headerSize 
-                                     + paletteSize
-                                     + pixelDataSize;
-  //bmpFileHeader->bfReserved1         =
-  //bmpFileHeader->bfReserved2         = 0;
-  bmpFileHeader->bfOffBits           = headerSize
-                                     + paletteSize;
-
-  memset(bmpInfoHeader, 0, sizeof(BITMAPV5HEADER));
-  bmpInfoHeader->Size                = sizeof(BITMAPV5HEADER);  
-  bmpInfoHeader->Width               = width;                               
-  bmpInfoHeader->Height              = -height;                              // negative height flips vertically
-                                                                            // so image isn't upside down 
-                                                                            // but Google Chorme doesn't support that!!! 
-  bmpInfoHeader->Planes              = 1;  
-  bmpInfoHeader->BitsPerPixel        = bits;  
-  //bmpInfoHeader->Compression         = 0; 
-  bmpInfoHeader->SizeOfBitmap        = 0x03;                                 // BI_RGB (0), BI_BITFIELD (3)
-  bmpInfoHeader->HorzResolution      = 0x1000; 
-  bmpInfoHeader->VertResolution      = 0x1000; 
-  bmpInfoHeader->ColorsUsed          =     
-  bmpInfoHeader->ColorsImportant     = (bits <= 8) ? (1 << bits) : 0;        // <= 8bit use color palette
-  if (bits == 16)
-  {  
-    bmpInfoHeader->RedMask           = 0x0000f800;
-	bmpInfoHeader->GreenMask         = 0x000007e0;
-	bmpInfoHeader->BlueMask          = 0x0000001f;
-  }
-
-  for (int c = 0; c < bmpInfoHeader->ColorsUsed; c++)                         // grayscale color table
-  {
-    uint8_t color = 255 * c / (bmpInfoHeader->ColorsUsed - 1);
-    *(bmpPalette++) = color;
-    *(bmpPalette++) = color;
-    *(bmpPalette++) = color;
-    *(bmpPalette++) = 0xFF;
-  }
-  Log.trace("BMP data offset: %d + %d + %d = %d, BMP file size: %d",  
-    sizeof(BITMAPFILEHEADER), sizeof(BITMAPV5HEADER), paletteSize, bmpFileHeader->bfOffBits, bmpFileHeader->bfSize);
-  return bmpFileHeader->bfOffBits;
-}  
@@ -7,10 +7,10 @@ http://4dsystems.com.au/product/uCAM_III/
 http://www.4dsystems.com.au/productpages/uCAM-III/downloads/uCAM-III_datasheet_R_1_0.pdf
 
 ## Overview:
-The library implements most functions the uCamIII provides according to datasheet, 
-only baudrate selection is omitted due to the fact that up to 115200 the autodetection 
-works fine and higher baudrates available for the camera are usually not supported by 
-the microcontrollers using this library.
+The library implements most functions the uCamIII provides according to datasheet.
+The link is established at an autodetected baudrate (up to 115200) via `init()`, 
+higher rates (up to 3686400 where the UART supports it) can then be negotiated via 
+`setBaudrate()` which falls back to the previous rate when the camera can't be synced.
 
 It also supports hardware and software serial ports (e.g. `ParticleSoftSerial` on the 
 Particle side or `SoftwareSerial` and `NewSoftSerial` for Arduino) by use of 
@@ -34,7 +34,13 @@ can be dumped into a file.
 For the TCP data sink you need to be running a server like the provided 'imageReceiver.js'
 (run the server from its file location via `node ./imageReceiver.js`) and inform the 
 device of the IP and port for the server. This is done via `Particle.function("setServer")`
-in the form `###.###.###.###:port`.
+in the form `###.###.###.###:port`. Images are sent as frames (see uCamIII_FrameWriter.h)
+over one connection that stays open between snapshots. The last image is kept (leased from a
+uCamIII_FramePool) and can be sent again via `Particle.function("resend")`.
+`Particle.function("watch")` with an interval in ms has the device probe the scene with 
+80x60 gray8 snapshots and send a JPEG only when something changed ("0" stops it).
+JPEGs are checked by a uCamIII_JpegParser as they arrive: the download ends at the EOI
+marker and a broken image isn't sent.
 
 For WiFi devices it also provides a Webserver which lets you select image format and
 resolution and displays the image. 
@@ -69,6 +75,13 @@ SOFTWARE.
 ************************************************************************************* */
 
 #include <uCamIII.h>
+#include <uCamIII_Encoder.h>
+#include <uCamIII_Pipeline.h>
+#include <uCamIII_FrameWriter.h>
+#include <uCamIII_FramePool.h>
+#include <uCamIII_Motion.h>
+#include <uCamIII_JpegParser.h>
+#include <uCamIII_Spool.h>
 
 #warning "WebServer library needs to be imported" 
 #include "WebServer.h"
@@ -95,12 +108,14 @@ size_t TCPClientX::write(const uint8_t *buffer, size_t size)
   size_t pos; 
   for (pos = 0; pos < size;)
   {
-	if (size - pos < chunkSize) chunkSize = size - pos;
-	int sent = TCPClient::write(&buffer[pos], chunkSize);
-	if (sent == chunkSize)
-	  pos += chunkSize;
+	size_t chunk = (size - pos < chunkSize) ? size - pos : chunkSize;   // only this call's tail is shorter
+	int    sent  = TCPClient::write(&buffer[pos], chunk);
+	if (sent > 0)
+	  pos += sent;
 	else if (sent == -16) 
 	  for (uint32_t ms = millis(); millis() - ms < flushDelayTime; Particle.process());
+	else
+	  break;
   }
 	return pos;
 }
@@ -240,7 +255,7 @@ long prepareCam(uCamIII_SNAP_TYPE snap    = uCamIII_SNAP_RAW,
                 uCamIII_CBE contrast      = uCamIII_DEFAULT,
                 uCamIII_CBE brightness    = uCamIII_DEFAULT,
                 uCamIII_CBE exposure      = uCamIII_DEFAULT,
-                uCamIII_callback callback = NULL);
+                const uCamIII_Sink& sink  = uCamIII_Sink());
 
 uCamIII<USARTSerial> ucam(Serial1, A0, 500);                        // use HW Serial1 and A0 as reset pin for uCamIII
 // or
@@ -249,7 +264,10 @@ uCamIII<USARTSerial> ucam(Serial1, A0, 500);                        // use HW Se
 // ParticleSoftSerial pss(D0, D1);
 // uCamIII<ParticleSoftSerial> ucam(pss);
 
-uint8_t     imageBuffer[160*120*2 + 134];                           // max raw image 160x120x2byte + max BMP header size
+// images are assembled in place in a pool slot: max raw image 160x120x2byte + max BMP header size,
+// JPEGs that don't fit are refused instead of overwriting the slot (more slots keep older images too)
+uCamIII_FramePoolBuffer<1, 160*120*2 + 134> framePool;
+uCamIII_Frame *lastFrame     = NULL;                                // leased until the next snapshot
 int         imageSize     = 0;
 int         imageType     = uCamIII_TYPE_SNAPSHOT;                  // default for the demo 
                                                                     // alternative: _TYPE_RAW & _TYPE_JPEG
@@ -269,10 +287,21 @@ char        nonce[34];
 #elif Wiring_Cellular
   TCPClientX client( 512, 100);
 #endif
-uCamIII_callback snapTarget = callbackSerial;
+uint8_t          netRing[2048];                                     // camera packages waiting for the network
+uCamIII_Pipeline netPipe(netRing, sizeof(netRing), uCamIII_Sink(sinkTCP, &client));
+uCamIII_FrameWriter netFrames(netPipe.sink());                      // header + CRC per image, connection stays open
+bool             snapTCP = false;
+uCamIII_Sink     snapTarget(sinkSerial, &Serial);                   // sinks get their target as context
+
+uint8_t          motionBackground[80 * 60];
+uCamIII_Motion   motion(motionBackground);                          // cheap probes gate the JPEGs
+uint32_t         watchMs = 0;                                       // probe interval, 0 = off
+uCamIII_JpegParser jpegParser;                                      // JPEGs end at EOI, broken ones are caught
+#if uCamIII_SPOOL_POSIX
+uCamIII_Spool    spool(256 * 1024, 24 * 3600);                      // frames the uplink wasn't there for, a day at most
+#endif
 
 int         sendImageTCP(const uint8_t *buf, int len, int chunkSize = 512, uint32_t flushTime = 100);
-int         bmpHeader(uint8_t *buf, int len, int width, int height, int bits, int encoding = 0, int padding = 0);
 
 void setup() {
   Time.zone(+2.0);
@@ -280,9 +309,16 @@ void setup() {
   Particle.function("setServer", devicesHandler);
   Particle.function("setTarget", setSnapshotTarget);
   Particle.function("snap", takeSnapshot);
+  Particle.function("resend", resendSnapshot);
+  Particle.function("watch", watchScene);
 
   pinMode(D7, OUTPUT);
   ucam.init(115200);
+  ucam.setJpegParser(&jpegParser);
+#if uCamIII_SPOOL_POSIX
+  spool.setClock([]() -> uint32_t { return Time.now(); });
+  spool.open("/uCamIII.spool");                                     // what was left before a reset is still there
+#endif
 
 #if Wiring_WiFi
   strncpy(lIP, String(WiFi.localIP()), sizeof(lIP));
@@ -297,6 +333,34 @@ void setup() {
 
 void loop() {
   static uint32_t msSend = 0;    
+  static uint32_t msWatch = 0;
+  static uint32_t msSpool = 0;
+
+  if (watchMs && millis() - msWatch >= watchMs)
+  {
+    msWatch = millis();
+    if (motion.check(ucam))                                         // 4800 bytes instead of a full JPEG
+    {
+      int x, y, w, h;
+      motion.getBox(x, y, w, h, 640, 480);
+      Log.info("motion in %d blocks around %d,%d %dx%d", motion.getChanged(), x, y, w, h);
+      takeSnapshot("JPG");
+    }
+  }
+
+#if uCamIII_SPOOL_POSIX
+  if (serverPort && spool.getCount() && (spool.isForwarding() || millis() - msSpool >= 1000))
+  {                                                                 // forward what piled up while the uplink was down
+    msSpool = millis();
+    if (spool.drain(netFrames, 1, &netPipe) < 0)                    // a record goes once netPipe has sent all of it
+    {
+      netFrames.reset();
+      netPipe.reset();
+      client.stop();
+      spool.rewind();                                               // that frame goes again next time
+    }
+  }
+#endif
 
 #if Wiring_WiFi
   char buff[64];
@@ -325,11 +389,13 @@ int setSnapshotTarget(String target)
 {
   if (target.equalsIgnoreCase("tcp"))
   {
-    snapTarget = callbackTCP;
+    snapTarget = netFrames.sink();                          // next package arrives while the last one is sent
+    snapTCP    = true;
     return 1;
   }
   else 
-    snapTarget = callbackSerial;                            // default to Serial
+    snapTarget = uCamIII_Sink(sinkSerial, &Serial);         // default to Serial
+  snapTCP = false;
     
   return 0;
 }
@@ -355,32 +421,41 @@ int takeSnapshot(String format)
 
   if (retVal <= 0) return retVal;
   
+  framePool.release(lastFrame);                                 // the slot may be reused now
+  lastFrame = NULL;
   if (retVal = imageSize = ucam.getPicture((uCamIII_PIC_TYPE)imageType))
   {
     Log.info("\r\nImageSize: %d", imageSize);
 
-    if (imageType == uCamIII_SNAP_JPEG)
-      for (int received = 0, chunk = 0; (received < imageSize) && (chunk = ucam.getJpegData(&imageBuffer[constrain(received, 0, sizeof(imageBuffer)-512)], 512, snapTarget)); received += chunk);
-    else if (imageSize <= sizeof(imageBuffer)) 
+    if (snapTCP && imageType == uCamIII_SNAP_JPEG) netFrames.begin(ucam);  // JPEG size is known by now
+    uCamIII_Frame *frame = readImage(snapTarget);
+    if (!frame)
+      retVal = 0;
+    else if (imageType != uCamIII_SNAP_JPEG)                    // a BMP, sent once it's complete
     {
-      int offset = bmpHeader(imageBuffer, sizeof(imageBuffer), imageWidth, imageHeight, imagePxDepth);
-      retVal     = ucam.getRawData(&imageBuffer[offset], imageSize, NULL);
+      if (snapTCP) netFrames.begin(frame->format, frame->resolution, frame->len, frame->ms, uCamIII_FRAME_BMP);
+      if (!sinkAll(snapTarget, frame->data, frame->len)) retVal = 0;
+    }
+    lastFrame = framePool.lease();                              // keep it for resendSnapshot()
 
-      if (imagePxDepth == 16) 
-      {
-        for (int i = offset; i < imageSize + offset; i += 2)    // raw image comes big-endian and upside down from cam,
-        {                                                       // this block corrects endianness
-          uint8_t dmy = imageBuffer[i];
-          imageBuffer[i] = imageBuffer[i+1];
-          imageBuffer[i+1] = dmy;
-        }
+    if (snapTCP)
+    {
+      // a JPEG that ended early at its EOI leaves the frame open, end() pads it to the size announced
+      bool sent = frame ? netFrames.end() : (netFrames.flush() && !netFrames.isOpen());
+      if (!sent || !netPipe.flush())
+      {                                                         // broken frame, start over on a new connection
+        retVal = 0;
+        netFrames.reset();
+        netPipe.reset();
+        client.stop();
+#if uCamIII_SPOOL_POSIX
+        if (frame && spool.store(frame->data, frame->len, frame->format, frame->resolution, frame->ms,
+                                 frame->format == uCamIII_COMP_JPEG ? 0 : uCamIII_FRAME_BMP))
+          retVal = frame->len;                                  // spooled, goes out once the uplink is back
+#endif
       }
-      snapTarget(imageBuffer, imageSize + offset, 0);
     }
 
-    if (client.connected())                                     // if the TCP client would still be connected
-      client.stop();                                            // stop the connection
-
     digitalWrite(D7, LOW);
 
     return retVal;
@@ -389,17 +464,79 @@ int takeSnapshot(String format)
   return 0;
 }
 
+int watchScene(String interval)
+{
+  Log.trace(__FUNCTION__); 
+
+  watchMs = interval.toInt();
+  motion.reset();                                               // learn the scene from the next probe on
+  return watchMs;
+}
+
+int resendSnapshot(String dummy)
+{
+  Log.trace(__FUNCTION__); 
+
+  if (!lastFrame) return 0;
+  if (snapTCP) netFrames.begin(lastFrame->format, lastFrame->resolution, lastFrame->len, lastFrame->ms, 
+                               lastFrame->format == uCamIII_COMP_JPEG ? 0 : uCamIII_FRAME_BMP);
+  if (!sinkAll(snapTarget, lastFrame->data, lastFrame->len)) return 0;
+  if (snapTCP && (!netFrames.flush() || !netPipe.flush())) return 0;
+  return lastFrame->len;
+}
+
+// read the image announced by getPicture() into a pool slot: JPEG packages land in place 
+// and go on to jpegSink as they arrive, raw images get a BMP header and their byte order
+// fixed - returns NULL if the image doesn't fit a slot or didn't arrive completely
+uCamIII_Frame* readImage(const uCamIII_Sink& jpegSink)
+{
+  if (imageType == uCamIII_SNAP_JPEG)
+  {
+    framePool.setOutput(jpegSink);
+    if (!framePool.begin(ucam))
+    {
+      ucam.skipImage();                                         // refused (too big/no free slot), end the transfer
+      return NULL;
+    }
+    while (framePool.isFilling() && ucam.getJpegData(framePool.next(), framePool.room(), framePool.sink()));
+    return framePool.end(ucam);                                 // the JPEG may have ended early at EOI
+  }
+
+  uint8_t header[134];
+  int     offset = uCamIII_Encoder::bmpHeader(header, sizeof(header), imageWidth, imageHeight, imagePxDepth);
+
+  framePool.setOutput(uCamIII_Sink());
+  if (!framePool.begin(ucam.getImageFormat(), ucam.getResolution(), imageSize + offset))
+  {
+    ucam.skipImage();                                           // the camera sends it anyway, drain it
+    return NULL;
+  }
+  framePool.write(header, offset, 0);
+  ucam.getRawData(framePool.next(), framePool.room(), framePool.sink());
+
+  uCamIII_Frame *frame = framePool.end();
+  if (frame && imagePxDepth == 16) 
+  {
+    for (int i = offset; i < frame->len; i += 2)                // raw image comes big-endian and upside down from cam,
+    {                                                           // this block corrects endianness
+      uint8_t dmy = frame->data[i];
+      frame->data[i] = frame->data[i+1];
+      frame->data[i+1] = dmy;
+    }
+  }
+  return frame;
+}
+
 long prepareCam(uCamIII_SNAP_TYPE snap, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res, 
                  uCamIII_CBE contrast, uCamIII_CBE brightness, uCamIII_CBE exposure,
-                 uCamIII_callback callback)
+                 const uCamIII_Sink& sink)
 {
   int retVal = 0;
   
   digitalWrite(D7, HIGH);
 
-  ucam.hardReset();
-
-  if (!(retVal = ucam.sync())) return -1;
+  // only syncs (or resets) when the link may have been lost, unchanged settings aren't resent
+  if (!(retVal = ucam.ensureSync())) return -1;
   
   if (!(retVal = ucam.setImageFormat(fmt, res))) return -2;
   
@@ -411,7 +548,7 @@ long prepareCam(uCamIII_SNAP_TYPE snap, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES re
   imageTime = Time.now();
 
   if (fmt == uCamIII_COMP_JPEG) 
-    if (!(retVal = ucam.setPackageSize(512))) return -4;
+    if (!(retVal = ucam.setPackageSize(uCamIII_PACKAGE_AUTO))) return -4;
 
   // if we made it to here, we can set the global image variables accordingly 
   imageType = snap;             
@@ -466,33 +603,47 @@ long prepareCam(uCamIII_SNAP_TYPE snap, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES re
   return retVal;
 }
 
-int callbackSerial(uint8_t *buf, int len, int id)
+// sinks return the bytes they took, uCamIII_SINK_BUSY to have the library hold off and
+// offer the data again or uCamIII_SINK_ABORT to stop the transfer
+int sinkSerial(void *context, uint8_t *buf, int len, int id)
 {
   Log.info("Package %d (%d Byte) -> Serial", id, len);
   
-  return Serial.write(buf, len);
+  return ((Stream*)context)->write(buf, len);
 }
 
-int callbackTCP(uint8_t *buf, int len, int id)
+int sinkTCP(void *context, uint8_t *buf, int len, int id)
 {
+  TCPClient *tcp = (TCPClient*)context;
+
   Log.info("Package %d (%d Byte) -> TCP %s:%d", id, len, (const char*)serverAddr.toString(), serverPort);
 
-  if (serverPort)
+  if (!serverPort) return uCamIII_SINK_ABORT;                   // nobody to send the image to
+  if (!tcp->connected() && !tcp->connect(serverAddr, serverPort)) return uCamIII_SINK_ABORT;
+  int sent = tcp->TCPClient::write(buf, len);                   // no busy-waiting, the library holds off instead
+  if (sent == -16) return uCamIII_SINK_BUSY;                    // TX buffer full
+  return sent < 0 ? uCamIII_SINK_ABORT : sent;
+}
+
+// write a whole buffer through a sink, e.g. a raw image assembled in a pool slot
+bool sinkAll(const uCamIII_Sink& sink, uint8_t *buf, int len)
+{
+  for (uint32_t ms = millis(); len > 0 && millis() - ms < 5000; Particle.process())
   {
-    if (!client.connected()) 
-      client.connect(serverAddr, serverPort);
-    return client.write(buf, len);
+    int n = sink.write(buf, len, 0);
+    if (n < 0) return false;
+    buf += n;
+    len -= n;
   }
-  
-  return 0;
+  return len <= 0;
 }
 
 // ------------------------------------------------------------------------------------------------------------------------
 #if Wiring_WiFi // ---------------------------  only available for WiFi devices -------------------------------------------
 
-int callbackWebServer(uint8_t *buf, int len, int id) 
+int sinkWebServer(void *context, uint8_t *buf, int len, int id) 
 {
-  return webserver.write(buf, len);
+  return ((WebServer*)context)->write(buf, len);
 }
 
 void defaultCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
@@ -566,165 +717,20 @@ void imageCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail,
 {
   Log.trace(__FUNCTION__); 
 
+  framePool.release(lastFrame);
+  lastFrame = NULL;
   if (imageSize = ucam.getPicture((uCamIII_PIC_TYPE)imageType))
   {
     Log.info("\r\nImageSize: %d", imageSize);
 
-    if (imageType == uCamIII_SNAP_JPEG)
-    {
-      Log.info("get JPEG chunks");
-      for (int received = 0, chunk = 0; (received < imageSize) && (chunk = ucam.getJpegData(&imageBuffer[constrain(received, 0, sizeof(imageBuffer)-512)], 512, callbackWebServer)); received += chunk);
-    }
-    else if (imageSize <= sizeof(imageBuffer)) 
-    {
-      Log.info("get RAW image");
-
-      int offset = bmpHeader(imageBuffer, sizeof(imageBuffer), imageWidth, imageHeight, imagePxDepth);
-Log.trace("after bmpHeader (%d)", offset);
-      int size   = ucam.getRawData(&imageBuffer[offset], imageSize, NULL);
-Log.trace("after getRawData (%d)", size);
-
-      if (imagePxDepth == 16) 
-      {
-        for (int i = offset; i < imageSize + offset; i += 2)    // raw image comes big-endian and upside down from cam,
-        {                                                       // this block corrects endianness
-          uint8_t dmy = imageBuffer[i];
-          imageBuffer[i] = imageBuffer[i+1];
-          imageBuffer[i+1] = dmy;
-        }
-      }
-        
-Log.trace("before server write (%d + %d = %d / %d == %d)", imageSize, offset, imageSize + offset, imageSize, size);
-      server.write(imageBuffer, imageSize + offset);
-Log.trace("after server write (%d + %d = %d / %d == %d)", imageSize, offset, imageSize + offset, imageSize, size);
-    }
-else
-{
-Log.trace("raw too big for buffer %d <= %d", imageSize, sizeof(imageBuffer));
-}
+    uCamIII_Frame *frame = readImage(uCamIII_Sink(sinkWebServer, &server));
+    if (frame && imageType != uCamIII_SNAP_JPEG)
+      server.write(frame->data, frame->len);
+    else if (!frame)
+      Log.warn("image of %d bytes didn't fit or arrive (slot %ld bytes)", imageSize, framePool.getSlotSize());
+    lastFrame = framePool.lease();
     digitalWrite(D7, LOW);
   }
-  
-  //server.write(imageBuffer, imageSize);
 }
 #endif
 // ------------------------------------------------------------------------------------------------------------------------
-
-// -------------------------------------   helper function for bitmap headers   -------------------------------------------
-struct BITMAPFILEHEADER 
-{
-  uint16_t   bfType;            // file type BM (0x424d)                        [  0]
-  uint32_t   bfSize;            // file size all together                       [  2]
-  uint16_t   bfReserved1;       //                                              [  6]
-  uint16_t   bfReserved2;       //                                              [  8]
-  uint32_t   bfOffBits;         // offset of actual image data                  [ 10]
-} __attribute__((__packed__));  //                                              ( 14)
-
-// https://msdn.microsoft.com/en-us/library/windows/desktop/dd183381(v=vs.85).aspx
-struct BITMAPV5HEADER
-{
-  // --------------------------------------------------------------------------
-  // legacy BITMAPINFOHEADER: 
-  uint32_t Size;              // Size of this header in bytes               [  0][ 14]
-  int32_t  Width;             // Image width in pixels                      [  4][ 18]
-  int32_t  Height;            // Image height in pixels                     [  8][ 22]
-  uint16_t Planes;            // Number of color planes                     [ 12][ 26]
-  uint16_t BitsPerPixel;      // Number of bits per pixel                   [ 14][ 28]
-  uint32_t Compression;       // Compression methods used                   [ 16][ 30]
-  uint32_t SizeOfBitmap;      // Size of bitmap in bytes                    [ 20][ 34]
-  int32_t  HorzResolution;    // Horizontal resolution in pixels per meter  [ 24][ 38] 
-  int32_t  VertResolution;    // Vertical resolution in pixels per meter    [ 28][ 42]
-  uint32_t ColorsUsed;        // Number of colors in the image              [ 32][ 46]
-  uint32_t ColorsImportant;   // Minimum number of important colors         [ 36][ 50]
-  // --------------------------------------------------------------------   ( 40)( 54)
-  // Fields added for V2:
-  uint32_t RedMask;           // Mask identifying bits of red component     [ 40][ 54]
-  uint32_t GreenMask;         // Mask identifying bits of green component   [ 44][ 58]
-  uint32_t BlueMask;          // Mask identifying bits of blue component    [ 48][ 62]
-  // --------------------------------------------------------------------   ( 52)( 66)
-  // Fields added for V3:
-  uint32_t AlphaMask;         // Mask identifying bits of alpha component   [ 52][ 66]
-/*// --------------------------------------------------------------------   ( 56)( 70)
-  // Fields added for V4:
-  uint32_t CSType;            // Color space type                           [ 56][ 70]
-  int32_t  RedX;              // X coordinate of red endpoint               [ 60][ 74]
-  int32_t  RedY;              // Y coordinate of red endpoint               [ 64][ 78]
-  int32_t  RedZ;              // Z coordinate of red endpoint               [ 68][ 82]
-  int32_t  GreenX;            // X coordinate of green endpoint             [ 72][ 86]
-  int32_t  GreenY;            // Y coordinate of green endpoint             [ 76][ 90]
-  int32_t  GreenZ;            // Z coordinate of green endpoint             [ 80][ 94]
-  int32_t  BlueX;             // X coordinate of blue endpoint              [ 84][ 98]
-  int32_t  BlueY;             // Y coordinate of blue endpoint              [ 88][102]
-  int32_t  BlueZ;             // Z coordinate of blue endpoint              [ 92][106]
-  uint32_t GammaRed;          // Gamma red coordinate scale value           [ 96][110]
-  uint32_t GammaGreen;        // Gamma green coordinate scale value         [100][114]
-  uint32_t GammaBlue;         // Gamma blue coordinate scale value          [104][118]
-  // --------------------------------------------------------------------   (108)(122)
-  // Fields added for V5:
-  uint32_t Intent;            //                                            [108][122]
-  uint32_t ProfileData;       //                                            [112][126]
-  uint32_t ProfileSize;       //                                            [116][130]
-  uint32_t Reserved;          //                                            [120][134]
-*/
-} __attribute__((__packed__));
-
-int bmpHeader(uint8_t *buf, int len, int width, int height, int bits, int encoding, int padding)  
-{  
-  Log.trace(__FUNCTION__); 
-
-  uint32_t          headerSize      = sizeof(BITMAPFILEHEADER) 
-                                    + sizeof(BITMAPV5HEADER);
-  uint32_t          paletteSize     = (bits <= 8) ? (1 << (bits+2)) : 0;    // optional palette
-  uint32_t          pixelDataSize   = height * ((width * (bits / 8)) + padding);  
-
-  BITMAPFILEHEADER *bmpFileHeader   = (BITMAPFILEHEADER*)buf;
-  BITMAPV5HEADER   *bmpInfoHeader   = (BITMAPV5HEADER*)(buf + sizeof(BITMAPFILEHEADER));
-  uint8_t          *bmpPalette      = buf + headerSize; 
-
-  if (len < headerSize + paletteSize) return 0;
-
-  /// ToDo: where do we set encoding R5G6B5 vs. CrYCbY?
-
-  memset(bmpFileHeader, 0, sizeof(BITMAPFILEHEADER));
-  bmpFileHeader->bfType              = 0x4D42;                               // magic number "BM"
-  bmpFileHeader->bfSize              = headerSize 
-                                     + paletteSize
-                                     + pixelDataSize;
-  //bmpFileHeader->bfReserved1         =
-  //bmpFileHeader->bfReserved2         = 0;
-  bmpFileHeader->bfOffBits           = headerSize
-                                     + paletteSize;
-
-  memset(bmpInfoHeader, 0, sizeof(BITMAPV5HEADER));
-  bmpInfoHeader->Size                = sizeof(BITMAPV5HEADER);  
-  bmpInfoHeader->Width               = width;                               
-  bmpInfoHeader->Height              = -height;                              // negative height flips vertically
-                                                                            // so image isn't upside down 
-                                                                            // but Google Chorme doesn't support that!!! 
-  bmpInfoHeader->Planes              = 1;  
-  bmpInfoHeader->BitsPerPixel        = bits;  
-  //bmpInfoHeader->Compression         = 0; 
-  bmpInfoHeader->SizeOfBitmap        = 0x03;                                 // BI_RGB (0), BI_BITFIELD (3)
-  bmpInfoHeader->HorzResolution      = 0x1000; 
-  bmpInfoHeader->VertResolution      = 0x1000; 
-  bmpInfoHeader->ColorsUsed          =     
-  bmpInfoHeader->ColorsImportant     = (bits <= 8) ? (1 << bits) : 0;        // <= 8bit use color palette
-  if (bits == 16)
-  {  
-    bmpInfoHeader->RedMask           = 0x0000f800;
-	bmpInfoHeader->GreenMask         = 0x000007e0;
-	bmpInfoHeader->BlueMask          = 0x0000001f;
-  }
-
-  for (int c = 0; c < bmpInfoHeader->ColorsUsed; c++)                         // grayscale color table
-  {
-    uint8_t color = 255 * c / (bmpInfoHeader->ColorsUsed - 1);
-    *(bmpPalette++) = color;
-    *(bmpPalette++) = color;
-    *(bmpPalette++) = color;
-    *(bmpPalette++) = 0xFF;
-  }
-  Log.trace("BMP data offset: %d + %d + %d = %d, BMP file size: %d",  
-    sizeof(BITMAPFILEHEADER), sizeof(BITMAPV5HEADER), paletteSize, bmpFileHeader->bfOffBits, bmpFileHeader->bfSize);
-  return bmpFileHeader->bfOffBits;
-}  
@@ -0,0 +1,105 @@
+#include "Arduino.h"
+
+static uint64_t         clockUs      = 0;
+static HostWakeSource  *wakeSources  = NULL;
+static void           (*pinHook)(int pin, int mode, int value) = NULL;
+static int              pinModes[64];
+
+Logger                  Log;
+
+// ------------------------------------ virtual clock ------------------------------------
+
+HostWakeSource::HostWakeSource() : _next(wakeSources)
+{
+  wakeSources = this;
+}
+
+HostWakeSource::~HostWakeSource()
+{
+  for (HostWakeSource **p = &wakeSources; *p; p = &(*p)->_next)
+    if (*p == this) { *p = _next; break; }
+}
+
+uint64_t hostMicros()
+{
+  return clockUs;
+}
+
+void hostAdvanceTo(uint64_t us)
+{
+  if (us > clockUs) clockUs = us;
+}
+
+void hostIdleUntil(uint64_t deadlineUs)
+{
+  uint64_t next = deadlineUs;
+  for (HostWakeSource *s = wakeSources; s; s = s->_next)
+  {
+    uint64_t t = s->nextEventMicros();
+    if (t > clockUs && t < next) next = t;
+  }
+  hostAdvanceTo(next > clockUs ? next : clockUs + 1);
+}
+
+void hostSetPinHook(void (*hook)(int pin, int mode, int value))
+{
+  pinHook = hook;
+}
+
+void pinMode(int pin, int mode)
+{
+  if (pin >= 0 && pin < (int)(sizeof(pinModes) / sizeof(pinModes[0]))) pinModes[pin] = mode;
+  if (pinHook) pinHook(pin, mode, -1);
+}
+
+void digitalWrite(int pin, int value)
+{
+  if (pinHook) pinHook(pin, pin >= 0 && pin < 64 ? pinModes[pin] : OUTPUT, value);
+}
+
+// ------------------------------------ Print/Stream -------------------------------------
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size-- && write(*buffer++)) n++;
+  return n;
+}
+
+int Stream::timedRead()
+{
+  uint64_t deadline = hostMicros() + _timeout * 1000ULL;
+  int      c;
+
+  while ((c = read()) < 0 && hostMicros() < deadline)
+    hostIdleUntil(deadline);
+  return c;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+  size_t count = 0;
+  int    c;
+
+  while (count < length && (c = timedRead()) >= 0)
+    buffer[count++] = (char)c;
+  return count;
+}
+
+// ------------------------------------ Log ----------------------------------------------
+
+static void logPrint(LogLevel lvl, const char *tag, const char *fmt, va_list args)
+{
+  if (lvl < Log.level) return;
+  fprintf(stderr, "%10.3f %s ", clockUs / 1000.0, tag);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+}
+
+#define LOG_FORWARD(name, lvl, tag) \
+  void Logger::name(const char *fmt, ...) const { va_list a; va_start(a, fmt); logPrint(lvl, tag, fmt, a); va_end(a); }
+
+LOG_FORWARD(trace, LOG_LEVEL_TRACE, "TRACE")
+LOG_FORWARD(info,  LOG_LEVEL_INFO,  "INFO ")
+LOG_FORWARD(warn,  LOG_LEVEL_WARN,  "WARN ")
+LOG_FORWARD(error, LOG_LEVEL_ERROR, "ERROR")
@@ -0,0 +1,110 @@
+/* *************************************************************************************
+
+Minimal Arduino core stand-in for building the uCamIII library on a Linux host.
+
+Only what the library actually uses is provided: `Print`/`Stream`, `millis()`/`micros()`/
+`delay()`, the pin functions used by `hardReset()` and a `Log` object with the 
+Particle `Logger` interface.
+
+Time is simulated: `millis()`/`micros()` read a virtual clock that only advances 
+through `delay()`/`delayMicroseconds()` or while a `Stream` waits for data. 
+Devices (e.g. `uCamIII_Emulator`) register as `HostWakeSource` so that a blocking read 
+jumps straight to the moment the next byte arrives instead of spinning.
+This keeps benchmark runs deterministic and independent of host load.
+
+************************************************************************************* */
+
+#ifndef _HOST_ARDUINO_h_
+#define _HOST_ARDUINO_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#define LOW     0
+#define HIGH    1
+#define INPUT   0
+#define OUTPUT  1
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef uint8_t byte;
+
+// ------------------------------------ virtual clock ------------------------------------
+
+class HostWakeSource {
+public:
+  HostWakeSource();
+  virtual ~HostWakeSource();
+  virtual uint64_t  nextEventMicros() = 0;                      // absolute time of next pending event, UINT64_MAX if none
+  HostWakeSource   *_next;
+};
+
+uint64_t            hostMicros();
+void                hostAdvanceTo(uint64_t us);                 // never moves backwards
+void                hostIdleUntil(uint64_t deadlineUs);         // jump to next wake source event but not past deadline
+void                hostSetPinHook(void (*hook)(int pin, int mode, int value));
+
+inline uint32_t     millis()                                    { return (uint32_t)(hostMicros() / 1000); }
+inline uint32_t     micros()                                    { return (uint32_t)hostMicros(); }
+inline void         delay(uint32_t ms)                          { hostAdvanceTo(hostMicros() + ms * 1000ULL); }
+inline void         delayMicroseconds(uint32_t us)              { hostAdvanceTo(hostMicros() + us); }
+
+void                pinMode(int pin, int mode);
+void                digitalWrite(int pin, int value);
+
+// ------------------------------------ Print/Stream -------------------------------------
+
+class Print {
+public:
+  virtual          ~Print() { }
+  virtual size_t    write(uint8_t c) = 0;
+  virtual size_t    write(const uint8_t *buffer, size_t size);
+  size_t            write(const char *str)                      { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+};
+
+class Stream : public Print {
+public:
+  Stream() : _timeout(1000) { }
+  virtual int       available() = 0;
+  virtual int       read() = 0;
+  virtual int       peek() = 0;
+  virtual void      flush() { }
+
+  void              setTimeout(unsigned long timeout)           { _timeout = timeout; }
+  size_t            readBytes(char *buffer, size_t length);
+  size_t            readBytes(uint8_t *buffer, size_t length)   { return readBytes((char*)buffer, length); }
+
+protected:
+  unsigned long     _timeout;
+  int               timedRead();
+};
+
+// ------------------------------------ Log ----------------------------------------------
+
+enum LogLevel
+{ LOG_LEVEL_ALL             = 1
+, LOG_LEVEL_TRACE           = 1
+, LOG_LEVEL_INFO            = 30
+, LOG_LEVEL_WARN            = 40
+, LOG_LEVEL_ERROR           = 50
+, LOG_LEVEL_NONE            = 70
+};
+
+class Logger {
+public:
+  Logger() : level(LOG_LEVEL_NONE) { }
+  void              trace(const char *fmt, ...) const;
+  void              info(const char *fmt, ...) const;
+  void              warn(const char *fmt, ...) const;
+  void              error(const char *fmt, ...) const;
+
+  LogLevel          level;
+};
+
+extern Logger       Log;
+
+#endif
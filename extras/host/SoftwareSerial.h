@@ -0,0 +1 @@
+// intentionally empty - uCamIII.h includes it for Arduino targets
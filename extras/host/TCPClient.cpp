@@ -0,0 +1,37 @@
+#include "TCPClient.h"
+
+size_t TCPClient::write(const uint8_t *buffer, size_t size)
+{
+  size_t n;
+
+  if (!_connected) return 0;
+  drain();
+  n = _txBuffer - _buffered;
+  if (!n) return (size_t)-16;                                   // like the Particle firmware: TX buffer full
+  if (n > size) n = size;
+  _received.insert(_received.end(), buffer, buffer + n);
+  _buffered += n;
+  return n;
+}
+
+uint64_t TCPClient::drainedMicros()
+{
+  drain();
+  return _lastUs + _buffered * 1000000ULL / _rate;
+}
+
+// bytes sent since the last look, whole bytes only so no time is lost to rounding
+void TCPClient::drain()
+{
+  uint64_t now  = hostMicros();
+  uint64_t sent = (now - _lastUs) * _rate / 1000000ULL;
+
+  if (sent >= _buffered)
+  {
+    _buffered = 0;
+    _lastUs   = now;
+    return;
+  }
+  _buffered -= sent;
+  _lastUs   += sent * 1000000ULL / _rate;
+}
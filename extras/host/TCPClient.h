@@ -0,0 +1,46 @@
+/* *************************************************************************************
+
+Host side stand-in for Particle's `TCPClient`
+
+A connection to a local receiver with the send path modelled the way the device sees it:
+`write()` copies into a TX buffer of limited size and returns -16 (as `size_t`, like the
+Particle implementation) when that is full, the buffer drains at the link rate in 
+simulated time (see Arduino.h). What has been written is kept for verification.
+
+************************************************************************************* */
+
+#ifndef _HOST_TCPCLIENT_h_
+#define _HOST_TCPCLIENT_h_
+
+#include <vector>
+#include "Arduino.h"
+
+class TCPClient : public Print {
+public:
+  TCPClient(uint32_t bytesPerSec = 100000, size_t txBuffer = 1024)
+  : _rate(bytesPerSec), _txBuffer(txBuffer), _buffered(0), _lastUs(0), _connected(false) { }
+
+  int               connect(const char *host, uint16_t port)    { _connected = true; _lastUs = hostMicros(); return 1; }
+  bool              connected()                                 { return _connected; }
+  void              stop()                                      { _connected = false; }
+
+  virtual size_t    write(uint8_t c)                            { return write(&c, 1); }
+  virtual size_t    write(const uint8_t *buffer, size_t size);
+  using Print::write;
+
+  void              setLink(uint32_t bytesPerSec, size_t txBuffer) { _rate = bytesPerSec; _txBuffer = txBuffer; }
+  uint64_t          drainedMicros();                            // when the last byte written will have left
+  std::vector<uint8_t>& received()                              { return _received; }
+
+protected:
+  uint32_t          _rate;
+  size_t            _txBuffer;
+  size_t            _buffered;                                  // written but not yet sent
+  uint64_t          _lastUs;                                    // _buffered is valid at this time
+  bool              _connected;
+  std::vector<uint8_t> _received;
+
+  void              drain();
+};
+
+#endif
@@ -0,0 +1,1298 @@
+/* *************************************************************************************
+
+uCamBench - capture latency/throughput benchmark against uCamIII_Emulator
+
+Runs the same sequence as the uCamTest example (reset, sync, configure, snapshot, 
+get picture, read data) for every uCamIII_IMAGE_FORMAT x uCamIII_RES x package size
+combination and reports frames/s, bytes/s and per-phase latency in simulated time,
+plus the host CPU time spent per frame.
+
+  ./build/uCamBench [-b baud] [-B switchBaud] [-n frames] [-i interByteUs] [-s syncMisses]
+                    [-c corruptOneIn] [-d dropOneIn] [-k nakOneIn] [-g brokenOneIn] [-f format] [-e pollUs] 
+                    [-J] [-p padding] [-x pixel] [-u] [-R x,y,w,h[,step[,avg]]] [-o bmp|pgm|ppm] [-r] [-S] [-C fps] [-w sinkUs] [-a bytes] [-t entries] [-m cams] 
+                    [-M moveEvery[,noise[,level[,blocks[,learn]]]]] [-N bytesPerSec[:txBuffer]] [-P ringBytes] [-F] [-Q slotBytes] [-H] [-A] 
+                    [-L capacityKB[:upEvery[:maxAgeS]]] [-v]
+
+  -J  check JPEGs with uCamIII_JpegParser while they arrive: the transfer ends at EOI and
+      broken images are given up (-g: one in brokenOneIn JPEGs lacks EOI or has a garbled 
+      header, -p: the emulator pads JPEGs with that many zeros after EOI)
+  -x  convert raw images to gray8, rgb565 (little-endian), rgb888 or bgr888 while reading
+  -u  with -x (or alone) place whole frames bottom-up (getRawData() only)
+  -R  keep only that window of raw images and of that every step-th pixel/row, or with
+      avg 1 the mean of each step x step block (the converter's window, see -x)
+  -o  save the first raw frame of each format/resolution as <format>_<res>.bmp/.pgm/.ppm
+      via uCamIII_Encoder (the pixel format has to suit the container, see -x)
+  -r  read raw images row by row via streamRawData() instead of getRawData()
+  -C  continuous capture via beginContinuous() at fps (0 = back to back) for -n frames per 
+      combination, reports the fps it achieved and frames skipped (-w: sink takes sinkUs)
+  -w  otherwise a slow sink for JPEG, -r and -e: takes at most 256 bytes per call and is 
+      busy for sinkUs after each, so the library has to hold off (backpressure)
+  -a  the sink aborts each capture after that many bytes (JPEG, -r and -e)
+  -S  keep the session (ensureSync() instead of hard reset + sync per frame), unchanged 
+      settings are then answered from the library's cache
+  -B  negotiate this rate via setBaudrate() after init() at -b
+  -e  use the non-blocking engine (beginCapture()/poll()) instead of the blocking calls,
+      calling poll() every pollUs (at least 1, simulated time only moves on while waiting)
+      while it reports no event
+  -m  run each format/resolution (512 byte packages) on that many emulated cameras, first 
+      one camera after the other, then interleaved by uCamIII_Scheduler with a common trigger;
+      finally arm them all and never trigger, each has to report the timeout once asleep
+  -M  motion gating for -n cycles: a 640x480 JPEG every cycle vs. only when an 80x60 gray8 
+      probe compared by uCamIII_Motion (level per pixel, default 12, in at least blocks 
+      8x8 blocks, default 2) shows a change, the emulated scene's object moves every 
+      moveEvery cycles and noise adds +/-noise per pixel; reports bytes and detections
+  -N  send each image (512 byte packages/slices, non-blocking engine) over a simulated TCP
+      link of that rate with a TX buffer of txBuffer bytes (default 1024), once directly 
+      from the sink and once through a uCamIII_Pipeline ring of -P bytes (default 4096), 
+      and compare with camera and network alone
+  -F  with -N send the pipelined images as uCamIII_FrameWriter frames over one connection
+      and check each frame's header, sequence number and CRCs
+  -Q  assemble each image in place in a two slot uCamIII_FramePool of slotBytes per slot
+      (which passes it on to the sink), holding a lease on the newest frame until the next 
+      one is complete, and check the pooled frame against what the sink got
+  -H  capture each format/resolution alternately through uCamIII<serial> and the header-only
+      uCamIII_Core<serial> (blocking calls, 512 byte packages) and compare the host cpu time
+      per image byte of the data transfer
+  -A  add a run with uCamIII_PACKAGE_AUTO to the package sizes: the library tunes the size 
+      from the transfers so far, the column shows "a" and the size it has arrived at
+  -L  store-and-forward: -n captures (-f format, default JPEG, 640x480 or 160x120 raw) go
+      into a uCamIII_Spool of capacityKB in the file uCamBench.spool, the uplink (-N rate,
+      default 90000 B/s) is only up for every upEvery-th capture (default 4) and then 
+      drains the spool as uCamIII_FrameWriter frames through a uCamIII_Pipeline ring of -P
+      bytes; at the end the file is reopened as after a reset and drained, and every frame
+      received is checked against its capture
+  -t  keep a binary trace ring of that many entries and dump it after the first failed capture
+  -v  log (repeat for trace; `make LOG_LEVEL=LOG_LEVEL_TRACE` compiles the trace messages in)
+
+************************************************************************************* */
+
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "uCamIII.h"
+#include "uCamIII_Converter.h"
+#include "uCamIII_Encoder.h"
+#include "uCamIII_Scheduler.h"
+#include "uCamIII_Pipeline.h"
+#include "uCamIII_FrameWriter.h"
+#include "uCamIII_FramePool.h"
+#include "uCamIII_Motion.h"
+#include "uCamIII_JpegParser.h"
+#include "uCamIII_Core.h"
+#include "uCamIII_Spool.h"
+#include "uCamIII_Emulator.h"
+#include "TCPClient.h"
+
+#define RESET_PIN 10
+
+static uint32_t baseBaud = 115200;                              // init() rate
+static uint32_t fastBaud = 0;                                   // setBaudrate() rate if any
+
+static bool     session  = false;                              // -S
+
+// hard reset and sync like prepareCam(), a reset drops the camera back to autodetection
+// with -S only sync when the session cache can't vouch for the link
+static bool resync(uCamIII<uCamIII_Emulator>& ucam, bool sync = true)
+{
+  if (session)
+    return !sync || ucam.ensureSync();
+  if (fastBaud)
+    return ucam.init(baseBaud) && ucam.setBaudrate(fastBaud);
+  ucam.hardReset();
+  return !sync || ucam.sync();
+}
+
+struct Phase 
+{ uint64_t sync, config, snap, picture, data; 
+};
+
+static const struct { uCamIII_IMAGE_FORMAT fmt; const char *name; } formats[] =
+{ { uCamIII_RAW_8BIT,         "RAW8"   }
+, { uCamIII_RAW_16BIT_RGB565, "RGB565" }
+, { uCamIII_RAW_16BIT_CRYCBY, "CrYCbY" }
+, { uCamIII_COMP_JPEG,        "JPEG"   }
+};
+
+static const uCamIII_RES resolutions[] =                        // uCamIII_160x128 shares its value with 160x120
+{ uCamIII_80x60, uCamIII_160x120, uCamIII_320x240, uCamIII_640x480, uCamIII_128x96, uCamIII_128x128 
+};
+
+static std::vector<uint16_t> packageSizes = { 64, 128, 256, 512 };   // -A adds uCamIII_PACKAGE_AUTO
+
+static bool                  streamRows = false;                // raw via streamRawData() row by row
+static uCamIII_Converter    *converter  = NULL;                 // -x/-u
+
+static uCamIII_PIXEL         pixel      = uCamIII_PIXEL_RAW;
+static bool                  bottomUp   = false;
+static int                   win[6]     = { 0, 0, 0, 0, 1, 0 };  // -R x, y, width, height, step, average
+static bool                  parseJpeg  = false;                // -J
+
+// -R reference: the window cut out of the camera's image pixel by pixel, still in camera format
+static std::vector<uint8_t> windowed(const uint8_t *img, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res, int& ow, int& oh)
+{
+  int  w, h, bpp = uCamIII_Base::bytesPerPixel(fmt);
+  bool crycby = (fmt == uCamIII_RAW_16BIT_CRYCBY);
+
+  uCamIII_Base::dimensions(fmt, res, w, h);
+  int s  = std::max(1, std::min(16, win[4]));
+  int x  = std::max(0, std::min(w, win[0]));
+  int y  = std::max(0, std::min(h, win[1]));
+  ow = ((win[2] <= 0 || win[2] > w - x) ? w - x : win[2]) / s;
+  oh = ((win[3] <= 0 || win[3] > h - y) ? h - y : win[3]) / s;
+  if (crycby) { x &= ~1; ow &= ~1; }
+
+  std::vector<uint8_t> out(ow * oh * bpp);
+  for (int oy = 0; oy < oh; oy++)
+    for (int ox = 0; ox < ow; ox++)
+    {
+      int sum[3] = { 0, 0, 0 }, n = (win[5] && s > 1) ? s : 1;
+      for (int dy = 0; dy < n; dy++)
+        for (int dx = 0; dx < n; dx++)
+        {
+          int            px = (y + oy * s + dy) * w + x + ox * s + dx;
+          const uint8_t *p  = img + px * bpp;
+          if (fmt == uCamIII_RAW_16BIT_RGB565)
+          {
+            int v = p[0] << 8 | p[1];
+            sum[0] += v >> 11; sum[1] += (v >> 5) & 0x3F; sum[2] += v & 0x1F;
+          }
+          else if (crycby)
+          {
+            const uint8_t *pair = img + (px & ~1) * 2;
+            sum[0] += p[1]; sum[1] += pair[0]; sum[2] += pair[2];
+          }
+          else
+            sum[0] += p[0];
+        }
+      for (int k = 0; k < 3; k++) sum[k] = (sum[k] + n * n / 2) / (n * n);
+
+      uint8_t *o = &out[(oy * ow + ox) * bpp];
+      if (fmt == uCamIII_RAW_16BIT_RGB565)
+      {
+        int v = sum[0] << 11 | sum[1] << 5 | sum[2];
+        o[0] = v >> 8; o[1] = v;
+      }
+      else if (crycby && !(ox & 1))
+      {
+        o[0] = sum[1]; o[1] = sum[0]; o[2] = sum[2];
+      }
+      else if (crycby)
+      {
+        o[-2] = (o[-2] + sum[1] + 1) >> 1; o[0] = (o[0] + sum[2] + 1) >> 1; o[1] = sum[0];
+      }
+      else
+        o[0] = sum[0];
+    }
+  return out;
+}
+
+// -x/-u reference: the cut converted one pixel at a time straight from the formulas - RGB565 
+// widened by bit replication, gray as (77 R + 150 G + 29 B) / 256, CrYCbY as full range YCbCr 
+// with 8 bit fixed point coefficients - and each row put in its place by index
+static std::vector<uint8_t> converted(const std::vector<uint8_t>& cut, uCamIII_IMAGE_FORMAT fmt, int ow, int oh, bool flip)
+{
+  static const int outBpp[] = { 0, 1, 2, 3, 3 };                // by uCamIII_PIXEL
+  int inBpp = uCamIII_Base::bytesPerPixel(fmt);
+  int bpp   = (pixel == uCamIII_PIXEL_RAW) ? inBpp : outBpp[pixel];
+
+  std::vector<uint8_t> out(ow * oh * bpp);
+  for (int oy = 0; oy < oh; oy++)
+    for (int ox = 0; ox < ow; ox++)
+    {
+      const uint8_t *p = &cut[(oy * ow + ox) * inBpp];
+      uint8_t       *o = &out[((flip ? oh - 1 - oy : oy) * ow + ox) * bpp];
+      int            r, g, b, gray;
+
+      if (pixel == uCamIII_PIXEL_RAW)
+      {
+        memcpy(o, p, bpp);
+        continue;
+      }
+      if (fmt == uCamIII_RAW_8BIT)
+        r = g = b = gray = p[0];
+      else if (fmt == uCamIII_RAW_16BIT_RGB565)
+      {
+        int v = p[0] << 8 | p[1], r5 = v >> 11, g6 = (v >> 5) & 0x3F, b5 = v & 0x1F;
+        r    = r5 << 3 | r5 >> 2;
+        g    = g6 << 2 | g6 >> 4;
+        b    = b5 << 3 | b5 >> 2;
+        gray = (77 * r + 150 * g + 29 * b) >> 8;
+      }
+      else                                                      // Cr/Cb shared by the pixel pair
+      {
+        const uint8_t *pair = &cut[(oy * ow + (ox & ~1)) * 2];
+        int            cr   = pair[0] - 128, cb = pair[2] - 128;
+        gray = p[1];
+        r    = std::max(0, std::min(255, gray + ((359 * cr) >> 8)));
+        g    = std::max(0, std::min(255, gray - ((88 * cb + 183 * cr) >> 8)));
+        b    = std::max(0, std::min(255, gray + ((454 * cb) >> 8)));
+      }
+
+      switch (pixel)
+      {
+        case uCamIII_PIXEL_GRAY8:
+          o[0] = gray;
+          break;
+        case uCamIII_PIXEL_RGB565:                              // little-endian
+        {
+          int v = (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+          o[0] = v; o[1] = v >> 8;
+          break;
+        }
+        case uCamIII_PIXEL_RGB888:
+          o[0] = r; o[1] = g; o[2] = b;
+          break;
+        default:
+          o[0] = b; o[1] = g; o[2] = r;
+          break;
+      }
+    }
+  return out;
+}
+
+// does buffer[0..size) hold what the library should have delivered for the emulator's last image,
+// streamed/engine output is always top-down, only whole frames are placed bottom-up
+static bool matches(uCamIII_Emulator& emu, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res, 
+                    const std::vector<uint8_t>& buffer, long size, bool wholeFrame)
+{
+  if (fmt == uCamIII_COMP_JPEG && parseJpeg)                    // up to EOI, the padding isn't fetched
+    return size == (long)emu.jpegLength() && !memcmp(buffer.data(), emu.image(), size);
+  if (!converter || fmt == uCamIII_COMP_JPEG)
+    return size == (long)emu.imageSize() && !memcmp(buffer.data(), emu.image(), size);
+
+  int                  ow, oh;
+  std::vector<uint8_t> cut      = windowed(emu.image(), fmt, res, ow, oh);
+  std::vector<uint8_t> expected = converted(cut, fmt, ow, oh, bottomUp && wholeFrame);
+  return size == (long)expected.size() && !memcmp(buffer.data(), expected.data(), size);
+}
+
+static const char          *container  = NULL;
+
+static int fileSink(void *context, uint8_t *buffer, int len, int id)
+{
+  int n = fwrite(buffer, 1, len, (FILE*)context);
+  return n ? n : uCamIII_SINK_ABORT;
+}
+
+// write a delivered raw frame as BMP/PGM/PPM through the streaming encoder, row by row
+static bool save(uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res, const char *name, std::vector<uint8_t>& buffer)
+{
+  static const char *names[] = { "bmp", "pgm", "ppm" };
+  uCamIII_Encoder    enc;
+  int                w, h;
+  int                bits = uCamIII_Base::bytesPerPixel(fmt) * 8;
+  char               path[64];
+  FILE              *file;
+  bool               ok   = false;
+
+  if (fmt == uCamIII_COMP_JPEG || !uCamIII_Base::dimensions(fmt, res, w, h)) return false;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    if (!strcasecmp(container, names[i])) enc.setContainer((uCamIII_CONTAINER)i);
+  if (converter && converter->begin(fmt, res)) 
+    ok = enc.begin(*converter);
+  else
+    ok = enc.begin(w, h, bits);
+  if (!ok) return false;
+
+  snprintf(path, sizeof(path), "%s.%s", name, container);
+  if (!(file = fopen(path, "wb"))) return false;
+  uCamIII_Sink sink(fileSink, file);
+  ok = enc.writeHeader(sink) == enc.getHeaderSize();
+  for (int row = 0, rowBytes = (enc.getFileSize() - enc.getHeaderSize()) / h - enc.getRowPadding(); ok && row < h; row++)
+    for (int off = 0, n; ok && off < rowBytes; off += n)       // what the sink didn't take is offered again
+      ok = (n = enc.write(&buffer[row * rowBytes + off], rowBytes - off, sink)) > 0;
+  fclose(file);
+  return ok && enc.isComplete();
+}
+
+// engine/streaming sink, one per target frame: with -w it takes at most sinkBytes per call 
+// and then stays busy for sinkUs (backpressure), with -a it aborts after abortAfter bytes
+static uint32_t sinkUs     = 0;                                 // -w
+static int      sinkBytes  = 256;
+static long     abortAfter = 0;                                 // -a
+
+struct Collector
+{
+  std::vector<uint8_t> *frame;
+  long                  fill;
+  uint64_t              readyUs;
+};
+
+static int collect(void *context, uint8_t *buffer, int len, int id)
+{
+  Collector *c = (Collector*)context;
+
+  if (abortAfter && c->fill >= abortAfter) return uCamIII_SINK_ABORT;
+  if (sinkUs)
+  {
+    if (hostMicros() < c->readyUs) return uCamIII_SINK_BUSY;
+    if (len > sinkBytes) len = sinkBytes;
+    c->readyUs = hostMicros() + sinkUs;
+  }
+  if (c->fill + len <= (long)c->frame->size()) memcpy(&(*c->frame)[c->fill], buffer, len);
+  c->fill += len;
+  return len;
+}
+
+// -Q: the pool assembles the image and passes it on to the collector, the newest frame stays 
+// leased until the next one is complete (like an upload waiting for its acknowledgement)
+static uCamIII_FramePool    *pool       = NULL;
+static uCamIII_Frame        *held       = NULL;
+
+static bool pooled(uCamIII_Base& ucam, const Collector& c)
+{
+  uCamIII_Frame *frame = pool->end(ucam);
+
+  if (!frame) return false;
+  pool->release(held);
+  held = pool->lease();
+  return held == frame && frame->len == c.fill && !memcmp(frame->data, c.frame->data(), frame->len);
+}
+
+static uint64_t cpuNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// one capture cycle like prepareCam() + takeSnapshot() in uCamTest.ino
+static long capture(uCamIII<uCamIII_Emulator>& ucam, uCamIII_Emulator& emu, uCamIII_IMAGE_FORMAT fmt, 
+                    uCamIII_RES res, uint16_t packageSize, std::vector<uint8_t>& buffer, Phase& t)
+{
+  bool     jpeg = (fmt == uCamIII_COMP_JPEG);
+  uint64_t us   = hostMicros();
+  long     size = 0;
+  long     received = 0;
+
+  if (!resync(ucam)) return -1;
+  t.sync += hostMicros() - us; us = hostMicros();
+
+  if (!ucam.setImageFormat(fmt, res)) return -2;
+  ucam.setCBE();
+  if (jpeg && !ucam.setPackageSize(packageSize)) return -4;
+  t.config += hostMicros() - us; us = hostMicros();
+
+  if (!ucam.takeSnapshot(jpeg ? uCamIII_SNAP_JPEG : uCamIII_SNAP_RAW)) return -3;
+  t.snap += hostMicros() - us; us = hostMicros();
+
+  if (!(size = ucam.getPicture(uCamIII_TYPE_SNAPSHOT))) return -5;
+  t.picture += hostMicros() - us; us = hostMicros();
+
+  if (pool)
+  {                                                     // read in place, packages/frame go to the collector from there
+    Collector c = { &buffer, 0, 0 };
+    pool->setOutput(uCamIII_Sink(collect, &c));
+    if (!pool->begin(ucam))
+    {
+      ucam.skipImage();                                 // doesn't fit a slot, end the transfer
+      return -7;
+    }
+    if (jpeg)
+      while (pool->isFilling() && ucam.getJpegData(pool->next(), pool->room(), pool->sink()));
+    else
+      ucam.getRawData(pool->next(), pool->room(), pool->sink());
+    t.data += hostMicros() - us;
+    return (pooled(ucam, c) && matches(emu, fmt, res, buffer, c.fill, !jpeg)) ? size : -6;
+  }
+  if (jpeg)
+  {
+    uint8_t   pkg[512];
+    Collector c = { &buffer, 0, 0 };
+    for (long chunk = 0; received < size && (chunk = ucam.getJpegData(pkg, sizeof(pkg), uCamIII_Sink(collect, &c))); received += chunk);
+  }
+  else if (streamRows)
+  {
+    uint8_t   row[640 * 2];
+    Collector c = { &buffer, 0, 0 };
+    if (ucam.streamRawData(row, sizeof(row), uCamIII_Sink(collect, &c), ucam.getRowBytes()) != size) return -6;
+    received  = c.fill;
+  }
+  else
+    received = ucam.getRawData(buffer.data(), buffer.size());
+  t.data += hostMicros() - us;
+
+  if (!matches(emu, fmt, res, buffer, received, !jpeg && !streamRows)) 
+    return -6;
+  return size;
+}
+
+// the same cycle driven by beginCapture()/poll()
+static long captureEngine(uCamIII<uCamIII_Emulator>& ucam, uCamIII_Emulator& emu, uCamIII_IMAGE_FORMAT fmt, 
+                          uCamIII_RES res, uint16_t packageSize, std::vector<uint8_t>& buffer, Phase& t, 
+                          uint32_t pollUs)
+{
+  uint8_t   chunk[512];
+  uint64_t  us = hostMicros();
+  Collector c  = { &buffer, 0, 0 };
+
+  if (!resync(ucam, false)) return -1;
+  if (pool) pool->setOutput(uCamIII_Sink(collect, &c));        // packages are copied to their place, then collected
+  if (!ucam.beginCapture(fmt, res, chunk, sizeof(chunk), pool ? pool->sink() : uCamIII_Sink(collect, &c), 
+                         uCamIII_TYPE_SNAPSHOT, packageSize)) return -1;
+
+  while (ucam.isBusy())
+  {
+    switch (ucam.poll())
+    {
+      case uCamIII_EVENT_NONE:       delayMicroseconds(pollUs); break;
+      case uCamIII_EVENT_SYNCED:     t.sync    += hostMicros() - us; us = hostMicros(); break;
+      case uCamIII_EVENT_CONFIGURED: t.config  += hostMicros() - us; us = hostMicros(); break;
+      case uCamIII_EVENT_SNAPPED:    t.snap    += hostMicros() - us; us = hostMicros(); break;
+      case uCamIII_EVENT_IMAGE_SIZE: t.picture += hostMicros() - us; us = hostMicros(); 
+                                     if (pool && !pool->begin(ucam)) ucam.abort(); 
+                                     break;
+      default: break;
+    }
+  }
+  t.data += hostMicros() - us;
+
+  long size = ucam.getImageSize();
+  if (ucam.getState() != uCamIII_STATE_DONE || !matches(emu, fmt, res, buffer, c.fill, false)) 
+    return -ucam.getFailedState();
+  if (pool && !pooled(ucam, c)) return -7;
+  return size;
+}
+
+// continuous capture: frames per combination, the sink checks each frame and can be slowed down
+static uCamIII_Emulator *contEmu   = NULL;
+static uCamIII_IMAGE_FORMAT contFmt;
+static uCamIII_RES       contRes;
+static int               contBad   = 0;
+static int               contLeft  = 0;
+
+static int frameSink(uint8_t *buffer, long size, uint32_t seq, uint32_t ms)
+{
+  std::vector<uint8_t> f(buffer, buffer + size);
+  if (!matches(*contEmu, contFmt, contRes, f, size, false)) contBad++;
+  if (sinkUs) delayMicroseconds(sinkUs);
+  return (--contLeft > 0) ? 1 : -1;                             // -1 stops after this frame
+}
+
+static long captureContinuous(uCamIII<uCamIII_Emulator>& ucam, uCamIII_Emulator& emu, uCamIII_IMAGE_FORMAT fmt, 
+                              uCamIII_RES res, uint16_t packageSize, std::vector<uint8_t>& buffer, int frames,
+                              float fps, uint32_t pollUs)
+{
+  contEmu  = &emu;
+  contFmt  = fmt;
+  contRes  = res;
+  contBad  = 0;
+  contLeft = frames;
+  if (!resync(ucam, false)) return -1;
+  if (!ucam.beginContinuous(fmt, res, buffer.data(), buffer.size(), frameSink, fps, packageSize)) return -1;
+
+  while (ucam.isBusy())
+    if (ucam.poll() == uCamIII_EVENT_NONE) delayMicroseconds(pollUs);
+  if (ucam.getState() != uCamIII_STATE_DONE) return -ucam.getFailedState();
+  return ucam.getFrameCount() - contBad;
+}
+
+// multi camera: each camera's chunks go to its own frame
+static std::vector<uint8_t>  camFrame[uCamIII_MAX_CAMERAS];
+
+// `frames` captures per camera, sequentially (one engine after the other) or all at once 
+// through the scheduler; returns the number of frames received intact
+static int captureMulti(std::vector<uCamIII<uCamIII_Emulator>*>& cams, std::vector<uCamIII_Emulator*>& emus,
+                        uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res, int frames, bool interleaved, uint32_t pollUs)
+{
+  uCamIII_Scheduler sched;
+  uint8_t           chunk[uCamIII_MAX_CAMERAS][512];
+  Collector         sink[uCamIII_MAX_CAMERAS];
+  int               ok = 0;
+
+  for (size_t c = 0; c < cams.size(); c++) sched.add(*cams[c]);
+  for (int n = 0; n < frames; n++)
+  {
+    for (size_t c = 0; c < cams.size(); c++)
+    {
+      sink[c].frame   = &camFrame[c];
+      sink[c].fill    = 0;
+      sink[c].readyUs = 0;
+      if (interleaved)
+        sched.capture(c, fmt, res, chunk[c], sizeof(chunk[c]), uCamIII_Sink(collect, &sink[c]), true);
+      else
+      {
+        cams[c]->setExternalTrigger(false);
+        if (!cams[c]->beginCapture(fmt, res, chunk[c], sizeof(chunk[c]), uCamIII_Sink(collect, &sink[c]))) continue;
+        while (cams[c]->isBusy())
+          if (cams[c]->poll() == uCamIII_EVENT_NONE) delayMicroseconds(pollUs);
+      }
+    }
+    if (interleaved)
+    {
+      sched.trigger();
+      while (sched.poll()) delayMicroseconds(pollUs);
+    }
+    for (size_t c = 0; c < cams.size(); c++)
+      if (cams[c]->getState() == uCamIII_STATE_DONE && matches(*emus[c], fmt, res, camFrame[c], sink[c].fill, false)) ok++;
+  }
+  return ok;
+}
+
+// all cameras armed and the trigger never comes: each has to report the timeout once it has
+// fallen asleep, returns the number that did (ERROR in state ARMED)
+static int armedTimeout(std::vector<uCamIII<uCamIII_Emulator>*>& cams, uint32_t pollUs, uint32_t& ms)
+{
+  uCamIII_Scheduler sched;
+  uint8_t           chunk[uCamIII_MAX_CAMERAS][512];
+  uint32_t          start = millis();
+  int               ok    = 0;
+
+  for (size_t c = 0; c < cams.size(); c++)
+  {
+    sched.add(*cams[c]);
+    sched.capture(c, uCamIII_COMP_JPEG, uCamIII_160x120, chunk[c], sizeof(chunk[c]), uCamIII_Sink(), true);
+  }
+  while (sched.poll() && millis() - start < 60000) delayMicroseconds(pollUs);
+  ms = millis() - start;
+  for (size_t c = 0; c < cams.size(); c++)
+    if (sched.getEvent(c) == uCamIII_EVENT_ERROR && cams[c]->getFailedState() == uCamIII_STATE_ARMED) ok++;
+  sched.abort();
+  return ok;
+}
+
+// network: TCPClient::write() semantics mapped onto a uCamIII_Sink
+static int tcpSink(void *context, uint8_t *buffer, int len, int id)
+{
+  int sent = (int)((TCPClient*)context)->write(buffer, len);
+  return sent == -16 ? uCamIII_SINK_BUSY : sent < 0 ? uCamIII_SINK_ABORT : sent;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// is the frame at `offset` of a framed upload intact and is its payload the emulator's image
+static bool unframe(uCamIII_Emulator& emu, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res, uint32_t seq,
+                    const std::vector<uint8_t>& stream, size_t& offset)
+{
+  if (stream.size() < offset + uCamIII_FRAME_HEADER) return false;
+
+  const uint8_t *h   = &stream[offset];
+  uint32_t       len = get32(&h[16]);
+
+  if (memcmp(h, "uC3F", 4) || h[4] != uCamIII_FRAME_VERSION || h[5] != fmt || h[6] != res 
+  || get32(&h[8]) != seq || get32(&h[20]) != uCamIII_FrameWriter::crc32(h, 20)
+  || stream.size() < offset + uCamIII_FRAME_HEADER + len + uCamIII_FRAME_TRAILER
+  || get32(&h[uCamIII_FRAME_HEADER + len]) != uCamIII_FrameWriter::crc32(&h[uCamIII_FRAME_HEADER], len))
+    return false;
+
+  std::vector<uint8_t> payload(&h[uCamIII_FRAME_HEADER], &h[uCamIII_FRAME_HEADER + len]);
+  offset += uCamIII_FRAME_HEADER + len + uCamIII_FRAME_TRAILER;
+  return matches(emu, fmt, res, payload, len, false);
+}
+
+// one capture into `sink` (optionally pumping `pipe`), microseconds from the image size reply
+// until the last byte has left `tcp` (or the camera if there's no network), -1 if the image
+// didn't arrive intact; with `frames` the connection stays open and the frame is checked
+static int64_t captureNet(uCamIII<uCamIII_Emulator>& ucam, uCamIII_Emulator& emu, uCamIII_IMAGE_FORMAT fmt, 
+                          uCamIII_RES res, const uCamIII_Sink& sink, TCPClient *tcp, uCamIII_Pipeline *pipe,
+                          uCamIII_FrameWriter *frames, std::vector<uint8_t>& buffer, long& fill, uint32_t pollUs)
+{
+  uint8_t  chunk[512];
+  uint64_t start = hostMicros();
+  size_t   offset = tcp ? tcp->received().size() : 0;
+  uint32_t seq    = frames ? frames->getSequence() : 0;
+
+  if (tcp && !frames) 
+  {
+    tcp->received().clear();
+    offset = 0;
+  }
+  if (tcp && !tcp->connected()) tcp->connect("127.0.0.1", 5550);
+  if (pipe) pipe->reset();
+  if (frames && (frames->isOpen() || frames->isFailed())) frames->reset();
+  if (!resync(ucam, false)) return -1;
+  if (!ucam.beginCapture(fmt, res, chunk, sizeof(chunk), sink, uCamIII_TYPE_SNAPSHOT, sizeof(chunk))) return -1;
+  while (ucam.isBusy())
+  {
+    uCamIII_EVENT e = ucam.poll();
+    if (e == uCamIII_EVENT_IMAGE_SIZE) start = hostMicros();
+    if (pipe) pipe->pump();
+    if (e == uCamIII_EVENT_NONE) delayMicroseconds(pollUs);
+  }
+  if (frames && !frames->flush()) return -1;
+  if (pipe && !pipe->flush()) return -1;
+  if (ucam.getState() != uCamIII_STATE_DONE) return -1;
+  if (!tcp) return matches(emu, fmt, res, buffer, fill, false) ? (int64_t)(hostMicros() - start) : -1;
+
+  hostAdvanceTo(tcp->drainedMicros());
+  if (frames) return unframe(emu, fmt, res, seq, tcp->received(), offset) ? (int64_t)(hostMicros() - start) : -1;
+  tcp->stop();
+  if (!matches(emu, fmt, res, tcp->received(), tcp->received().size(), false)) return -1;
+  return hostMicros() - start;
+}
+
+static int benchNet(uint32_t rate, int txBuffer, int ringBytes, bool framed, int frames, const char *only, uint32_t pollUs)
+{
+  uCamIII_Emulator          emu(baseBaud);
+  uCamIII<uCamIII_Emulator> ucam(emu, RESET_PIN, 500);
+  TCPClient                 tcp(rate, txBuffer);
+  std::vector<uint8_t>      ring(ringBytes);
+  uCamIII_Pipeline          pipe(ring.data(), ring.size(), uCamIII_Sink(tcpSink, &tcp));
+  std::vector<uint8_t>      buffer(640 * 480 * 2);
+  uCamIII_FrameWriter       writer(pipe.sink());
+  TCPClient                 direct(rate, txBuffer);             // the framed connection stays open
+
+  writer.attach(ucam);
+  emu.attachResetPin(RESET_PIN);
+  if (!ucam.init(baseBaud) || (fastBaud && !ucam.setBaudrate(fastBaud)))
+  {
+    fprintf(stderr, "no sync with emulator\n");
+    return 1;
+  }
+
+  printf("baud %u, network %u B/s (%d byte TX buffer), ring %d bytes%s, %d frame(s), ms per frame from DATA reply (simulated)\n", 
+         ucam.getBaudrate(), rate, txBuffer, ringBytes, framed ? ", framed" : "", frames);
+  printf("%-7s %-8s %7s %8s %8s %8s %8s %8s %6s\n", 
+         "format", "res", "bytes", "camera", "network", "direct", "piped", "speedup", "ring");
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+  {
+    if (only && strcasecmp(only, formats[f].name)) continue;
+    for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++)
+    {
+      int       w, h;
+      char      resName[16];
+      int64_t   cam = 0, sent = 0, piped = 0;
+      Collector c   = { &buffer, 0, 0 };
+      bool      ok  = true;
+
+      uCamIII_Emulator::dimensions(formats[f].fmt, resolutions[r], w, h);
+      snprintf(resName, sizeof(resName), "%dx%d", w, h);
+      for (int n = 0; n < frames && ok; n++)
+      {
+        int64_t t;
+        c.fill = 0;
+        ok = ok && (t = captureNet(ucam, emu, formats[f].fmt, resolutions[r], uCamIII_Sink(collect, &c), 
+                                   NULL, NULL, NULL, buffer, c.fill, pollUs)) >= 0 && ((cam += t), true);
+        ok = ok && (t = captureNet(ucam, emu, formats[f].fmt, resolutions[r], uCamIII_Sink(tcpSink, &direct), 
+                                   &direct, NULL, NULL, buffer, c.fill, pollUs)) >= 0 && ((sent += t), true);
+        ok = ok && (t = captureNet(ucam, emu, formats[f].fmt, resolutions[r], framed ? writer.sink() : pipe.sink(), 
+                                   &tcp, &pipe, framed ? &writer : NULL, buffer, c.fill, pollUs)) >= 0 && ((piped += t), true);
+      }
+      if (!ok)
+      {
+        printf("%-7s %-8s %7s\n", formats[f].name, resName, "n/a");
+        continue;
+      }
+      printf("%-7s %-8s %7u %8.1f %8.1f %8.1f %8.1f %7.2fx %6d\n", formats[f].name, resName, emu.imageSize(),
+             cam / 1e3 / frames, emu.imageSize() * 1e3 / rate, sent / 1e3 / frames, piped / 1e3 / frames, 
+             (double)sent / piped, pipe.getHighWater());
+    }
+  }
+  if (framed)
+  {
+    size_t off = 0, n = 0;
+    while (off + uCamIII_FRAME_HEADER <= tcp.received().size())
+    {
+      off += uCamIII_FRAME_HEADER + get32(&tcp.received()[off + 16]) + uCamIII_FRAME_TRAILER;
+      n++;
+    }
+    printf("\nframed connection: %u frames written, %u bytes, %u frames walked\n", 
+           writer.getFrameCount(), (unsigned)tcp.received().size(), (unsigned)n);
+  }
+  return 0;
+}
+
+// what a frame received from the spool carried, checked against the captures by sequence number
+static bool unspool(const std::vector<std::vector<uint8_t> >& images, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res,
+                    const std::vector<uint8_t>& stream, size_t& offset, uint32_t& seq)
+{
+  if (stream.size() < offset + uCamIII_FRAME_HEADER) return false;
+
+  const uint8_t *h   = &stream[offset];
+  uint32_t       len = get32(&h[16]);
+
+  seq = get32(&h[8]);
+  if (memcmp(h, "uC3F", 4) || h[5] != fmt || h[6] != res || get32(&h[20]) != uCamIII_FrameWriter::crc32(h, 20)
+  || stream.size() < offset + uCamIII_FRAME_HEADER + len + uCamIII_FRAME_TRAILER
+  || get32(&h[uCamIII_FRAME_HEADER + len]) != uCamIII_FrameWriter::crc32(&h[uCamIII_FRAME_HEADER], len))
+    return false;
+  offset += uCamIII_FRAME_HEADER + len + uCamIII_FRAME_TRAILER;
+  return seq < images.size() && images[seq].size() == len && !memcmp(&h[uCamIII_FRAME_HEADER], images[seq].data(), len);
+}
+
+// the uplink is up: drain the spool completely through writer and pipe, returns host cpu ns 
+// spent in drain()
+static uint64_t forward(uCamIII_Spool& spool, uCamIII_FrameWriter& writer, uCamIII_Pipeline& pipe, TCPClient& tcp)
+{
+  uint64_t cpu = 0;
+
+  tcp.connect("127.0.0.1", 5550);
+  writer.reset();
+  pipe.reset();
+  spool.rewind();
+  while (spool.getCount())
+  {
+    uint64_t c = cpuNs();
+    int      r = spool.drain(writer, 0, &pipe);
+    cpu += cpuNs() - c;
+    if (r < 0) break;
+    if (spool.getCount()) delay(1);                             // TX buffer full
+  }
+  hostAdvanceTo(tcp.drainedMicros());
+  tcp.stop();
+  return cpu;
+}
+
+static int benchSpool(uint32_t capacity, int upEvery, uint32_t maxAge, uint32_t rate, int txBuffer, int ringBytes,
+                      int frames, const char *only, uint32_t pollUs)
+{
+  const char               *path = "uCamBench.spool";
+  uCamIII_Emulator          emu(baseBaud);
+  uCamIII<uCamIII_Emulator> ucam(emu, RESET_PIN, 500);
+  uCamIII_Spool             spool(capacity, maxAge);
+  TCPClient                 tcp(rate, txBuffer);
+  std::vector<uint8_t>      ring(ringBytes);
+  uCamIII_Pipeline          pipe(ring.data(), ring.size(), uCamIII_Sink(tcpSink, &tcp));
+  uCamIII_FrameWriter       writer(pipe.sink());
+  uCamIII_IMAGE_FORMAT      fmt  = uCamIII_COMP_JPEG;
+  std::vector<std::vector<uint8_t> > images;                    // by spool sequence number
+  uint8_t                   chunk[512];
+  uint64_t                  cpu = 0;
+  int                       captured = 0, direct = 0, left, got = 0, gaps = 0;
+  uint32_t                  seq, next = 0, forwarded;
+  size_t                    off = 0;
+
+  size_t                    f;
+
+  for (f = 0; only && f < sizeof(formats) / sizeof(formats[0]); f++)
+    if (!strcasecmp(only, formats[f].name)) break;
+  if (only && f == sizeof(formats) / sizeof(formats[0]))
+  {
+    fprintf(stderr, "unknown format %s\n", only);
+    return 1;
+  }
+  if (only) fmt = formats[f].fmt;
+  uCamIII_RES               res  = (fmt == uCamIII_COMP_JPEG) ? uCamIII_640x480 : uCamIII_160x120;
+
+  unlink(path);
+  spool.attach(ucam);
+  emu.attachResetPin(RESET_PIN);
+  if (!spool.open(path)) return 1;
+  if (!ucam.init(baseBaud) || (fastBaud && !ucam.setBaudrate(fastBaud)))
+  {
+    fprintf(stderr, "no sync with emulator\n");
+    return 1;
+  }
+
+  printf("baud %u, spool %s of %u kB (max age %u s), uplink %u B/s up for every %d. capture, %d %s captures\n",
+         ucam.getBaudrate(), path, capacity / 1024, maxAge, rate, upEvery, frames, 
+         fmt == uCamIII_COMP_JPEG ? "JPEG" : "raw");
+  for (int n = 0; n < frames; n++)
+  {
+    bool ok = resync(ucam, false)
+           && ucam.beginCapture(fmt, res, chunk, sizeof(chunk), spool.sink(), uCamIII_TYPE_SNAPSHOT, sizeof(chunk));
+    while (ok && ucam.isBusy())
+      if (ucam.poll() == uCamIII_EVENT_NONE) delayMicroseconds(pollUs);
+    if (spool.end(ok && ucam.getState() == uCamIII_STATE_DONE) && spool.getSequence() > images.size())
+    {
+      images.resize(spool.getSequence());
+      images.back().assign(emu.image(), emu.image() + emu.imageSize());
+      captured++;
+    }
+    if (n % upEvery != upEvery - 1) continue;
+    direct++;                                                   // without the spool only this one would go out
+    cpu += forward(spool, writer, pipe, tcp);
+  }
+  left      = spool.getCount();
+  forwarded = spool.getForwarded();
+  printf("captured %d, stored %u, forwarded %u while up, %d left (%u bytes), dropped %u, refused %u\n",
+         captured, spool.getStored(), forwarded, left, spool.getUsed(), spool.getDropped(), spool.getRefused());
+
+  spool.close();                                                // as after a reset
+  if (!spool.open(path)) return 1;
+  printf("reopened: %u records, sequence goes on at %u\n", spool.getCount(), spool.getSequence());
+  cpu += forward(spool, writer, pipe, tcp);
+  forwarded = spool.getForwarded();
+
+  while (off < tcp.received().size())
+  {
+    if (!unspool(images, fmt, res, tcp.received(), off, seq)) break;
+    gaps += (seq != next);
+    next  = seq + 1;
+    got++;
+  }
+  printf("received %d intact frames (of %u forwarded), %d gaps in the sequence, %u bytes walked of %u\n", 
+         got, forwarded, gaps, (unsigned)off, (unsigned)tcp.received().size());
+  printf("without the spool %d of %d captures would have been sent, drain cpu %.1f us per frame\n",
+         direct, frames, forwarded ? cpu / 1e3 / forwarded : 0.0);
+  unlink(path);
+  // every record forwarded arrived intact and in order, a gap only where the quotas dropped
+  // or the CRC check removed records, and something was stored at all
+  if (!captured || got != (int)forwarded || off != tcp.received().size()
+  || (uint32_t)gaps > spool.getDropped() + spool.getCorrupt())
+  {
+    fprintf(stderr, "spool check failed: %d captures stored, %d frames received of %u forwarded\n",
+            captured, got, forwarded);
+    return 1;
+  }
+  return 0;
+}
+
+static int benchMulti(int count, int frames, uint32_t interByte, const char *only, uint32_t pollUs)
+{
+  std::vector<uCamIII_Emulator*>          emus;
+  std::vector<uCamIII<uCamIII_Emulator>*> cams;
+  const uint16_t                          packageSize = 512;
+
+  if (count > uCamIII_MAX_CAMERAS) count = uCamIII_MAX_CAMERAS;
+  for (int c = 0; c < count; c++)
+  {
+    emus.push_back(new uCamIII_Emulator(baseBaud, interByte, c + 1));
+    cams.push_back(new uCamIII<uCamIII_Emulator>(*emus[c], -1, 500));
+    camFrame[c].resize(640 * 480 * 2);
+    if (!cams[c]->init(baseBaud) || (fastBaud && !cams[c]->setBaudrate(fastBaud)))
+    {
+      fprintf(stderr, "camera %d: no sync with emulator\n", c);
+      return 1;
+    }
+  }
+
+  printf("baud %u, %d camera(s), %d frame(s) each, package size %u, aggregate frames/s (simulated)\n", 
+         cams[0]->getBaudrate(), count, frames, packageSize);
+  printf("%-7s %-8s %9s %9s %9s %8s\n", "format", "res", "ok", "seq fps", "sched fps", "speedup");
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+  {
+    if (only && strcasecmp(only, formats[f].name)) continue;
+    for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++)
+    {
+      int      w, h;
+      char     resName[16];
+      uint64_t us;
+      double   seq, par;
+      int      okSeq, okPar;
+
+      uCamIII_Emulator::dimensions(formats[f].fmt, resolutions[r], w, h);
+      snprintf(resName, sizeof(resName), "%dx%d", w, h);
+
+      us    = hostMicros();
+      okSeq = captureMulti(cams, emus, formats[f].fmt, resolutions[r], frames, false, pollUs);
+      seq   = okSeq * 1e6 / (hostMicros() - us);
+      us    = hostMicros();
+      okPar = captureMulti(cams, emus, formats[f].fmt, resolutions[r], frames, true, pollUs);
+      par   = okPar * 1e6 / (hostMicros() - us);
+      if (!okSeq || !okPar)
+        printf("%-7s %-8s %4d/%-4d %9s\n", formats[f].name, resName, okSeq + okPar, 2 * count * frames, "n/a");
+      else
+        printf("%-7s %-8s %4d/%-4d %9.2f %9.2f %7.2fx\n", formats[f].name, resName, okSeq + okPar, 2 * count * frames,
+               seq, par, par / seq);
+    }
+  }
+
+  uint32_t ms;
+  int      timedOut = armedTimeout(cams, pollUs, ms);
+  printf("\narmed without a trigger: %d of %d camera(s) reported the timeout after %.1f s\n", 
+         timedOut, count, ms / 1e3);
+  if (timedOut != count)
+  {
+    fprintf(stderr, "armed cameras didn't time out\n");
+    return 1;
+  }
+  return 0;
+}
+
+// one 640x480 JPEG like takeSnapshot("JPG") in uCamTest.ino, image bytes or 0
+static long captureJpeg(uCamIII<uCamIII_Emulator>& ucam, std::vector<uint8_t>& buffer)
+{
+  long size = 0, received = 0, chunk = 0;
+
+  if (!ucam.ensureSync() || !ucam.setImageFormat(uCamIII_COMP_JPEG, uCamIII_640x480) || !ucam.setPackageSize(512)
+  ||  !ucam.takeSnapshot(uCamIII_SNAP_JPEG) || !(size = ucam.getPicture(uCamIII_TYPE_SNAPSHOT))) return 0;
+  while (received < size && (chunk = ucam.getJpegData(&buffer[received], buffer.size() - received)))
+    received += chunk;
+  return (received == size) ? size : 0;
+}
+
+// -M: every cycle a 640x480 JPEG either way vs. only when an 80x60 probe shows motion, the
+// object in the emulated scene moves every moveEvery cycles
+static int benchMotion(int moveEvery, int noise, int level, int blocks, int learn, int cycles, uint32_t interByte)
+{
+  uCamIII_Emulator          emu(baseBaud, interByte);
+  uCamIII<uCamIII_Emulator> ucam(emu, RESET_PIN, 500);
+  std::vector<uint8_t>      buffer(640 * 480);
+  std::vector<uint8_t>      background(80 * 60);
+  uCamIII_Motion            motion(background.data());
+  uint64_t                  wire[2] = { 0, 0 }, image[2] = { 0, 0 }, us[2] = { 0, 0 }, cpu = 0;
+  int                       moves = 0, hits = 0, misses = 0, falses = 0, boxed = 0, failed = 0;
+  int                       objX = 100, objY = 100;
+
+  motion.setThreshold(level, blocks);
+  motion.setLearning(learn);
+  emu.setNoise(noise);
+  emu.setObject(objX, objY, 150);
+  emu.attachResetPin(RESET_PIN);
+  if (!ucam.init(baseBaud) || (fastBaud && !ucam.setBaudrate(fastBaud)))
+  {
+    fprintf(stderr, "no sync with emulator\n");
+    return 1;
+  }
+
+  printf("baud %u, %d cycle(s), object moves every %d, noise +/-%d, threshold %d per pixel in %d block(s), learning 1/%d\n", 
+         ucam.getBaudrate(), cycles, moveEvery, noise, level, blocks, 1 << learn);
+  for (int n = 0; n < cycles; n++)
+  {
+    bool     moved = n && moveEvery > 0 && !(n % moveEvery);
+    uint32_t sent  = emu.counters().bytesSent;
+    uint64_t t     = hostMicros();
+    long     size;
+
+    if (moved)
+    {
+      objX = rand() % 850;
+      objY = rand() % 850;
+      emu.setObject(objX, objY, 150);
+      moves++;
+    }
+
+    if (!(size = captureJpeg(ucam, buffer))) failed++;          // ungated
+    image[0] += size;
+    wire[0]  += emu.counters().bytesSent - sent;
+    us[0]    += hostMicros() - t;
+
+    sent = emu.counters().bytesSent;
+    t    = hostMicros();
+    uint64_t c = cpuNs();
+    bool     hit = motion.check(ucam);                         // gated
+    cpu += cpuNs() - c;
+    if (hit)
+    {
+      int x, y, w, h, cx = (objX + 75) * 640 / 1000, cy = (objY + 75) * 480 / 1000;
+      if (!(size = captureJpeg(ucam, buffer))) failed++;
+      image[1] += size;
+      if (motion.getBox(x, y, w, h, 640, 480) && cx >= x && cx < x + w && cy >= y && cy < y + h) boxed++;
+    }
+    wire[1] += emu.counters().bytesSent - sent;
+    us[1]   += hostMicros() - t;
+    if (hit && moved) hits++;
+    else if (hit)     falses++;
+    else if (moved)   misses++;
+  }
+
+  printf("%-9s %10s %10s %10s\n", "", "camera B", "upload B", "ms/cycle");
+  printf("%-9s %10llu %10llu %10.1f\n", "always", (unsigned long long)wire[0], (unsigned long long)image[0], us[0] / 1e3 / cycles);
+  printf("%-9s %10llu %10llu %10.1f\n", "gated", (unsigned long long)wire[1], (unsigned long long)image[1], us[1] / 1e3 / cycles);
+  printf("\nmoves %d: detected %d (object in box %d), missed %d, false triggers %d, probes %u, failed captures %d, %.1f us cpu per probe\n", 
+         moves, hits, boxed, misses, falses, motion.getProbes(), failed + (int)motion.getFailures(), cpu / 1e3 / cycles);
+  return 0;
+}
+
+// one capture cycle through either class (the calls are the same), cpu time of the data phase
+// added to cpu - raw data is read once it's all in the RX buffer, JPEG packages as they arrive
+template <class camera>
+static long captureWith(camera& cam, uCamIII_Emulator& emu, uCamIII_IMAGE_FORMAT fmt, uCamIII_RES res, 
+                        std::vector<uint8_t>& buffer, uint64_t& cpu)
+{
+  bool     jpeg     = (fmt == uCamIII_COMP_JPEG);
+  long     size     = 0;
+  long     received = 0;
+  long     chunk    = 0;
+  uint64_t ns;
+
+  if (fastBaud ? !(cam.init(baseBaud) && cam.setBaudrate(fastBaud)) : (cam.hardReset(), !cam.sync())) return 0;
+  if (!cam.setImageFormat(fmt, res) || (jpeg && !cam.setPackageSize(512))
+  ||  !cam.takeSnapshot(jpeg ? uCamIII_SNAP_JPEG : uCamIII_SNAP_RAW) || !(size = cam.getPicture(uCamIII_TYPE_SNAPSHOT))) return 0;
+  if (!jpeg) delay(size * 10000LL / (fastBaud ? fastBaud : baseBaud) + 1);   // all buffered: the cost of taking it
+  ns = cpuNs();
+  if (jpeg)
+    while (received < size && (chunk = cam.getJpegData(&buffer[received], buffer.size() - received)))
+      received += chunk;
+  else
+    received = cam.getRawData(buffer.data(), buffer.size());
+  cpu += cpuNs() - ns;
+  return matches(emu, fmt, res, buffer, received, !jpeg) ? size : 0;
+}
+
+// -H: uCamIII<serial> vs. the header-only uCamIII_Core<serial> taking turns on one emulator,
+// host cpu time per image byte of the data transfer
+static int benchCore(int frames, uint32_t interByte, const char *only, const uCamIII_Emulator::Faults& faults)
+{
+  uCamIII_Emulator               emu(baseBaud, interByte);
+  uCamIII<uCamIII_Emulator>      ucam(emu, RESET_PIN, 500);
+  uCamIII_Core<uCamIII_Emulator> core(emu, RESET_PIN, 500);
+  std::vector<uint8_t>           buffer(640 * 480 * 2);
+
+  emu.setFaults(faults);
+  emu.attachResetPin(RESET_PIN);
+  printf("baud %u, %d frame(s) per combination and class, 512 byte packages, cpu in ns per image byte (host)\n", 
+         fastBaud ? fastBaud : baseBaud, frames);
+  printf("%-7s %-8s %9s %9s %9s %8s\n", "format", "res", "ok", "Base ns/B", "Core ns/B", "ratio");
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+  {
+    if (only && strcasecmp(only, formats[f].name)) continue;
+    for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++)
+    {
+      int      w, h;
+      char     resName[16];
+      uint64_t cpu[2]   = { 0, 0 };
+      uint64_t bytes[2] = { 0, 0 };
+      int      ok[2]    = { 0, 0 };
+
+      uCamIII_Emulator::dimensions(formats[f].fmt, resolutions[r], w, h);
+      snprintf(resName, sizeof(resName), "%dx%d", w, h);
+      for (int n = 0; n < frames; n++)
+      {
+        long size;
+        if ((size = captureWith(ucam, emu, formats[f].fmt, resolutions[r], buffer, cpu[0]))) { ok[0]++; bytes[0] += size; }
+        if ((size = captureWith(core, emu, formats[f].fmt, resolutions[r], buffer, cpu[1]))) { ok[1]++; bytes[1] += size; }
+      }
+      if (!ok[0] || !ok[1])
+      {
+        printf("%-7s %-8s %4d/%-4d %9s\n", formats[f].name, resName, ok[0] + ok[1], 2 * frames, "n/a");
+        continue;
+      }
+      double base = (double)cpu[0] / bytes[0], fast = (double)cpu[1] / bytes[1];
+      printf("%-7s %-8s %4d/%-4d %9.2f %9.2f %7.2fx\n", formats[f].name, resName, ok[0] + ok[1], 2 * frames, 
+             base, fast, base / fast);
+    }
+  }
+  printf("\nemulator: %u commands, %u packages, %u bytes sent, %u corrupted, %u dropped, %u NAKs\n",
+         emu.counters().commands, emu.counters().packages, emu.counters().bytesSent, 
+         emu.counters().bytesCorrupted, emu.counters().bytesDropped, emu.counters().naks);
+  return 0;
+}
+
+// package size column: the size, or for uCamIII_PACKAGE_AUTO "a" and the size tuned to by now
+static void packageName(char *name, size_t len, uint16_t size, uCamIII_Base& ucam)
+{
+  if (size == uCamIII_PACKAGE_AUTO)
+    snprintf(name, len, "a%u", ucam.getAutoPackageSize());
+  else
+    snprintf(name, len, "%u", size);
+}
+
+class StderrPrint : public Print {                              // dumpTrace() target
+public:
+  size_t            write(uint8_t c)                            { return fputc(c, stderr) != EOF; }
+};
+
+static uCamIII_PIXEL pixelFormat(const char *name)
+{
+  static const char *names[] = { "raw", "gray8", "rgb565", "rgb888", "bgr888" };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    if (!strcasecmp(name, names[i])) return (uCamIII_PIXEL)i;
+  fprintf(stderr, "unknown pixel format %s, using raw\n", name);
+  return uCamIII_PIXEL_RAW;
+}
+
+int main(int argc, char *argv[])
+{
+  int                       frames    = 3;
+  uint32_t                  interByte = 0;
+  const char               *only      = NULL;
+  bool                      engine    = false;
+  uint32_t                  pollUs    = 0;
+  float                     contFps   = -1;
+  std::vector<uCamIII_TraceEntry> ring;
+  bool                      dumped    = false;
+  int                       multi     = 0;
+  uint32_t                  netRate   = 0;
+  int                       ringBytes = 4096;
+  int                       txBuffer  = 1024;
+  bool                      framed    = false;
+  bool                      core      = false;
+  long                      slotBytes = 0;
+  uint32_t                  padding   = 0;
+  int                       motion[5] = { 0, 0, 12, 2, 1 };  // -M moveEvery, noise, level, blocks, learn
+  uint32_t                  spool[3]  = { 0, 4, 0 };          // -L capacityKB, upEvery, maxAgeS
+  char                     *end;
+  uCamIII_Emulator::Faults  faults;
+  int                       opt;
+
+  while ((opt = getopt(argc, argv, "b:B:n:i:s:c:d:k:g:f:e:p:x:o:C:w:a:t:m:L:M:N:P:Q:R:AFHJurSv")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': baseBaud            = strtoul(optarg, NULL, 0); break;
+      case 'B': fastBaud            = strtoul(optarg, NULL, 0); break;
+      case 'n': frames              = atoi(optarg); break;
+      case 'i': interByte           = strtoul(optarg, NULL, 0); break;
+      case 's': faults.syncMisses   = atoi(optarg); break;
+      case 'c': faults.corruptOneIn = strtoul(optarg, NULL, 0); break;
+      case 'd': faults.dropOneIn    = strtoul(optarg, NULL, 0); break;
+      case 'k': faults.nakOneIn     = strtoul(optarg, NULL, 0); break;
+      case 'g': faults.brokenJpegOneIn = strtoul(optarg, NULL, 0); break;
+      case 'J': parseJpeg           = true; break;
+      case 'p': padding             = strtoul(optarg, NULL, 0); break;
+      case 'f': only                = optarg; break;
+      case 'r': streamRows          = true; break;
+      case 'S': session             = true; break;
+      case 'C': contFps             = atof(optarg); break;
+      case 'w': sinkUs              = strtoul(optarg, NULL, 0); break;
+      case 'a': abortAfter          = atol(optarg); break;
+      case 't': ring.resize(atoi(optarg)); break;
+      case 'm': multi               = atoi(optarg); break;
+      case 'M': sscanf(optarg, "%d,%d,%d,%d,%d", &motion[0], &motion[1], &motion[2], &motion[3], &motion[4]); break;
+      case 'L': sscanf(optarg, "%u:%u:%u", &spool[0], &spool[1], &spool[2]); break;
+      case 'N': netRate             = strtoul(optarg, &end, 0); if (*end) txBuffer = atoi(end + 1); break;
+      case 'P': ringBytes           = atoi(optarg); break;
+      case 'F': framed              = true; break;
+      case 'A': packageSizes.push_back(uCamIII_PACKAGE_AUTO); break;
+      case 'H': core                = true; break;
+      case 'Q': slotBytes           = atol(optarg); break;
+      case 'x': pixel               = pixelFormat(optarg); break;
+      case 'u': bottomUp            = true; break;
+      case 'R': sscanf(optarg, "%d,%d,%d,%d,%d,%d", &win[0], &win[1], &win[2], &win[3], &win[4], &win[5]); break;
+      case 'o': container           = optarg; break;
+      case 'e': engine              = true; pollUs = constrain(strtoul(optarg, NULL, 0), 1UL, 1000000UL); break;
+      case 'v': Log.level           = (LogLevel)(Log.level > LOG_LEVEL_INFO ? LOG_LEVEL_INFO : LOG_LEVEL_TRACE); break;
+      default:
+        fprintf(stderr, "usage: %s [-b baud] [-B switchBaud] [-n frames] [-i interByteUs] [-s syncMisses] "
+                        "[-c corruptOneIn] [-d dropOneIn] [-k nakOneIn] [-g brokenOneIn] [-f format] [-e pollUs] [-J] [-p padding] [-x pixel] [-u] [-R x,y,w,h[,step[,avg]]] [-o bmp|pgm|ppm] [-r] [-S] [-C fps] [-w sinkUs] [-a bytes] [-t entries] [-m cams] [-M moveEvery[,noise[,level[,blocks[,learn]]]]] [-N bytesPerSec[:txBuffer]] [-P ringBytes] [-F] [-Q slotBytes] [-H] [-A] [-L capacityKB[:upEvery[:maxAgeS]]] [-v]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (multi > 0) return benchMulti(multi, frames, interByte, only, pollUs ? pollUs : 100);
+  if (motion[0]) return benchMotion(motion[0], motion[1], motion[2], motion[3], motion[4], frames, interByte);
+  if (core)      return benchCore(frames, interByte, only, faults);
+  if (spool[0])  return benchSpool(spool[0] * 1024, spool[1] ? spool[1] : 1, spool[2], netRate ? netRate : 90000,
+                                    txBuffer, ringBytes, frames, only, pollUs ? pollUs : 100);
+  if (netRate)   return benchNet(netRate, txBuffer, ringBytes, framed, frames, only, pollUs ? pollUs : 100);
+
+  uCamIII_Emulator          emu(baseBaud, interByte);
+  uCamIII<uCamIII_Emulator> ucam(emu, RESET_PIN, 500);
+  std::vector<uint8_t>      buffer(640 * 480 * 3);
+  uCamIII_Converter         conv(pixel, bottomUp);
+  std::vector<uint8_t>      slots(2 * slotBytes);
+  uCamIII_FramePool         framePool(slots.data(), slotBytes, 2);
+  uCamIII_JpegParser        jpegParser;
+
+  std::vector<uint16_t>     sums(640 * 3);
+  bool                      windowing = win[0] || win[1] || win[2] || win[3] || win[4] > 1;
+
+  conv.setWindow(win[0], win[1], win[2], win[3], win[4]);
+  if (win[5]) conv.setAveraging(sums.data(), sums.size());
+  if (pixel != uCamIII_PIXEL_RAW || bottomUp || windowing) ucam.setConverter(converter = &conv);
+  if (ring.size()) ucam.attachTrace(ring.data(), ring.size());
+  if (parseJpeg) ucam.setJpegParser(&jpegParser);
+  emu.setJpegPadding(padding);
+  if (slotBytes > 0) pool = &framePool;
+  emu.setFaults(faults);
+  emu.attachResetPin(RESET_PIN);
+  if (!ucam.init(baseBaud))
+  {
+    fprintf(stderr, "no sync with emulator\n");
+    return 1;
+  }
+  if (fastBaud && !ucam.setBaudrate(fastBaud))
+  {
+    fprintf(stderr, "switch to %u baud failed, staying at %u\n", fastBaud, ucam.getBaudrate());
+    fastBaud = 0;
+  }
+
+  printf("baud %u, %d frame(s) per combination, %s, times in ms (simulated), cpu in us (host)\n", 
+         ucam.getBaudrate(), frames, contFps >= 0 ? "continuous" : engine ? "non-blocking engine" : "blocking calls");
+  if (contFps >= 0)
+    printf("%-7s %-8s %4s %6s %7s %9s %8s %8s %8s\n", 
+           "format", "res", "pkg", "ok", "fps", "B/s", "skipped", "dropped", "cpu");
+  else
+    printf("%-7s %-8s %4s %6s %7s %9s %8s %8s %8s %8s %9s %8s\n", 
+           "format", "res", "pkg", "ok", "fps", "B/s", "sync", "config", "snap", "getpic", "data", "cpu");
+
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+  {
+    if (only && strcasecmp(only, formats[f].name)) continue;
+    for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++)
+      for (size_t p = 0; p < packageSizes.size(); p++)
+      {
+        int      w, h;
+        char     resName[16];
+        char     pkg[8];
+        Phase    t   = { 0, 0, 0, 0, 0 };
+        int      ok  = 0;
+        uint64_t bytes = 0;
+        uint64_t start = hostMicros();
+        uint64_t cpu   = cpuNs();
+
+        uCamIII_Emulator::dimensions(formats[f].fmt, resolutions[r], w, h);
+        snprintf(resName, sizeof(resName), "%dx%d", w, h);
+
+        if (contFps >= 0)
+        {
+          long got = captureContinuous(ucam, emu, formats[f].fmt, resolutions[r], packageSizes[p], buffer, 
+                                       frames, contFps, pollUs ? pollUs : 100);
+          cpu = cpuNs() - cpu;
+          packageName(pkg, sizeof(pkg), packageSizes[p], ucam);
+          if (got < 0)
+            printf("%-7s %-8s %4s %3d/%-2d %7s\n", formats[f].name, resName, pkg, 0, frames, "n/a");
+          else
+            printf("%-7s %-8s %4s %3ld/%-2d %7.2f %9.0f %8u %8u %8.1f\n", formats[f].name, resName, pkg, 
+                   got, frames, ucam.getFps(), (double)emu.imageSize() * ucam.getFps(), 
+                   ucam.getFramesSkipped(), ucam.getFramesDropped(), cpu / 1e3 / frames);
+          continue;
+        }
+
+        for (int n = 0; n < frames; n++)
+        {
+          long size = engine 
+                    ? captureEngine(ucam, emu, formats[f].fmt, resolutions[r], packageSizes[p], buffer, t, pollUs)
+                    : capture(ucam, emu, formats[f].fmt, resolutions[r], packageSizes[p], buffer, t);
+          if (size > 0) 
+          {
+            char name[32];
+            snprintf(name, sizeof(name), "%s_%s", formats[f].name, resName);
+            if (container && !ok && !p && !save(formats[f].fmt, resolutions[r], name, buffer))
+              fprintf(stderr, "%s can't be written as %s\n", name, container);
+            ok++;
+            bytes += size;
+          }
+          else if (ring.size() && !dumped)
+          {
+            StderrPrint err;
+            fprintf(stderr, "--- trace of the first failed capture (%s %s, %u) ---\n", formats[f].name, resName, packageSizes[p]);
+            ucam.dumpTrace(err);
+            dumped = true;
+          }
+          ucam.clearTrace();
+        }
+
+        double sec = (hostMicros() - start) / 1e6;
+        cpu = cpuNs() - cpu;
+        packageName(pkg, sizeof(pkg), packageSizes[p], ucam);
+        if (!ok)
+        {
+          printf("%-7s %-8s %4s %3d/%-2d %7s\n", formats[f].name, resName, pkg, ok, frames, "n/a");
+          continue;
+        }
+        printf("%-7s %-8s %4s %3d/%-2d %7.2f %9.0f %8.1f %8.1f %8.1f %8.1f %9.1f %8.1f\n",
+               formats[f].name, resName, pkg, ok, frames,
+               ok / sec, bytes / sec,
+               t.sync / 1e3 / frames, t.config / 1e3 / frames, t.snap / 1e3 / frames, 
+               t.picture / 1e3 / frames, t.data / 1e3 / frames, cpu / 1e3 / frames);
+      }
+  }
+
+  const uCamIII_Emulator::Counters& c = emu.counters();
+  printf("\nemulator: %u commands, %u packages, %u bytes sent, %u corrupted, %u dropped, %u NAKs, %u SYNCs ignored\n",
+         c.commands, c.packages, c.bytesSent, c.bytesCorrupted, c.bytesDropped, c.naks, c.syncsIgnored);
+  printf("library:  %u packages re-requested, %u checksum errors, %u short reads, %u commands skipped\n",
+         ucam.getPackageRetries(), ucam.getPackageChecksumErrors(), ucam.getPackageShortReads(), 
+         ucam.getSkippedCommands());
+  printf("sync:     %u ok, %u failed, %u SYNCs sent, last %u tries/%u ms, max %u ms, learned wait %u ms\n",
+         ucam.getSyncCount(), ucam.getSyncFailures(), ucam.getSyncTries(), ucam.getSyncLastTries(), 
+         ucam.getSyncLastMs(), ucam.getSyncMaxMs(), ucam.getSyncWaitMs());
+  printf("snapshot: %u not-ready probes, learned processing time %u ms\n",
+         ucam.getSnapshotProbes(), ucam.getSnapshotLatency());
+
+  const uCamIII_Stats& st = ucam.getStats();
+  printf("stats:    %u captures, %u failed, %u bytes, %u packages, %u flushed bytes, %u timeouts\n"
+         "          sync %u ms, config %u ms, snapshot %u ms, picture %u ms, data %u ms\n          NAKs:",
+         st.captures, st.failures, st.bytes, st.packages, st.flushedBytes, st.timeouts,
+         st.phaseMs[uCamIII_PHASE_SYNC], st.phaseMs[uCamIII_PHASE_CONFIG], st.phaseMs[uCamIII_PHASE_SNAPSHOT], 
+         st.phaseMs[uCamIII_PHASE_PICTURE], st.phaseMs[uCamIII_PHASE_DATA]);
+  for (int e = 1; e < 256; e++)
+    if (uCamIII_Stats::nakIndex(e) && st.nak(e)) printf(" %02X x%u", e, st.nak(e));
+  printf("\n");
+  printf("sink:     %u stalls, %u ms waited, %u aborts\n", st.sinkStalls, st.sinkWaitMs, st.sinkAborts);
+  if (parseJpeg || faults.brokenJpegOneIn)
+    printf("jpeg:     %u garbled by the emulator, %u given up by the parser, %u bytes after EOI not fetched\n", 
+           c.brokenJpegs, st.jpegBroken, st.jpegSkipped);
+  printf("packages: tuned to %u bytes, last goodput %.0f B/s, overhead %u us, %.2g failures per byte\n",
+         ucam.getAutoPackageSize(), ucam.getGoodput(), ucam.getPackageOverheadUs(), ucam.getPackageErrorRate());
+  if (pool)
+    printf("pool:     2 x %ld bytes, %d frames held, %u refused/overflowed, %u without a free slot\n", 
+           slotBytes, pool->available(), pool->getOverflows(), pool->getNoSlot());
+  return 0;
+}
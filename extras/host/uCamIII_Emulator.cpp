@@ -0,0 +1,453 @@
+#include <algorithm>
+#include "uCamIII_Emulator.h"
+
+uCamIII_Emulator *uCamIII_Emulator::_resetOwner = NULL;
+
+uCamIII_Emulator::uCamIII_Emulator(uint32_t baudrate, uint32_t interByteUs, uint32_t seed)
+: _cmdLen(0), _hostBaud(baudrate), _camBaud(0), _interByteNs(interByteUs * 1000ULL), _txCursorNs(0)
+, _responseUs(1000), _jpegBytesPerKPixel(150), _jpegPadding(0), _jpegLength(0), _rng(seed ? seed : 1), _objX(0), _objY(0), _objSize(0), _noise(0)
+, _resetPin(-1)
+{
+  powerUp();
+}
+
+void uCamIII_Emulator::begin(uint32_t baudrate)
+{
+  _hostBaud = baudrate;
+}
+
+void uCamIII_Emulator::end()
+{
+}
+
+void uCamIII_Emulator::powerUp()
+{
+  _tx.clear();
+  _ready         = 0;
+  _cmdLen        = 0;
+  _camBaud       = 0;
+  _awake         = true;
+  _syncsToIgnore = _faults.syncMisses;
+  _ackCounter    = 0;
+  _format        = uCamIII_COMP_JPEG;
+  _rawRes        = uCamIII_640x480;
+  _jpegRes       = uCamIII_640x480;
+  _packageSize   = 64;
+  _idleSeconds   = 15;
+  _lastCmdUs     = hostMicros();
+  _snapValid     = false;
+  _jpegActive    = false;
+  _txCursorNs    = hostMicros() * 1000ULL;
+}
+
+void uCamIII_Emulator::attachResetPin(int pin)
+{
+  _resetPin   = pin;
+  _resetOwner = this;
+  hostSetPinHook(pinHook);
+}
+
+void uCamIII_Emulator::pinHook(int pin, int mode, int value)
+{
+  if (_resetOwner && pin == _resetOwner->_resetPin && mode == INPUT && value < 0)
+    _resetOwner->powerUp();                                     // reset line released
+}
+
+// ------------------------------------ Stream -------------------------------------------
+
+size_t uCamIII_Emulator::arrived() const
+{
+  uint64_t now = hostMicros();
+  if (_tx.empty() || _tx.front().us > now) return 0;
+  if (_tx.back().us <= now) return _tx.size();
+  return std::upper_bound(_tx.begin(), _tx.end(), now, 
+                          [](uint64_t t, const TxByte& b) { return t < b.us; }) - _tx.begin();
+}
+
+int uCamIII_Emulator::peek()
+{
+  return arrived() ? _tx.front().c : -1;
+}
+
+size_t uCamIII_Emulator::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t uCamIII_Emulator::write(const uint8_t *buffer, size_t size)
+{
+  uint64_t ns = hostMicros() * 1000ULL;
+  uint64_t perByte = 10000000000ULL / _hostBaud;
+
+  for (size_t i = 0; i < size; i++)
+  {
+    ns += perByte;
+    if (_camBaud && _camBaud != _hostBaud) continue;           // camera can't make sense of the wrong baudrate
+    if (_cmdLen == 0 && buffer[i] != uCamIII_STARTBYTE) continue;
+    _cmd[_cmdLen++] = buffer[i];
+    if (_cmdLen == sizeof(_cmd))
+    {
+      _cmdLen = 0;
+      command(_cmd, ns / 1000);
+    }
+  }
+  return size;
+}
+
+uint64_t uCamIII_Emulator::nextEventMicros()
+{
+  return _tx.empty() ? UINT64_MAX : _tx.front().us;
+}
+
+// ------------------------------------ camera -------------------------------------------
+
+uint32_t uCamIII_Emulator::random()
+{
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  return _rng;
+}
+
+uint64_t uCamIII_Emulator::byteNs() const
+{
+  return 10000000000ULL / (_camBaud ? _camBaud : _hostBaud);
+}
+
+void uCamIII_Emulator::transmit(const uint8_t *data, size_t len, uint64_t notBeforeUs)
+{
+  uint64_t ns = std::max<uint64_t>(_txCursorNs, notBeforeUs * 1000ULL);
+  uint64_t perByte = byteNs() + _interByteNs;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    uint8_t c = data[i];
+    ns += perByte;
+    _counters.bytesSent++;
+    if (_faults.dropOneIn && random() % _faults.dropOneIn == 0)
+    {
+      _counters.bytesDropped++;
+      continue;
+    }
+    if (_faults.corruptOneIn && random() % _faults.corruptOneIn == 0)
+    {
+      c ^= 1 << (random() & 7);
+      _counters.bytesCorrupted++;
+    }
+    TxByte b = { ns / 1000, c };
+    _tx.push_back(b);
+  }
+  _txCursorNs = ns;
+}
+
+void uCamIII_Emulator::ack(uint8_t cmd, uint64_t atUs)
+{
+  uint8_t buf[6] = { uCamIII_STARTBYTE, uCamIII_CMD_ACK, cmd, _ackCounter++, 0x00, 0x00 };
+  transmit(buf, sizeof(buf), atUs);
+}
+
+void uCamIII_Emulator::nak(uint8_t error, uint64_t atUs)
+{
+  uint8_t buf[6] = { uCamIII_STARTBYTE, uCamIII_CMD_NAK, 0x00, _ackCounter++, error, 0x00 };
+  _counters.naks++;
+  transmit(buf, sizeof(buf), atUs);
+}
+
+bool uCamIII_Emulator::dimensions(uCamIII_IMAGE_FORMAT format, uint8_t res, int& width, int& height)
+{
+  bool jpeg = (format == uCamIII_COMP_JPEG);
+
+  switch (res)
+  {
+    case uCamIII_80x60:   width =  80; height =  60; return !jpeg;
+    case uCamIII_160x120: width = 160; height = jpeg ? 128 : 120; return true;
+    case uCamIII_320x240: width = 320; height = 240; return true;
+    case uCamIII_640x480: width = 640; height = 480; return true;
+    case uCamIII_128x96:  width = 128; height =  96; return !jpeg;
+    case uCamIII_128x128: width = 128; height = 128; return !jpeg;
+  }
+  width = height = 0;
+  return false;
+}
+
+int uCamIII_Emulator::bytesPerPixel(uCamIII_IMAGE_FORMAT format)
+{
+  return (format == uCamIII_RAW_16BIT_RGB565 || format == uCamIII_RAW_16BIT_CRYCBY) ? 2 : 1;
+}
+
+uint64_t uCamIII_Emulator::processingUs(bool jpeg) const
+{
+  int w, h;
+  dimensions((uCamIII_IMAGE_FORMAT)_format, jpeg ? _jpegRes : _rawRes, w, h);
+  return jpeg ? 20000 + (uint64_t)w * h : 10000 + (uint64_t)w * h / 8;
+}
+
+bool uCamIII_Emulator::renderImage(bool jpeg)
+{
+  int w, h;
+  uCamIII_IMAGE_FORMAT fmt = (uCamIII_IMAGE_FORMAT)_format;
+
+  if (!dimensions(fmt, jpeg ? _jpegRes : _rawRes, w, h)) return false;
+  _frameCount++;
+  _image.clear();
+
+  if (!jpeg)
+  {
+    _image.reserve(w * h * bytesPerPixel(fmt));
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++)
+      {
+        uint8_t r = x * 255 / w, g = y * 255 / h, b = 0x80;
+        if (_objSize && x * 1000 >= _objX * w && x * 1000 < (_objX + _objSize) * w 
+                     && y * 1000 >= _objY * h && y * 1000 < (_objY + _objSize) * h)
+          r = g = b = 0xF0;                                     // bright object in front of the gradient
+        if (_noise)
+        {
+          int n = (int)(random() % (2 * _noise + 1)) - _noise;
+          r = std::min(255, std::max(0, r + n));
+          g = std::min(255, std::max(0, g + n));
+        }
+        uint8_t gray = (r + g) / 2;
+        switch (fmt)
+        {
+          case uCamIII_RAW_8BIT:
+            _image.push_back(gray);
+            break;
+          case uCamIII_RAW_16BIT_RGB565:                        // big-endian as the camera sends it
+            _image.push_back((r & 0xF8) | (g >> 5));
+            _image.push_back(((g << 3) & 0xE0) | (b >> 3));
+            break;
+          case uCamIII_RAW_16BIT_CRYCBY:                        // Cr Y Cb Y per pixel pair
+            _image.push_back((x & 1) ? 128 - (g >> 2) : 128 + (r >> 2));
+            _image.push_back(gray);
+            break;
+          default:
+            break;
+        }
+      }
+    return true;
+  }
+
+  static const uint8_t head[] = 
+  { 0xFF, 0xD8                                                  // SOI
+  , 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00
+  };
+  size_t target = 600 + (uint64_t)w * h * _jpegBytesPerKPixel / 1000;
+  target += target * (random() % 61) / 1000 - target * 30 / 1000; // +/-3% size jitter between frames
+
+  _image.insert(_image.end(), head, head + sizeof(head));
+  uint8_t dqt[] = { 0xFF, 0xDB, 0x00, 0x43, 0x00 };             // DQT
+  _image.insert(_image.end(), dqt, dqt + sizeof(dqt));
+  for (int i = 0; i < 64; i++) _image.push_back(1 + i / 4);
+  uint8_t sof[] = { 0xFF, 0xC0, 0x00, 0x11, 0x08                // SOF0
+                  , (uint8_t)(h >> 8), (uint8_t)h, (uint8_t)(w >> 8), (uint8_t)w
+                  , 0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01 };
+  _image.insert(_image.end(), sof, sof + sizeof(sof));
+  uint8_t dht[] = { 0xFF, 0xC4, 0x00, 0x1F, 0x00                // DHT (standard luminance DC)
+                  , 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0
+                  , 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+  _image.insert(_image.end(), dht, dht + sizeof(dht));
+  uint8_t sos[] = { 0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3F, 0x00 };
+  _image.insert(_image.end(), sos, sos + sizeof(sos));
+  while (_image.size() + 2 < target)                            // entropy coded data with byte stuffing
+  {
+    uint8_t c = random() >> 7;
+    _image.push_back(c);
+    if (c == 0xFF) _image.push_back(0x00);
+  }
+  _image.push_back(0xFF);                                       // EOI
+  _image.push_back(0xD9);
+  _jpegLength = _image.size();
+  if (_faults.brokenJpegOneIn && random() % _faults.brokenJpegOneIn == 0)
+  {
+    if (random() & 1)
+      _image[_image.size() - 2] = 0x3C;                         // EOI lost: ends in the middle of the scan
+    else
+      _image[sizeof(head) + 1] = 0x55;                          // DQT marker garbled
+    _counters.brokenJpegs++;
+  }
+  _image.insert(_image.end(), _jpegPadding, 0x00);
+  return true;
+}
+
+void uCamIII_Emulator::sendPackage(uint16_t id, uint64_t atUs)
+{
+  uint32_t payload = _packageSize - 6;
+  uint32_t offset  = (uint32_t)(id - 1) * payload;
+
+  if (id == 0 || offset >= _image.size())
+  {
+    nak(uCamIII_ERROR_PKG_NUM, atUs);
+    return;
+  }
+
+  uint16_t size = std::min<uint32_t>(payload, _image.size() - offset);
+  std::vector<uint8_t> pkg;
+  pkg.reserve(size + 6);
+  pkg.push_back(id & 0xFF);
+  pkg.push_back(id >> 8);
+  pkg.push_back(size & 0xFF);
+  pkg.push_back(size >> 8);
+  pkg.insert(pkg.end(), _image.begin() + offset, _image.begin() + offset + size);
+  uint8_t sum = 0;
+  for (size_t i = 0; i < pkg.size(); i++) sum += pkg[i];
+  pkg.push_back(sum);
+  pkg.push_back(0x00);
+  _counters.packages++;
+  transmit(pkg.data(), pkg.size(), atUs);
+}
+
+void uCamIII_Emulator::command(const uint8_t *cmd, uint64_t atUs)
+{
+  uint64_t at = atUs + _responseUs;
+
+  _counters.commands++;
+
+  if (_awake && _idleSeconds && atUs - _lastCmdUs > _idleSeconds * 1000000ULL)
+  {                                                             // idle timer expired -> camera went to sleep
+    _awake         = false;
+    _syncsToIgnore = _faults.syncMisses;
+    _jpegActive    = false;
+  }
+  _lastCmdUs = atUs;
+
+  if (cmd[1] == uCamIII_CMD_SYNC)
+  {
+    if (!_camBaud && _hostBaud > 115200) return;                // autodetection only works up to 115200
+    if (_syncsToIgnore)
+    {
+      _syncsToIgnore--;
+      _counters.syncsIgnored++;
+      return;
+    }
+    _camBaud = _hostBaud;                                       // autodetected
+    _awake   = true;
+    ack(uCamIII_CMD_SYNC, at);
+    uint8_t sync[6] = { uCamIII_STARTBYTE, uCamIII_CMD_SYNC, 0x00, 0x00, 0x00, 0x00 };
+    transmit(sync, sizeof(sync), at);
+    return;
+  }
+
+  if (!_camBaud || !_awake) return;                             // not listening yet
+
+  if (cmd[1] != uCamIII_CMD_ACK && _faults.nakOneIn && random() % _faults.nakOneIn == 0)
+  {
+    nak(uCamIII_ERROR_UNEXP_REPLY, at);
+    return;
+  }
+
+  switch (cmd[1])
+  {
+    case uCamIII_CMD_INIT:
+    {
+      int w, h;
+      uCamIII_IMAGE_FORMAT fmt = (uCamIII_IMAGE_FORMAT)cmd[3];
+      if ((fmt != uCamIII_RAW_8BIT && fmt != uCamIII_RAW_16BIT_RGB565 
+        && fmt != uCamIII_COMP_JPEG && fmt != uCamIII_RAW_16BIT_CRYCBY)
+      || !dimensions(fmt, fmt == uCamIII_COMP_JPEG ? cmd[5] : cmd[4], w, h))
+      {
+        nak(uCamIII_ERROR_PARAM, at);
+        return;
+      }
+      _format    = cmd[3];
+      _rawRes    = cmd[4];
+      _jpegRes   = cmd[5];
+      _snapValid = false;
+      ack(cmd[1], at);
+      break;
+    }
+    case uCamIII_CMD_SET_PACKSIZE:
+    {
+      uint16_t size = cmd[3] | cmd[4] << 8;
+      if (cmd[2] != 0x08 || size < 64 || size > 512)
+      {
+        nak(uCamIII_ERROR_PKG_SIZE, at);
+        return;
+      }
+      _packageSize = size;
+      ack(cmd[1], at);
+      break;
+    }
+    case uCamIII_CMD_SET_BAUDRATE:
+      ack(cmd[1], at);                                          // still answered at the old rate
+      _camBaud = 3686400 / ((cmd[2] + 1) * (cmd[3] + 1));
+      break;
+    case uCamIII_CMD_RESET:
+      ack(cmd[1], at);
+      _snapValid  = false;
+      _jpegActive = false;
+      if (cmd[2] == uCamIII_RESET_FULL)                         // back to power-on defaults
+      {
+        _camBaud       = 0;
+        _syncsToIgnore = _faults.syncMisses;
+        _packageSize   = 64;
+        _idleSeconds   = 15;
+      }
+      break;
+    case uCamIII_CMD_SNAPSHOT:
+      ack(cmd[1], at);
+      _snapValid   = true;
+      _snapType    = cmd[2];
+      _snapReadyUs = at + processingUs(_snapType == uCamIII_SNAP_JPEG);
+      break;
+    case uCamIII_CMD_GET_PICTURE:
+    {
+      bool     jpeg;
+      uint64_t ready = at;
+
+      if (cmd[2] == uCamIII_TYPE_SNAPSHOT)
+      {
+        if (!_snapValid)            { nak(uCamIII_ERROR_PIC_TYPE, at); return; }
+        if (atUs < _snapReadyUs)        { nak(uCamIII_ERROR_PIC_NOT_RDY, at); return; }
+        jpeg = (_snapType == uCamIII_SNAP_JPEG);
+      }
+      else if (cmd[2] == uCamIII_TYPE_RAW || cmd[2] == uCamIII_TYPE_JPEG)
+      {
+        jpeg  = (cmd[2] == uCamIII_TYPE_JPEG);
+        ready = at + processingUs(jpeg);
+      }
+      else
+      {
+        nak(uCamIII_ERROR_PIC_TYPE, at);
+        return;
+      }
+      if (jpeg != (_format == uCamIII_COMP_JPEG) || !renderImage(jpeg))
+      {
+        nak(uCamIII_ERROR_PIC_FORMAT, at);
+        return;
+      }
+      if (cmd[2] == uCamIII_TYPE_SNAPSHOT) _snapValid = false;
+
+      ack(cmd[1], at);
+      uint32_t size = _image.size();
+      uint8_t data[6] = { uCamIII_STARTBYTE, uCamIII_CMD_DATA, cmd[2], (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16) };
+      transmit(data, sizeof(data), ready);
+      if (jpeg)
+        _jpegActive = true;
+      else
+        transmit(_image.data(), _image.size(), ready);
+      break;
+    }
+    case uCamIII_CMD_ACK:
+      if (cmd[2] == 0x00 && _jpegActive)
+      {
+        uint16_t id = cmd[4] | cmd[5] << 8;
+        if (id == 0xF0F0)
+          _jpegActive = false;
+        else
+          sendPackage(id + 1, atUs + _responseUs / 10);
+      }
+      break;
+    case uCamIII_CMD_SET_FREQ:
+    case uCamIII_CMD_SET_CBE:
+      ack(cmd[1], at);
+      break;
+    case uCamIII_CMD_SLEEP:
+      _idleSeconds = cmd[2];
+      ack(cmd[1], at);
+      break;
+    default:
+      nak(uCamIII_ERROR_UNEXP_CMD, at);
+      break;
+  }
+}
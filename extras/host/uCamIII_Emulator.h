@@ -0,0 +1,148 @@
+/* *************************************************************************************
+
+Host side uCam-III emulator
+
+Implements the `Stream` interface `uCamIII_Base` talks to and answers the command set
+from `uCamIII.h` (SYNC/INIT/SNAPSHOT/GET_PICTURE/DATA/ACK/NAK/...) like the camera 
+would, so the library can be exercised and benchmarked without hardware.
+
+Modelled:
+ - wire time per byte (10 bits per byte at the current baudrate) plus an optional
+   inter-byte gap, command processing latency and picture processing time depending
+   on format and resolution
+ - baudrate autodetection on SYNC (up to 115200) and switching via `uCamIII_CMD_SET_BAUDRATE`
+ - idle timer (`uCamIII_CMD_SLEEP`) after which the camera needs to be synced again
+ - injected faults: ignored SYNCs, corrupted and dropped bytes, spurious NAKs
+
+JPEG packages follow the behaviour `getJpegData()` relies on: the ACK after DATA 
+carries package ID 0 and yields package 1, every further ACK acknowledges package `n` 
+and requests `n+1`, `F0 F0` ends the transfer. 
+The verify code is the low byte of the sum of ID, size and payload bytes (high byte 0).
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_EMULATOR_h_
+#define _UCAMIII_EMULATOR_h_
+
+#include <deque>
+#include <vector>
+#include "uCamIII.h"
+
+class uCamIII_Emulator : public Stream, public HostWakeSource {
+public:
+  struct Faults {
+    Faults() : syncMisses(5), corruptOneIn(0), dropOneIn(0), nakOneIn(0), brokenJpegOneIn(0) { }
+    uint16_t        syncMisses;                                 // SYNCs ignored after power-up/wake before answering
+    uint32_t        corruptOneIn;                               // flip one bit in one of N transmitted bytes (0 = off)
+    uint32_t        dropOneIn;                                  // drop one of N transmitted bytes (0 = off)
+    uint32_t        nakOneIn;                                   // answer one of N commands with NAK (0 = off)
+    uint32_t        brokenJpegOneIn;                            // one of N JPEGs without EOI or with a garbled header
+  };
+
+  struct Counters {
+    Counters() { memset(this, 0, sizeof(*this)); }
+    uint32_t        commands;
+    uint32_t        syncsIgnored;
+    uint32_t        naks;
+    uint32_t        packages;
+    uint32_t        bytesSent;
+    uint32_t        bytesCorrupted;
+    uint32_t        bytesDropped;
+    uint32_t        brokenJpegs;
+  };
+
+  uCamIII_Emulator(uint32_t baudrate = 115200, uint32_t interByteUs = 0, uint32_t seed = 1);
+
+  // serial port interface as used by uCamIII<serial>::init()
+  void              begin(uint32_t baudrate);
+  void              end();
+
+  // Stream - read()/available() are defined here, so a caller that knows the class (as 
+  // uCamIII_Core<serial> does) can inline them like a UART driver's ring buffer access
+  virtual int       available()                                 { return (int)(_ready = arrived()); }
+  virtual int       read()
+                    { if (!_ready && !(_ready = arrived())) return -1; _ready--; uint8_t c = _tx.front().c; _tx.pop_front(); return c; }
+  virtual int       peek();
+  virtual size_t    write(uint8_t c);
+  virtual size_t    write(const uint8_t *buffer, size_t size);
+  using Print::write;
+
+  // HostWakeSource
+  virtual uint64_t  nextEventMicros();
+
+  void              powerUp();                                  // same as releasing the reset pin
+  void              attachResetPin(int pin);                    // hook into pinMode()/digitalWrite() of that pin
+
+  void              setInterByteDelay(uint32_t us)              { _interByteNs = us * 1000ULL; }
+  void              setFaults(const Faults& faults)             { _faults = faults; }
+  void              setResponseLatency(uint32_t us)             { _responseUs = us; }
+  void              setJpegBytesPerKPixel(uint32_t bytes)       { _jpegBytesPerKPixel = bytes; }
+  void              setJpegPadding(uint32_t bytes)              { _jpegPadding = bytes; }     // zeros after EOI, part of the announced size
+  // square object in raw images at (x, y) of size in 1/1000 of the image (0 = none), +/-noise per pixel
+  void              setObject(int x, int y, int size)           { _objX = x; _objY = y; _objSize = size; }
+  void              setNoise(int noise)                         { _noise = noise; }
+
+  const Counters&   counters() const                            { return _counters; }
+  uint32_t          cameraBaudrate() const                      { return _camBaud; }
+  uint32_t          imageSize() const                           { return _image.size(); }
+  const uint8_t*    image() const                               { return _image.data(); }
+  uint32_t          jpegLength() const                          { return _jpegLength; }       // up to EOI
+
+  static bool       dimensions(uCamIII_IMAGE_FORMAT format, uint8_t res, int& width, int& height);
+  static int        bytesPerPixel(uCamIII_IMAGE_FORMAT format);
+
+private:
+  struct TxByte { uint64_t us; uint8_t c; };
+
+  std::deque<TxByte> _tx;
+  size_t            _ready;                                     // bytes at the front of _tx known to have arrived
+  std::vector<uint8_t> _image;
+  uint8_t           _cmd[6];
+  int               _cmdLen;
+
+  uint32_t          _hostBaud;
+  uint32_t          _camBaud;                                   // 0 until autodetected by SYNC
+  uint64_t          _interByteNs;
+  uint64_t          _txCursorNs;
+  uint32_t          _responseUs;
+  uint32_t          _jpegBytesPerKPixel;
+  uint32_t          _jpegPadding;
+  uint32_t          _jpegLength;
+  uint32_t          _rng;
+  int               _objX, _objY, _objSize;
+  int               _noise;
+  Faults            _faults;
+  Counters          _counters;
+  static uCamIII_Emulator *_resetOwner;
+  int               _resetPin;
+
+  // camera state
+  bool              _awake;
+  uint16_t          _syncsToIgnore;
+  uint8_t           _ackCounter;
+  uint8_t           _format;
+  uint8_t           _rawRes;
+  uint8_t           _jpegRes;
+  uint16_t          _packageSize;
+  uint8_t           _idleSeconds;
+  uint64_t          _lastCmdUs;
+  bool              _snapValid;
+  uint8_t           _snapType;
+  uint64_t          _snapReadyUs;
+  bool              _jpegActive;
+  uint16_t          _frameCount;
+
+  uint32_t          random();
+  uint64_t          byteNs() const;
+  void              command(const uint8_t *cmd, uint64_t atUs);
+  void              transmit(const uint8_t *data, size_t len, uint64_t notBeforeUs);
+  void              ack(uint8_t cmd, uint64_t atUs);
+  void              nak(uint8_t error, uint64_t atUs);
+  uint64_t          processingUs(bool jpeg) const;
+  bool              renderImage(bool jpeg);
+  void              sendPackage(uint16_t id, uint64_t atUs);
+  size_t            arrived() const;
+  static void       pinHook(int pin, int mode, int value);
+};
+
+#endif
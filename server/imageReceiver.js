@@ -1,73 +1,158 @@
+// Receives images framed by uCamIII_FrameWriter (see src/uCamIII_FrameWriter.h), any
+// number of them per connection and from any number of devices at once.
 // Run this like:
-// node imageReceiver.js
+// node imageReceiver.js [port]
 
 var fs = require('fs');
 var path = require('path');
 var net = require('net');
+var zlib = require('zlib');
 
-// For this simple test, just create dat files in the "out" directory in the directory
-// where imageReceiver.js lives.
-var outputDir = path.join(__dirname, "out");  
+// Images are saved in the "out" directory in the directory where imageReceiver.js lives,
+// JPEGs as 00001.jpg, BMPs as 00002.bmp, raw images as 00003_160x120_gray8.raw.
+var outputDir = path.join(__dirname, "out");
 
-var dataPort = 8124; // this is the port to listen on for data from the device
+var dataPort = parseInt(process.argv[2]) || 8124; // this is the port to listen on for data from the device
 
-// Output files in the out directory are of the form 00001.jpg. lastNum is used 
-// to speed up scanning for the next unique file.
-var lastNum = 0;
+var HEADER  = 24;
+var TRAILER = 4;
+var MAGIC   = Buffer.from('uC3F');
+var VERSION = 1;
 
-// Create the out directory if it does not exist
-try {
-	fs.mkdirSync(outputDir);
+var formats     = { 3: 'gray8', 6: 'rgb565', 7: 'jpeg', 8: 'crycby' };
+var resolutions = { 1: '80x60', 3: '160x120', 5: '320x240', 7: '640x480', 8: '128x96', 9: '128x128' };
+
+// Create the out directory if it does not exist and continue numbering after what's there
+// (one directory listing at startup instead of probing names per image)
+fs.mkdirSync(outputDir, { recursive: true });
+var lastNum = fs.readdirSync(outputDir).reduce(function (max, name) {
+	var num = parseInt(name, 10);
+	return (num > max) ? num : max;
+}, 0);
+
+// IEEE CRC-32 like the device computes it, zlib's if this node version has one
+var crc32 = zlib.crc32 || (function () {
+	var table = new Int32Array(256);
+	for (var n = 0; n < 256; n++) {
+		var c = n;
+		for (var k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >>> 1) : c >>> 1;
+		table[n] = c;
+	}
+	return function (data, value) {
+		var crc = ~(value || 0);
+		for (var i = 0; i < data.length; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >>> 8);
+		return ~crc >>> 0;
+	};
+})();
+
+function outputName(frame) {
+	var num = ('0000' + (++lastNum)).slice(-5);
+	if (frame.format === 7) return num + '.jpg';
+	if (frame.flags & 2) return num + '.bmp';
+	var res = resolutions[frame.resolution] || ('res' + frame.resolution);
+	var fmt = formats[frame.format] || ('fmt' + frame.format);
+	return num + '_' + res + '_' + fmt + (frame.flags & 1 ? '_converted' : '') + '.raw';
 }
-catch(e) {
+
+function parseHeader(head) {
+	if (head.compare(MAGIC, 0, 4, 0, 4) !== 0 || head[4] !== VERSION) return null;
+	if (head.readUInt32LE(20) !== crc32(head.subarray(0, 20))) return null;
+	return {
+		format:     head[5],
+		resolution: head[6],
+		flags:      head[7],
+		seq:        head.readUInt32LE(8),
+		ms:         head.readUInt32LE(12),
+		length:     head.readUInt32LE(16)
+	};
 }
 
-// Start a TCP Server. This is what receives data from the Particle device
-// https://gist.github.com/creationix/707146
+// Start a TCP Server. This is what receives data from the Particle device.
+// Each connection runs a small parser: header -> payload (streamed into a temporary
+// file while its CRC is computed) -> trailer, after which the file gets its final name
+// or is dropped if the CRC doesn't match. Garbage between frames is skipped.
 net.createServer(function (socket) {
-	console.log('data connection started from ' + socket.remoteAddress);
-	
-	// The server sends a 8-bit byte value for each sample. Javascript doesn't really like
-	// binary values, so we use setEncoding to read each byte of a data as 2 hex digits instead.
-	socket.setEncoding('hex');
-	
-	var outPath = getUniqueOutputPath();
-	
-	let writeStream = fs.createWriteStream(outPath);
-	
-	socket.on('data', function (data) {
-		// We received data on this connection.
-		// console.log("got data " + (data.length / 2));
-		writeStream.write(data, 'hex');
-	});
-	socket.on('end', function () {
-		console.log('transmission complete, saved to ' + outPath);
-		writeStream.end();
-	});
-}).listen(dataPort);
+	var who     = socket.remoteAddress + ':' + socket.remotePort;
+	var head    = Buffer.alloc(0);          // header/trailer bytes collected so far
+	var frame   = null;                     // frame whose payload/trailer is being received
+	var left    = 0;
+	var crc     = 0;
+	var out     = null;
+	var tmpPath = null;
+	var skipped = 0;
 
+	console.log('data connection started from ' + who);
 
-function formatName(num) {
-	var s = num.toString();
-	
-	while(s.length < 5) {
-		s = '0' + s;
+	function finish(ok) {
+		var done = frame, from = tmpPath, stream = out;
+		out = tmpPath = null;
+		stream.end(function () {
+			if (!ok) {
+				fs.unlink(from, function () { });
+				return;
+			}
+			var to = path.join(outputDir, done.name);
+			fs.rename(from, to, function (err) {
+				if (err) console.log('can\'t save ' + to + ': ' + err.message);
+			});
+			console.log('frame ' + done.seq + ' (' + done.length + ' bytes, taken at ' + done.ms + ' ms) saved to ' + to);
+		});
 	}
-	return s + '.jpg';
-}
 
-function getUniqueOutputPath() {
-	for(var ii = lastNum + 1; ii < 99999; ii++) {
-		var outPath = path.join(outputDir, formatName(ii));
-		try {
-			fs.statSync(outPath);
+	socket.on('data', function (data) {
+		var pos = 0;
+
+		while (pos < data.length) {
+			if (!frame) {                                                   // header
+				var take = Math.min(HEADER - head.length, data.length - pos);
+				head = Buffer.concat([head, data.subarray(pos, pos + take)]);
+				pos += take;
+				if (head.length < HEADER) break;
+				if (!(frame = parseHeader(head))) {                         // not a header here, resync
+					var next = head.indexOf(MAGIC[0], 1);
+					skipped += (next < 0) ? head.length : next;
+					head = (next < 0) ? Buffer.alloc(0) : head.subarray(next);
+					continue;
+				}
+				if (skipped) console.log(who + ': skipped ' + skipped + ' bytes');
+				skipped = 0;
+				head    = Buffer.alloc(0);
+				frame.name = outputName(frame);                             // numbered in arrival order
+				left    = frame.length;
+				crc     = 0;
+				tmpPath = path.join(outputDir, '.' + socket.remotePort + '_' + frame.seq + '.part');
+				out     = fs.createWriteStream(tmpPath);
+			}
+			else if (left) {                                                // payload
+				var part = data.subarray(pos, pos + Math.min(left, data.length - pos));
+				crc   = crc32(part, crc);
+				out.write(part);
+				left -= part.length;
+				pos  += part.length;
+			}
+			else {                                                          // trailer
+				var take = Math.min(TRAILER - head.length, data.length - pos);
+				head = Buffer.concat([head, data.subarray(pos, pos + take)]);
+				pos += take;
+				if (head.length < TRAILER) break;
+				var ok = head.readUInt32LE(0) === crc;
+				if (!ok) console.log(who + ': frame ' + frame.seq + ' CRC mismatch, dropped');
+				finish(ok);
+				frame = null;
+				head  = Buffer.alloc(0);
+			}
 		}
-		catch(e) {
-			// File does not exist, use this one
-			lastNum = ii;
-			return outPath;
+	});
+	socket.on('end', function () {
+		if (frame) {
+			console.log(who + ': connection ended in frame ' + frame.seq + ', dropped');
+			if (out) finish(false);
 		}
-	}
-	lastNum = 0;
-	return "00000.jpg";
-}
+		console.log('data connection from ' + who + ' closed');
+	});
+	socket.on('error', function (err) {
+		console.log(who + ': ' + err.message);
+	});
+}).listen(dataPort);
+
+console.log('listening on port ' + dataPort + ', saving to ' + outputDir);
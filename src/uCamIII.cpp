@@ -7,10 +7,10 @@ http://4dsystems.com.au/product/uCAM_III/
 http://www.4dsystems.com.au/productpages/uCAM-III/downloads/uCAM-III_datasheet_R_1_0.pdf
 
 Overview:
-The library implements most functions the uCamIII provides according to datasheet, 
-only baudrate selection is omitted due to the fact that up to 115200 the autodetection 
-works fine and higher baudrates available for the camera are usually not supported by 
-the microcontrollers using this library.
+The library implements most functions the uCamIII provides according to datasheet.
+The link is established at an autodetected baudrate (up to 115200) via `init()`, 
+higher rates (up to 3686400 where the UART supports it) can then be negotiated via 
+`setBaudrate()` which falls back to the previous rate when the camera can't be synced.
 
 It also supports hardware and software serial ports (e.g. `ParticleSoftSerial` on the 
 Particle side or `SoftwareSerial` and `NewSoftSerial` for Arduino) by use of 
@@ -49,171 +49,1539 @@ SOFTWARE.
 
 ************************************************************************************* */
 
+#include <math.h>
 #include <uCamIII.h>
+#include "uCamIII_Converter.h"
+#include "uCamIII_JpegParser.h"
 
 long uCamIII_Base::init() 
 {
-  Log.trace("uCAMIII_Base: %s", __FUNCTION__); 
+  uCamIII_LOG_TRACE("uCAMIII_Base: %s", __FUNCTION__); 
   hardReset();
   return sync();
 }
 
+// the camera may ignore a number of SYNCs (e.g. while waking up) and its reply to one try may only 
+// arrive during the next, so the ACK is looked for anywhere in the byte stream instead of
+// expecting it 6 byte aligned right after each SYNC
 long uCamIII_Base::sync(int maxTry)
 {
-  Log.trace(__FUNCTION__); 
+  uCamIII_LOG_TRACE(__FUNCTION__); 
 
+  uint32_t start   = millis();
+  uint32_t sent    = start;
+  uint16_t wait    = _syncWaitMs;
   int      tries;
-  int      count;
-  uint32_t ms = _timeout;
   
-  for (tries = 1; tries < maxTry; tries++)
+  for (tries = 1; tries <= maxTry; tries++)
   {
-    _timeout = 5 + tries;                                       // start with 5ms timeout between syncs and increase by 1ms
-    if ((count = sendCmdWithAck(uCamIII_CMD_SYNC))) break;
+    sent = millis();
+    sendCmd(uCamIII_CMD_SYNC);
+    count(&uCamIII_Stats::syncTries);
+    if (scanFrame(uCamIII_CMD_ACK, uCamIII_CMD_SYNC, wait)) break;
+    wait = syncBackoff(wait, tries);
   }
-  _timeout = ms;
-  if (tries < maxTry)
+
+  if (tries <= maxTry)
   {
-    Log.info("sync after %d tries", tries);    
-    if (expectPackage(uCamIII_CMD_SYNC)) {
+    uint32_t latency = millis() - sent;
+    if (scanFrame(uCamIII_CMD_SYNC, 0x00, _timeout)) 
+    {
       sendCmd(uCamIII_CMD_ACK, uCamIII_CMD_SYNC);
+      if (tries > 1) drainInput(wait);                          // replies to earlier tries may still be on their way
+      _cameraStream.setTimeout(_timeout);
+      syncDone(tries, latency, start);
+      phase(uCamIII_PHASE_SYNC, start);
+      uCamIII_LOG_INFO("sync after %d tries (%lu ms)", tries, _syncLastMs);    
       return tries;
     }
   }
   
-  Log.warn("no sync");
+  _cameraStream.setTimeout(_timeout);
+  uCamIII_LOG_WARN("no sync");
+  phase(uCamIII_PHASE_SYNC, start);
+  _synced = false;
+  _syncFailures++;
   return 0;
 }
 
+long uCamIII_Base::takeSnapshot(uCamIII_SNAP_TYPE type, uint16_t frame)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (!sendCmdWithAck(uCamIII_CMD_SNAPSHOT, type, frame & 0xFF, (frame >> 8) & 0xFF))
+  {
+    captureDone(false);
+    return 0;
+  }
+  _snapMs      = millis();                              // getPicture() waits for the processing
+  _captureMs   = _snapMs;
+  _snapPending = true;
+  _snapProbe   = 0;
+  return 1;
+}
+
 long uCamIII_Base::getPicture(uCamIII_PIC_TYPE type)
 {
-  Log.trace(__FUNCTION__); 
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  uint32_t ms;
 
-  if (sendCmdWithAck(uCamIII_CMD_GET_PICTURE, type))
+  if (type != uCamIII_TYPE_SNAPSHOT) _captureMs = millis();     // a live frame is taken on request
+  if (type == uCamIII_TYPE_SNAPSHOT && _snapPending)
   {
-    _packageNumber = 0;    
-    return (_imageSize = expectPackage(uCamIII_CMD_DATA, type) & 0x00FFFFFF);   // return image size
+    ms = millis();
+    delay(getSnapshotWait());                           // nothing to ask before the learned processing time
+    phase(uCamIII_PHASE_SNAPSHOT, ms);
+    while (!sendCmdWithAck(uCamIII_CMD_GET_PICTURE, type))
+    {
+      if (_lastError != uCamIII_ERROR_PIC_NOT_RDY || millis() - _snapMs >= _snapTimeout) 
+      {
+        _snapPending = false;
+        captureDone(false);
+        return 0;
+      }
+      snapshotProbed(false);
+      delay(_snapProbeMs);
+    }
+    snapshotProbed(true);
   }
-  return 0;
+  else if (!sendCmdWithAck(uCamIII_CMD_GET_PICTURE, type)) 
+  {
+    captureDone(false);
+    return 0;
+  }
+
+  ms             = millis();
+  _packageNumber = 0;    
+  _imageSize     = expectPackage(uCamIII_CMD_DATA, type) & 0x00FFFFFF;
+  phase(uCamIII_PHASE_PICTURE, ms);
+  _jpegDone      = false;
+  _jpegFed       = 0;
+  if (_jpegParser) _jpegParser->reset();
+  if (!_imageSize) captureDone(false);
+  else converting();                                    // getOutputSize() for this frame's geometry/window
+  return _imageSize;                                    // return image size
 }
 
 
-long uCamIII_Base::getJpegData(uint8_t *buffer, int len, uCamIII_callback callback, int package)
+long uCamIII_Base::getJpegData(uint8_t *buffer, int len, const uCamIII_Sink& sink, int package)
 {
-  Log.trace(__FUNCTION__); 
+  uCamIII_LOG_TRACE(__FUNCTION__); 
 
-  uint16_t        id    = 0;
+  uint16_t        id    = 0xF0F0;
   uint16_t        size  = 0;
   uint32_t        ms    = millis();
+  bool            last;
 
   if (package >= 0) _packageNumber = package;           // request specific package
+  else if (_jpegDone) return 0;                         // image ended already (e.g. at EOI before the announced size)
   
-  if (sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, _packageNumber & 0xFF, _packageNumber >> 8))
+  for (int attempt = 0; ; attempt++)
   {
-    char info[4];
-    char chk[2];
-    if (_cameraStream.readBytes(info, sizeof(info)) == sizeof(info))
+    if (!sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, _packageNumber & 0xFF, _packageNumber >> 8)) break;
+
+    int r = readPackage(buffer, len, id, size);
+    if (r > 0)                                          // package complete and verified
     {
-      id   = info[0] | info[1] << 8;
-      size = info[2] | info[3] << 8;
+      count(&uCamIII_Stats::packages);
+      break;
     }
-    
-    if (!size || size > len 
-    || _cameraStream.readBytes((char*)buffer, size) != size
-    || _cameraStream.readBytes(chk, sizeof(chk)) != sizeof(chk)
-    ) 
-    {                                                   // if the expected data didn't arrive in time                                                   
-      delay(100);                                       // allow for extra bytes to trickle in and then
-      ms = millis();                                    // flush the RX buffer and
-      while(_cameraStream.read() >= 0 && millis() - ms < _timeout) yield();
-      id = 0xF0F0;                                      // prepare for termination of request
+
+    if (r < 0)                                          // whole package received but corrupt
+      count(&uCamIII_Stats::checksumErrors);
+    else                                                // the expected data didn't arrive in time
+    {
+      count(&uCamIII_Stats::shortReads);
+      flushInput();
     }
+    id = 0xF0F0;                                        // prepare for termination of request
+    if (attempt >= _pkgRetryLimit) break;
+    count(&uCamIII_Stats::retries);                     // re-request just this package
+    uCamIII_LOG_INFO("retry package %u (%s)", _packageNumber + 1, r < 0 ? "checksum" : "short read");
   }
 
-  if (id * (_packageSize - 6) >= _imageSize || millis() - ms >= _timeout)
+  if (id < 0xF0F0)
+  {
+    int n = jpegPayload(buffer, size, id);
+    if (n < 0) id = 0xF0F0;                             // broken image -> not passed on, don't fetch the rest
+    else size = n;
+  }
+  if (id < 0xF0F0 && !deliver(sink, buffer, size, id))
+    id = 0xF0F0;                                        // sink gave up -> don't fetch the rest
+  if ((last = (id == 0xF0F0 || (long)id * (_packageSize - 6) >= _imageSize || jpegEnded())))
     sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, 0xF0, 0xF0);   // report end of final data request to camera
   else
     _packageNumber = id;                                // prepare to request next package
+  _jpegDone = last;
+  phase(uCamIII_PHASE_DATA, ms);
+  if (last) captureDone(id < 0xF0F0);
   
-  if (id < 0xF0F0)
+  return (id < 0xF0F0) ? size : 0;
+}
+
+// give up the image getPicture() announced: a JPEG transfer is ended before the first package,
+// raw data can't be stopped and is drained so it isn't taken for the reply to the next command
+void uCamIII_Base::skipImage()
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  uint32_t ms = millis();
+
+  if (_format == uCamIII_COMP_JPEG)
+    sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, 0xF0, 0xF0);
+  else
   {
-    if (callback) callback(buffer, size, id);
-    return size;    
+    drainInput(20);
+    sendCmd(uCamIII_CMD_ACK, uCamIII_CMD_DATA, 0x00, 0x01, 0x00);
   }
-  
-  return 0;
+  _jpegDone = true;
+  phase(uCamIII_PHASE_DATA, ms);
+  captureDone(false);
 }
 
-long uCamIII_Base::getRawData(uint8_t *buffer, int len, uCamIII_callback callback)
+long uCamIII_Base::getRawData(uint8_t *buffer, int len, const uCamIII_Sink& sink)
 {
-  if (len >= _imageSize
-  && _imageSize == (long)_cameraStream.readBytes((char*)buffer, _imageSize)
-  )
+  uint32_t ms       = millis();
+  long     received = 0;
+  long     size     = 0;
+
+  if (converting())
+  {                                                     // read in small pieces and convert them straight 
+    uint8_t piece[64];                                  // into their place within the frame
+
+    while (len >= _converter->outputFrameBytes() && received < _imageSize)
+    {
+      int n = (_imageSize - received < (long)sizeof(piece)) ? _imageSize - received : sizeof(piece);
+      int r = _cameraStream.readBytes((char*)piece, n);
+      count(&uCamIII_Stats::bytes, r);
+      if (r != n) break;
+      size     += _converter->place(piece, n, buffer);
+      received += n;
+    }
+  }
+  else if (len >= _imageSize)
+  {
+    received = size = _cameraStream.readBytes((char*)buffer, _imageSize);
+    count(&uCamIII_Stats::bytes, received);
+  }
+
+  if (received == _imageSize)
   {                                                     // success -> report end of data request to camera
     sendCmd(uCamIII_CMD_ACK, uCamIII_CMD_DATA, 0x00, 0x01, 0x00);    
-    if (callback) callback(buffer, _imageSize, 0);
-    return _imageSize;       
-  }
-  else                                                  // if the expected data didn't arrive in time
-  { 
-    uint32_t ms;                                                                                         
-    delay(100);                                         // allow for extra bytes to trickle in and then
-    ms = millis();                                      // flush the RX buffer
-    while(_cameraStream.read() >= 0 && millis() - ms < _timeout) yield();
+    if (!deliver(sink, buffer, size, 0)) size = 0;
+    phase(uCamIII_PHASE_DATA, ms);
+    captureDone(size > 0);
+    return size;       
   }
-  
+  count(&uCamIII_Stats::timeouts);                      // incomplete (or no room for it) - the camera sends
+  flushInput();                                         // the image regardless, don't take it for a reply
+  phase(uCamIII_PHASE_DATA, ms);
+  captureDone(false);
   return 0;
 }
 
+// deliver raw image data in slices of sliceSize (default len) bytes via buffer, so the image 
+// doesn't need to fit into RAM - the camera doesn't wait, so the sink has to keep up
+// with the wire (i.e. not take longer than the UART RX buffer takes to fill)
+// with a converter each slice is read into the end of buffer and converted towards its start
+long uCamIII_Base::streamRawData(uint8_t *buffer, int len, const uCamIII_Sink& sink, int sliceSize)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  long     received = 0;
+  int      id       = 0;
+  bool     convert  = converting();
+  uint32_t ms       = millis();
+
+  if (!sink.isSet() || (sliceSize = rawSlice(len, sliceSize)) <= 0) return 0;
+
+  while (received < _imageSize)
+  {
+    int      n   = (_imageSize - received < sliceSize) ? _imageSize - received : sliceSize;
+    uint8_t *dst = buffer + len - n;
+    int      r   = _cameraStream.readBytes((char*)(convert ? dst : buffer), n);
+    count(&uCamIII_Stats::bytes, r);
+    if (r != n)
+    {                                                   // if the expected data didn't arrive in time
+      count(&uCamIII_Stats::timeouts);
+      flushInput();
+      phase(uCamIII_PHASE_DATA, ms);
+      captureDone(false);
+      return 0;
+    }
+    received += n;
+    if (!deliver(sink, buffer, convert ? _converter->convert(dst, n, buffer) : n, id++))
+    {                                                   // the camera can't be stopped, let it finish
+      drainInput(20);
+      sendCmd(uCamIII_CMD_ACK, uCamIII_CMD_DATA, 0x00, 0x01, 0x00);    
+      phase(uCamIII_PHASE_DATA, ms);
+      captureDone(false);
+      return 0;
+    }
+  }
+                                                        // success -> report end of data request to camera
+  sendCmd(uCamIII_CMD_ACK, uCamIII_CMD_DATA, 0x00, 0x01, 0x00);    
+  phase(uCamIII_PHASE_DATA, ms);
+  captureDone(true);
+  return received;
+}
+
+bool uCamIII_Base::dimensions(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, int& width, int& height)
+{
+  switch (resolution)
+  {
+    case uCamIII_80x60:   width =  80; height =  60; return true;
+    case uCamIII_160x120: width = 160; height = (format == uCamIII_COMP_JPEG) ? 128 : 120; return true;
+    case uCamIII_320x240: width = 320; height = 240; return true;
+    case uCamIII_640x480: width = 640; height = 480; return true;
+    case uCamIII_128x96:  width = 128; height =  96; return true;
+    case uCamIII_128x128: width = 128; height = 128; return true;
+    default:              width = height = 0;        return false;
+  }
+}
+
+int uCamIII_Base::bytesPerPixel(uCamIII_IMAGE_FORMAT format)
+{
+  switch (format)
+  {
+    case uCamIII_RAW_8BIT:         return 1;
+    case uCamIII_RAW_16BIT_RGB565:
+    case uCamIII_RAW_16BIT_CRYCBY: return 2;
+    default:                       return 0;           // JPEG
+  }
+}
+
+// camera baudrate = 14.7456MHz / 4 / (div1 + 1) / (div2 + 1), divider pairs as listed in the datasheet
+bool uCamIII_Base::baudrateDividers(uint32_t baudrate, uint8_t& div1, uint8_t& div2)
+{
+  static const struct { uint32_t baudrate; uint8_t div1; uint8_t div2; } rates[] =
+  { {    2400, 31, 47 }
+  , {    4800, 31, 23 }
+  , {    9600, 31, 11 }
+  , {   19200, 31,  5 }
+  , {   38400, 31,  2 }
+  , {   57600, 31,  1 }
+  , {  115200, 31,  0 }
+  , {  153600,  7,  2 }
+  , {  230400,  7,  1 }
+  , {  460800,  7,  0 }
+  , {  921600,  1,  1 }
+  , { 1228800,  2,  0 }
+  , { 1843200,  1,  0 }
+  , { 3686400,  0,  0 }
+  };
+
+  for (unsigned i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    if (rates[i].baudrate == baudrate)
+    {
+      div1 = rates[i].div1;
+      div2 = rates[i].div2;
+      return true;
+    }
+  return false;
+}
+
 void uCamIII_Base::hardReset()
 {
-  Log.trace(__FUNCTION__); 
+  uCamIII_LOG_TRACE(__FUNCTION__); 
 
   if (_resetPin > 0)
   {
+    uint32_t ms = millis();
     pinMode(_resetPin, OUTPUT);
     digitalWrite(_resetPin, LOW);
     delay(10);
     pinMode(_resetPin, INPUT);
     delay(10);
+    phase(uCamIII_PHASE_SYNC, ms);
+  }
+  invalidateSession();
+  _idleTime = 15;                                               // back to power-on defaults
+}
+
+// a camera that's been answering recently is taken as synced without sending anything,
+// otherwise SYNC (which also wakes it up and keeps its settings) and only reset it as a last resort
+long uCamIII_Base::ensureSync(int maxTry)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  long tries;
+
+  if (isSynced()) return 1;
+  if ((tries = sync(maxTry))) return tries;
+  hardReset();
+  return sync(maxTry);
+}
+
+long uCamIII_Base::setImageFormat(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (cached(uCamIII_SETTING_FORMAT, _format == format && _resolution == resolution)) return 1;
+  long r = sendCmdWithAck(uCamIII_CMD_INIT, 0x00, format, resolution, resolution); 
+  if (r) 
+  { 
+    _format     = format; 
+    _resolution = resolution; 
+    _known     |= uCamIII_SETTING_FORMAT;
+  } 
+  return r;
+}
+
+long uCamIII_Base::reset(uCamIII_RESET_TYPE type, bool force)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  long r = sendCmdWithAck(uCamIII_CMD_RESET, type, 0x00, 0x00, force ? uCamIII_RESET_FORCE : 0x00);
+  if (type == uCamIII_RESET_FULL)                               // camera has to be synced again
+  {
+    invalidateSession();
+    _idleTime = 15;
+  }
+  return r;
+}
+
+long uCamIII_Base::setFrequency(uCamIII_FREQ frequency)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (cached(uCamIII_SETTING_FREQ, _frequency == frequency)) return 1;
+  long r = sendCmdWithAck(uCamIII_CMD_SET_FREQ, frequency);
+  if (r)
+  {
+    _frequency = frequency;
+    _known    |= uCamIII_SETTING_FREQ;
+  }
+  return r;
+}
+
+long uCamIII_Base::setCBE(uCamIII_CBE contrast, uCamIII_CBE brightness, uCamIII_CBE exposure)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (cached(uCamIII_SETTING_CBE, _contrast == contrast && _brightness == brightness && _exposure == exposure)) return 1;
+  long r = sendCmdWithAck(uCamIII_CMD_SET_CBE, contrast, brightness, exposure);
+  if (r)
+  {
+    _contrast   = contrast;
+    _brightness = brightness;
+    _exposure   = exposure;
+    _known     |= uCamIII_SETTING_CBE;
+  }
+  return r;
+}
+
+long uCamIII_Base::setIdleTime(uint8_t seconds)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (cached(uCamIII_SETTING_IDLE, _idleTime == seconds)) return 1;
+  long r = sendCmdWithAck(uCamIII_CMD_SLEEP, seconds);
+  if (r)
+  {
+    _idleTime = seconds;
+    _known   |= uCamIII_SETTING_IDLE;
+  }
+  return r;
+}
+
+long uCamIII_Base::setPackageSize(uint16_t size)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if ((_pkgAuto = (size == uCamIII_PACKAGE_AUTO))) size = autoPackageSize(uCamIII_PACKAGE_MAX);
+  if (cached(uCamIII_SETTING_PACKSIZE, _packageSize == size)) return size;
+  if (!sendCmdWithAck(uCamIII_CMD_SET_PACKSIZE, 0x08, size & 0xFF, (size >> 8) & 0xFF)) return 0;
+  _known |= uCamIII_SETTING_PACKSIZE;
+  return (_packageSize = size);
+}
+
+uint32_t uCamIII_Base::getSnapshotWait()
+{
+  uint32_t elapsed = millis() - _snapMs;
+
+  if (!_snapPending || _snapKey != (_format << 8 | _resolution)) return 0;
+  return (elapsed < _snapLatency) ? _snapLatency - elapsed : 0;
+}
+
+// result of a GET_PICTURE probe for the pending snapshot; the latency is relearned whenever 
+// the camera needed longer than expected and otherwise creeps down towards the point where 
+// the first probe would just be early
+void uCamIII_Base::snapshotProbed(bool ready)
+{
+  uint16_t key = _format << 8 | _resolution;
+
+  if (!ready)
+  {
+    if (_snapProbe < 0xFFFF) _snapProbe++;                      // saturates, 0 means ready at the first probe
+    _snapNotReady++;
+    return;
+  }
+  if (_snapProbe || _snapKey != key)
+    _snapLatency = constrain(millis() - _snapMs, 0UL, 0xFFFFUL);
+  else
+    _snapLatency -= _snapLatency / 8;
+  _snapKey     = key;
+  _snapPending = false;
+}
+
+const uCamIII_TraceEntry* uCamIII_Base::getTraceEntry(uint16_t index)
+{
+  if (index >= _traceCount) return NULL;
+  return &_trace[(_traceHead + _traceSize - _traceCount + index) % _traceSize];
+}
+
+void uCamIII_Base::dumpTrace(Print& out)
+{
+  static const char *types[] = { "?", "TX", "RX", "SHORT", "PKG" };
+  char line[64];
+
+  for (uint16_t i = 0; i < _traceCount; i++)
+  {
+    const uCamIII_TraceEntry *e = getTraceEntry(i);
+    int n = snprintf(line, sizeof(line), "%10lu %-5s", (unsigned long)e->us, types[e->type <= uCamIII_TRACE_PACKAGE ? e->type : 0]);
+    for (int b = 0; b < e->len && n < (int)sizeof(line) - 4; b++)
+      n += snprintf(line + n, sizeof(line) - n, " %02X", e->data[b]);
+    snprintf(line + n, sizeof(line) - n, "\r\n");
+    out.write(line);
+  }
+}
+
+uint8_t uCamIII_Stats::nakIndex(uint8_t error)
+{
+  if (error >= uCamIII_ERROR_PIC_TYPE && error <= uCamIII_ERROR_PKG_SIZE) return error;
+  switch (error)
+  {
+    case uCamIII_ERROR_CMD_HEADER: return 0x12;
+    case uCamIII_ERROR_CMD_LENGTH: return 0x13;
+    case uCamIII_ERROR_PIC_SEND:   return 0x14;
+    case uCamIII_ERROR_CMD_SEND:   return 0x15;
+    default:                       return 0;
+  }
+}
+
+// ---------------------------- non-blocking capture engine ----------------------------
+
+bool uCamIII_Base::beginSync(int maxTry)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (isBusy()) return false;
+  _syncOnly   = true;
+  _syncMaxTry = maxTry;
+  enter(uCamIII_STATE_SYNC);
+  return true;
+}
+
+bool uCamIII_Base::beginCapture(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, 
+                                uint8_t *buffer, int len, const uCamIII_Sink& sink,
+                                uCamIII_PIC_TYPE type, uint16_t packageSize, bool sync)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (isBusy() || !buffer || len <= 0) return false;
+  if (format == uCamIII_COMP_JPEG && len < (packageSize ? packageSize : _pkgMin) - 6) return false;
+
+  _capFormat      = format;
+  _capResolution  = resolution;
+  _capType        = type;
+  _capPackageSize = packageSize;
+  _capAuto        = (packageSize == uCamIII_PACKAGE_AUTO);
+  _capBuffer      = buffer;
+  _capLen         = len;
+  _capSink        = sink;
+  _capReceived    = 0;
+  _frameCallback  = NULL;
+  _syncOnly       = false;
+  _syncMaxTry     = 60;
+  _failedState    = uCamIII_STATE_IDLE;
+  enter(sync ? uCamIII_STATE_SYNC : uCamIII_STATE_FORMAT);
+  return true;
+}
+
+bool uCamIII_Base::beginContinuous(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, 
+                                   uint8_t *buffer, int len, uCamIII_frameCallback callback,
+                                   float fps, uint16_t packageSize)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  uCamIII_PIC_TYPE type = (format == uCamIII_COMP_JPEG) ? uCamIII_TYPE_JPEG : uCamIII_TYPE_RAW;
+
+  if (!callback || !beginCapture(format, resolution, buffer, len, uCamIII_Sink(), type, packageSize)) return false;
+  _frameCallback   = callback;
+  _frameIntervalMs = (fps > 0) ? 1000 / fps : 0;
+  _frameSeq        =
+  _framesDelivered =
+  _framesSkipped   =
+  _framesDropped   = 0;
+  _frameStartMs    = 
+  _frameLastMs     = millis();
+  _frameStop       = false;
+  return true;
+}
+
+bool uCamIII_Base::trigger()
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (_state != uCamIII_STATE_ARMED) return false;
+  enter(uCamIII_STATE_SNAPSHOT);
+  return true;
+}
+
+float uCamIII_Base::getFps()
+{
+  uint32_t frames = _framesDelivered + _framesDropped;
+  uint32_t ms     = _frameLastMs - _frameStartMs;
+  return (frames > 1 && ms) ? (frames - 1) * 1000.0 / ms : 0;   // intervals between frame completions
+}
+
+long uCamIII_Base::getOutputSize()
+{
+  return (_converter && _converter->isActive()) ? _converter->outputSize(_imageSize) : _imageSize;
+}
+
+void uCamIII_Base::abort()
+{
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  if (_state == uCamIII_STATE_JPEG_DATA)
+    sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, 0xF0, 0xF0);           // tell camera we're done
+  if (isBusy())
+  {
+    statePhase();
+    captureDone(false);
+  }
+  _state = uCamIII_STATE_IDLE;
+}
+
+uCamIII_EVENT uCamIII_Base::poll()
+{
+  int r;
+
+  switch (_state)
+  {
+    case uCamIII_STATE_SYNC:                                    // latency counts from the SYNC, not from a stray reply
+      if (!(r = pollReply(_step ? _timeout : _syncWait))) return uCamIII_EVENT_NONE;
+      if (r > 0 && !_step && _rx[1] == uCamIII_CMD_ACK && _rx[2] == uCamIII_CMD_SYNC)
+      {
+        _step        = 1;                                       // SYNC from camera should follow the ACK
+        _syncLatency = millis() - _issueMs;
+        return uCamIII_EVENT_NONE;
+      }
+      if (r > 0 && _rx[1] == uCamIII_CMD_SYNC)                  // (also when its ACK got lost)
+      {
+        sendCmd(uCamIII_CMD_ACK, uCamIII_CMD_SYNC);
+        syncDone(_syncTry + 1, _step ? _syncLatency : millis() - _issueMs, _syncStartMs);
+        uCamIII_LOG_INFO("sync after %d tries (%lu ms)", _syncTry + 1, _syncLastMs);
+        if (_syncOnly)
+          _state = uCamIII_STATE_DONE;
+        else
+          enter(uCamIII_STATE_FORMAT);
+        return uCamIII_EVENT_SYNCED;
+      }
+      if (r > 0) return uCamIII_EVENT_NONE;                     // stray or late frame, keep waiting
+      if (++_syncTry >= _syncMaxTry) 
+      {
+        _syncFailures++;
+        return fail();
+      }
+      _step     = 0;
+      _syncWait = syncBackoff(_syncWait, _syncTry);
+      count(&uCamIII_Stats::syncTries);
+      issue(uCamIII_CMD_SYNC);
+      return uCamIII_EVENT_NONE;
+
+    case uCamIII_STATE_SNAPSHOT:
+      if (_step)                                                // give the camera its usual processing time
+      {
+        if (getSnapshotWait()) return uCamIII_EVENT_NONE;
+        enter(uCamIII_STATE_GET_PICTURE);
+        return uCamIII_EVENT_SNAPPED;
+      }
+      // fall through
+    case uCamIII_STATE_FORMAT:
+    case uCamIII_STATE_PACKAGE_SIZE:
+      if (!(r = pollReply(_timeout))) return uCamIII_EVENT_NONE;
+      if (r < 0 || _rx[1] != uCamIII_CMD_ACK || _rx[2] != _pendingCmd) return fail();
+      if (_state == uCamIII_STATE_SNAPSHOT)
+      {
+        _step        = 1;
+        _snapMs      = millis();
+        _captureMs   = _snapMs;
+        _snapPending = true;
+        _snapProbe   = 0;
+        return uCamIII_EVENT_NONE;
+      }
+      if (_state == uCamIII_STATE_FORMAT)
+      {
+        _format     = _capFormat;
+        _resolution = _capResolution;
+        _known     |= uCamIII_SETTING_FORMAT;
+      }
+      if (_state == uCamIII_STATE_FORMAT && _capFormat == uCamIII_COMP_JPEG)
+      {
+        enter(uCamIII_STATE_PACKAGE_SIZE);
+        return uCamIII_EVENT_NONE;
+      }
+      if (_state == uCamIII_STATE_PACKAGE_SIZE) 
+      {
+        _packageSize = _capPackageSize;
+        _known      |= uCamIII_SETTING_PACKSIZE;
+      }
+      enter(configured());
+      return uCamIII_EVENT_CONFIGURED;
+
+    case uCamIII_STATE_GET_PICTURE:
+      if (_step == 2)                                           // snapshot not ready yet, probe again
+      {
+        if (millis() - _stateMs < _snapProbeMs) return uCamIII_EVENT_NONE;
+        _step = 0;
+        issue(uCamIII_CMD_GET_PICTURE, _capType);
+        return uCamIII_EVENT_NONE;
+      }
+      if (!(r = pollReply(_timeout))) return uCamIII_EVENT_NONE;
+      if (r < 0) return fail();
+      if (!_step)
+      {
+        if (_capType == uCamIII_TYPE_SNAPSHOT && _snapPending
+        && _rx[1] == uCamIII_CMD_NAK && _lastError == uCamIII_ERROR_PIC_NOT_RDY
+        && millis() - _snapMs < _snapTimeout)
+        {
+          snapshotProbed(false);
+          _step    = 2;
+          _stateMs = millis();
+          return uCamIII_EVENT_NONE;
+        }
+        if (_rx[1] != uCamIII_CMD_ACK || _rx[2] != uCamIII_CMD_GET_PICTURE) return fail();
+        if (_capType == uCamIII_TYPE_SNAPSHOT) snapshotProbed(true);
+        _step = 1;                                              // DATA reply with the image size follows
+        return uCamIII_EVENT_NONE;
+      }
+      if (_rx[1] != uCamIII_CMD_DATA) return fail();
+      statePhase();
+      _imageSize = _rx[3] | _rx[4] << 8 | (long)_rx[5] << 16;
+      _capFill   = 0;
+      _capId     = 0;
+      _capAttempt = 0;
+      _step      = 0;
+      _stateMs   = millis();
+      uCamIII_LOG_INFO("image size %ld", _imageSize);
+      if (_capFormat == uCamIII_COMP_JPEG)
+      {
+        _jpegFed = 0;
+        if (_jpegParser) _jpegParser->reset();
+        if (_frameCallback && _imageSize > _capLen)             // frame won't fit the buffer
+        {
+          sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, 0xF0, 0xF0);     // don't transfer it at all
+          captureDone(false);
+          _framesDropped++;
+          nextFrame();
+          return uCamIII_EVENT_IMAGE_SIZE;
+        }
+        _state = uCamIII_STATE_JPEG_DATA;
+        _packageNumber = 0;
+        sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, 0x00, 0x00);        // request first package
+      }
+      else
+      {
+        converting();
+        _capSlice = rawSlice(_capLen, _frameCallback ? _imageSize : _capLen);  // whole frames at once
+        _state    = uCamIII_STATE_RAW_DATA;
+        if (_frameCallback && _capSlice < _imageSize) return fail();          // buffer too small
+      }
+      return uCamIII_EVENT_IMAGE_SIZE;
+
+    case uCamIII_STATE_FRAME_WAIT:
+      if (_frameStop)                                           // endContinuous() between two frames
+      {
+        _state = uCamIII_STATE_DONE;
+        return uCamIII_EVENT_COMPLETE;
+      }
+      if ((int32_t)(millis() - _frameDueMs) < 0) return uCamIII_EVENT_NONE;
+      enter(frameRequest());
+      return uCamIII_EVENT_NONE;
+
+    case uCamIII_STATE_ARMED:                                   // the snapshot wouldn't be answered once the
+      if (isSynced()) return uCamIII_EVENT_NONE;                // camera has fallen asleep waiting for trigger()
+      count(&uCamIII_Stats::timeouts);
+      _synced = false;
+      return fail();
+
+    case uCamIII_STATE_RAW_DATA:
+      return pollRaw();
+
+    case uCamIII_STATE_JPEG_DATA:
+      return pollJpeg();
+
+    default:
+      return uCamIII_EVENT_NONE;
   }
 }
 
 // ----------------------------------- protected ----------------------------------------
 
+void uCamIII_Base::traceRecord(uint8_t type, const uint8_t *data, uint8_t len)
+{
+  uCamIII_TraceEntry *e = &_trace[_traceHead];
+
+  e->us   = micros();
+  e->type = type;
+  e->len  = len > sizeof(e->data) ? sizeof(e->data) : len;
+  memcpy(e->data, data, e->len);
+  if (++_traceHead >= _traceSize) _traceHead = 0;
+  if (_traceCount < _traceSize) _traceCount++;
+}
+
+void uCamIII_Base::openStats()
+{
+  memset(&_capStats, 0, sizeof(_capStats));
+  _statsOpen = true;
+}
+
+void uCamIII_Base::countNak(uint8_t error)
+{
+  uint8_t i = uCamIII_Stats::nakIndex(error);
+
+  if (!_statsOpen) openStats();
+  _stats.naks[i]++;
+  _capStats.naks[i]++;
+}
+
+void uCamIII_Base::phase(uCamIII_PHASE phase, uint32_t startMs)
+{
+  uint32_t ms = millis() - startMs;
+
+  if (!_statsOpen) openStats();
+  _stats.phaseMs[phase]    += ms;
+  _capStats.phaseMs[phase] += ms;
+}
+
+// engine: charge the time since the last transition to the phase of the state being left
+void uCamIII_Base::statePhase()
+{
+  uint32_t start = _phaseMs;
+
+  _phaseMs = millis();
+  switch (_state)
+  {
+    case uCamIII_STATE_SYNC:         phase(uCamIII_PHASE_SYNC, start);     break;
+    case uCamIII_STATE_FORMAT:
+    case uCamIII_STATE_PACKAGE_SIZE: phase(uCamIII_PHASE_CONFIG, start);   break;
+    case uCamIII_STATE_SNAPSHOT:     phase(uCamIII_PHASE_SNAPSHOT, start); break;
+    case uCamIII_STATE_GET_PICTURE:  phase(uCamIII_PHASE_PICTURE, start);  break;
+    case uCamIII_STATE_RAW_DATA:
+    case uCamIII_STATE_JPEG_DATA:    phase(uCamIII_PHASE_DATA, start);     break;
+    default:                                                               break;
+  }
+}
+
+void uCamIII_Base::captureDone(bool ok)
+{
+  count(ok ? &uCamIII_Stats::captures : &uCamIII_Stats::failures);
+  tunePackages(ok);
+  _statsOpen = false;                                           // the next event starts a new record
+}
+
+// learn from the JPEG transfer that just ended and choose the package size for the next one:
+// the overhead per package is what a clean transfer took beyond the byte times on the wire,
+// the error rate per byte follows from the share of packages that failed at this size and 
+// the penalty of a failure from the time beyond the clean packages; estimates are averaged
+// over transfers (1/4 weight for the newest), the size only changes for a predicted 5% gain
+void uCamIII_Base::tunePackages(bool ok)
+{
+  uint32_t good   = _capStats.packages;
+  uint32_t bad    = _capStats.checksumErrors + _capStats.shortReads;
+  uint32_t ms     = _capStats.phaseMs[uCamIII_PHASE_DATA];
+  float    us     = 1000.0f * (ms > _capStats.sinkWaitMs ? ms - _capStats.sinkWaitMs : 0);    // the sink's time isn't the link's
+  float    byteUs = 10e6f / (_baudrate ? _baudrate : 115200);
+  float    q, best;
+  int      size   = _packageSize;
+
+  if (!good && !bad) return;                                    // no JPEG data transferred
+  if (ok && us > 0) _pkgGoodput = _imageSize * 1e6f / us;
+  if (good && !bad && us > 0)
+  {
+    float overhead = (us - _capStats.bytes * byteUs) / good - 12 * byteUs;   // request, header and verify code
+    if (overhead < 0) overhead = 0;
+    _pkgOverheadUs = _pkgLearned ? _pkgOverheadUs + ((long)overhead - (long)_pkgOverheadUs) / 4 : overhead;
+    _pkgLearned    = true;
+  }
+  else if (bad && _pkgLearned)
+  {
+    float clean   = _pkgOverheadUs + (size + 6) * byteUs;
+    float penalty = (us - good * clean) / bad;
+    if (penalty < clean) penalty = clean;
+    _pkgPenaltyUs  = _pkgPenaltyUs + ((long)penalty - (long)_pkgPenaltyUs) / 4;
+  }
+  q = (float)bad / (good + bad);
+  if (q > 0.95f) q = 0.95f;
+  _pkgErrorRate += (-logf(1 - q) / size - _pkgErrorRate) / 4;
+
+  if (!_pkgLearned) return;
+  best = packageGoodput(_pkgTuned) * 1.05f;
+  for (int s = _pkgMin; ; s += 32)
+  {
+    float g = packageGoodput(s = (s > _pkgMax) ? _pkgMax : s);
+    if (g > best)
+    {
+      best      = g;
+      _pkgTuned = s;
+    }
+    if (s == _pkgMax) break;
+  }
+  uCamIII_LOG_TRACE("package size %u: overhead %lu us, error rate %.6f, penalty %lu us -> %u", 
+                    size, _pkgOverheadUs, _pkgErrorRate, _pkgPenaltyUs, _pkgTuned);
+}
+
+// the tuned size, cut to the last image (in the tuning's 32 byte steps) so that a small image
+// isn't fetched in one mostly empty package, and to the `room` of the caller's buffer
+uint16_t uCamIII_Base::autoPackageSize(long room)
+{
+  long     need = _imageSize + 6;
+  uint16_t size = _pkgTuned;
+
+  if (_imageSize > 0 && need < size)
+    size = (need <= _pkgMin) ? _pkgMin : _pkgMin + (need - _pkgMin + 31) / 32 * 32;
+  if (size > _pkgTuned) size = _pkgTuned;
+  if (room < size) size = room;
+  return size;
+}
+
+// predicted payload bytes per us for packages of `size` bytes: a package takes the overhead 
+// plus its and its request's byte times, it fails with 1 - (1 - errorRate)^size and each 
+// failure costs the penalty
+float uCamIII_Base::packageGoodput(int size)
+{
+  float byteUs = 10e6f / (_baudrate ? _baudrate : 115200);
+  float fail   = 1 - powf(1 - _pkgErrorRate, size);
+
+  if (fail > 0.99f) return 0;
+  return (size - 6) / (_pkgOverheadUs + (size + 6) * byteUs + fail / (1 - fail) * _pkgPenaltyUs);
+}
+
+// blocking calls: hand a chunk to the sink, waiting while it's backed up - false if it 
+// aborted or made no progress within the sink timeout
+bool uCamIII_Base::deliver(const uCamIII_Sink& sink, uint8_t *buffer, int len, int id)
+{
+  uint32_t ms      = millis();
+  uint32_t last    = ms;
+  bool     stalled = false;
+  int      n       = 0;
+
+  if (!sink.isSet()) return true;
+  while (len > 0)
+  {
+    if ((n = sink.write(buffer, len, id)) < 0) break;
+    if (n > len) n = len;
+    buffer += n;
+    len    -= n;
+    if (!len) break;
+    if (n) last = millis();
+    if (!stalled) count(&uCamIII_Stats::sinkStalls);
+    stalled = true;
+    if (millis() - last >= _sinkTimeout) break;
+    yield();
+    delay(1);
+  }
+  if (stalled) count(&uCamIII_Stats::sinkWaitMs, millis() - ms);
+  if (!len) return true;
+  count(&uCamIII_Stats::sinkAborts);
+  uCamIII_LOG_WARN("sink %s", n < 0 ? "aborted" : "stalled");
+  return false;
+}
+
 long uCamIII_Base::sendCmd(uCamIII_CMD cmd, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t p4)
 {
-  Log.trace(__FUNCTION__); 
+  uCamIII_LOG_TRACE(__FUNCTION__); 
 
   uint8_t buf[6] = { uCamIII_STARTBYTE, cmd, p1, p2, p3, p4 };
-  Log.info("sendCmd: %02X %02X %02X %02X %02X %02X", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+  uCamIII_LOG_TRACE("sendCmd: %02X %02X %02X %02X %02X %02X", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+  trace(uCamIII_TRACE_TX, buf, sizeof(buf));
+  _lastCmdMs = millis();
   return _cameraStream.write(buf, 6);
 }
 
 long uCamIII_Base::sendCmdWithAck(uCamIII_CMD cmd, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t p4) 
 {
-  Log.trace(__FUNCTION__); 
+  uCamIII_LOG_TRACE(__FUNCTION__); 
+
+  uint32_t ms = millis();
+  long     r;
 
   sendCmd(cmd, p1, p2, p3, p4);
-  return expectPackage(uCamIII_CMD_ACK, cmd);
+  r = expectPackage(uCamIII_CMD_ACK, cmd);
+  phase(cmd == uCamIII_CMD_SNAPSHOT    ? uCamIII_PHASE_SNAPSHOT 
+      : cmd == uCamIII_CMD_GET_PICTURE ? uCamIII_PHASE_PICTURE 
+      :                                  uCamIII_PHASE_CONFIG, ms);
+  return r;
 }
 
 long uCamIII_Base::expectPackage(uCamIII_CMD pkg, uint8_t option)
 {
-  Log.trace("%s(%02x,%02x)", __FUNCTION__, pkg, option); 
+  uCamIII_LOG_TRACE("%s(%02x,%02x)", __FUNCTION__, pkg, option); 
   uint8_t buf[6];
+  int     n;
   memset(buf, 0x00, sizeof(buf));
+  _lastError = 0;                                               // a timeout mustn't look like the last NAK
 
-  if (_cameraStream.readBytes((char*)buf, sizeof(buf)) == sizeof(buf))
+  if ((n = _cameraStream.readBytes((char*)buf, sizeof(buf))) == sizeof(buf))
   {
-    _lastError = 0;
-    Log.trace("received: %02X %02X %02X %02X %02X %02X", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+    uCamIII_LOG_TRACE("received: %02X %02X %02X %02X %02X %02X", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+    trace(uCamIII_TRACE_RX, buf, sizeof(buf));
     if (buf[1] == pkg && (buf[2] == option || option == uCamIII_DONT_CARE)) 
       return buf[3] | buf[4] << 8 | buf[5] << 16 | 0x1000000;
-    else if (buf[1] == uCamIII_CMD_NAK)
+    if (buf[1] == uCamIII_CMD_NAK)                              // e.g. PIC_NOT_RDY while probing, the caller decides
+    {
       _lastError = buf[4];
+      countNak(_lastError);
+      uCamIII_LOG_TRACE("NAK %02X for %02X", buf[4], option);
+      return 0;
+    }
+    uCamIII_LOG_WARN("unexpected: %02X %02X %02X %02X %02X %02X", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+    return 0;
   }
   
-  Log.warn("timeout: %02X %02X %02X %02X %02X %02X (%lu)", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], _timeout);
+  trace(uCamIII_TRACE_SHORT, buf, n);                           // no (complete) answer, the camera may
+  count(&uCamIII_Stats::timeouts);                              // have gone to sleep or been reset
+  _synced = false;
+  uCamIII_LOG_WARN("timeout: %02X %02X %02X %02X %02X %02X (%lu)", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], _timeout);
   return 0;
 }
+
+// true (and the command can be skipped) if the camera is synced and `setting` has already
+// been acknowledged with the requested value
+bool uCamIII_Base::cached(uCamIII_SETTING setting, bool same)
+{
+  if (!same || !(_known & setting) || !isSynced()) return false;
+  _skippedCmds++;
+  return true;
+}
+
+// read until a frame `AA cmd option ...` has been seen or `ms` have passed, at any byte offset
+bool uCamIII_Base::scanFrame(uint8_t cmd, uint8_t option, uint32_t ms)
+{
+  uint8_t  win[6];
+  int      n     = 0;
+  uint32_t start = millis();
+  uint32_t elapsed;
+  char     c;
+
+  while ((elapsed = millis() - start) < ms)
+  {
+    _cameraStream.setTimeout(ms - elapsed);
+    if (_cameraStream.readBytes(&c, 1) != 1) break;
+    if (n == sizeof(win))
+    {
+      memmove(win, win + 1, sizeof(win) - 1);
+      n--;
+    }
+    win[n++] = c;
+    if (n == sizeof(win) && win[0] == uCamIII_STARTBYTE && win[1] == cmd 
+    && (option == uCamIII_DONT_CARE || win[2] == option))
+    {
+      _lastCmdMs = millis();
+      trace(uCamIII_TRACE_RX, win, sizeof(win));
+      return true;
+    }
+  }
+  return false;
+}
+
+// discard input until nothing has arrived for `quietMs`
+void uCamIII_Base::drainInput(uint32_t quietMs)
+{
+  char c;
+
+  _cameraStream.setTimeout(quietMs);
+  while (_cameraStream.readBytes(&c, 1) == 1) 
+  {
+    count(&uCamIII_Stats::flushedBytes);
+    yield();
+  }
+  _cameraStream.setTimeout(_timeout);
+}
+
+// reply wait for the next SYNC: kept while the camera is expected to ignore SYNCs (as many 
+// tries as the last sync needed), then growing by half each try up to four times the learned 
+// wait (at least 20ms, at most the timeout) - a late reply is still found during the next try,
+// so longer waits would only slow down syncs the camera ignores
+uint16_t uCamIII_Base::syncBackoff(uint16_t wait, int tries)
+{
+  unsigned long limit = constrain(_syncWaitMs * 4UL, 20UL, _timeout);
+
+  if (tries < _syncLastTries) return wait;
+  wait += wait / 2 + 1;
+  return (wait < limit) ? wait : limit;
+}
+
+// remember what worked and update the statistics
+void uCamIII_Base::syncDone(int tries, uint32_t latency, uint32_t startMs)
+{
+  unsigned long wait = latency + latency / 2 + 2;               // 50% headroom over the observed reply time
+
+  _syncWaitMs    = constrain(wait, 5UL, _timeout);
+  _syncLastTries = tries;
+  _syncLastMs    = millis() - startMs;
+  if (_syncLastMs > _syncMaxMs) _syncMaxMs = _syncLastMs;
+  _syncCount++;
+  _synced        = true;
+}
+
+// read one JPEG package (id, size, data, verify code) 
+// returns 1 for a verified package, -1 for a checksum mismatch and 0 for a short read or bad header
+int uCamIII_Base::readPackage(uint8_t *buffer, int len, uint16_t& id, uint16_t& size)
+{
+  uint8_t info[6];                                              // id, size + verify code for the trace
+  uint8_t *chk = &info[4];
+  int      n;
+
+  if ((n = _cameraStream.readBytes((char*)info, 4)) != 4) 
+  {
+    trace(uCamIII_TRACE_SHORT, info, n);
+    return 0;
+  }
+  id   = info[0] | info[1] << 8;
+  size = info[2] | info[3] << 8;
+
+  if (size && size <= len)
+  {
+    n = _cameraStream.readBytes((char*)buffer, size);
+    count(&uCamIII_Stats::bytes, n);
+  }
+  if (!size || size > len || n != size
+  || _cameraStream.readBytes((char*)chk, 2) != 2
+  ) 
+  {
+    trace(uCamIII_TRACE_PACKAGE, info, 4);
+    return 0;
+  }
+  trace(uCamIII_TRACE_PACKAGE, info, sizeof(info));
+
+  return (chk[0] == verifyCode(info, buffer, size) && chk[1] == 0x00) ? 1 : -1;
+}
+
+// the verify code is the low byte of the sum over id, size and data
+uint8_t uCamIII_Base::verifyCode(const uint8_t *info, const uint8_t *data, int size)
+{
+  uint8_t sum = info[0] + info[1] + info[2] + info[3];
+  while (size--) sum += *data++;
+  return sum;
+}
+
+// (re)start the converter for the current frame, true if it has anything to do
+bool uCamIII_Base::converting()
+{
+  return _converter && _converter->begin(_format, _resolution) && _converter->isActive();
+}
+
+// a verified JPEG package through the parser (if any): bytes of it to pass on, -1 if the image 
+// is broken - the package the announced size ends with must have brought EOI by then. Each 
+// package id is parsed once, a package requested again is only cut where the image ended
+int uCamIII_Base::jpegPayload(uint8_t *data, int len, uint16_t id)
+{
+  int  n;
+  long rest;
+
+  if (!_jpegParser) return len;
+  if (id <= _jpegFed)                                   // parsed already
+  {
+    if (!_jpegParser->isDone()) return len;
+    rest = _jpegParser->getLength() - (long)(id - 1) * (_packageSize - 6);
+    return (rest <= 0) ? 0 : (rest < len) ? (int)rest : len;
+  }
+  _jpegFed = id;
+  if ((n = _jpegParser->parse(data, len)) < 0 
+   || ((long)id * (_packageSize - 6) >= _imageSize && !_jpegParser->finish()))
+  {
+    count(&uCamIII_Stats::jpegBroken);
+    _lastError = uCamIII_ERROR_JPEG_BROKEN;
+    return -1;
+  }
+  return n;
+}
+
+// true once the parser saw EOI: the image ends there, whatever size was announced
+bool uCamIII_Base::jpegEnded()
+{
+  if (!_jpegParser || !_jpegParser->isDone()) return false;
+  if (_jpegParser->getLength() < _imageSize)
+  {
+    count(&uCamIII_Stats::jpegSkipped, _imageSize - _jpegParser->getLength());
+    _imageSize = _jpegParser->getLength();
+  }
+  return true;
+}
+
+// raw input bytes per slice so that the (converted) output fits `len` 
+int uCamIII_Base::rawSlice(int len, int sliceSize)
+{
+  if (sliceSize <= 0 || sliceSize > len) sliceSize = len;
+  if (_converter && _converter->isActive())
+  {
+    int unit = _converter->unitBytes();
+    while (sliceSize > 0 && _converter->outputSize(sliceSize) > len) sliceSize -= unit;
+    sliceSize -= sliceSize % unit;
+  }
+  return sliceSize;
+}
+
+void uCamIII_Base::flushInput()
+{
+  uint32_t ms;
+  delay(100);                                           // allow for extra bytes to trickle in and then
+  ms = millis();                                        // flush the RX buffer
+  while(_cameraStream.read() >= 0 && millis() - ms < _timeout) 
+  {
+    count(&uCamIII_Stats::flushedBytes);
+    yield();
+  }
+}
+
+// ---------------------------- non-blocking capture engine ----------------------------
+
+void uCamIII_Base::issue(uCamIII_CMD cmd, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t p4)
+{
+  _pendingCmd = cmd;
+  _rxLen      = 0;
+  _lastError  = 0;
+  _stateMs    =
+  _issueMs    = millis();
+  sendCmd(cmd, p1, p2, p3, p4);
+}
+
+int uCamIII_Base::pollReply(uint32_t timeout)
+{
+  int c;
+
+  while (_rxLen < sizeof(_rx) && (c = _cameraStream.read()) >= 0)
+  {
+    if (!_rxLen && c != uCamIII_STARTBYTE) continue;            // skip noise between replies
+    _rx[_rxLen++] = c;
+  }
+  if (_rxLen == sizeof(_rx))
+  {
+    uCamIII_LOG_TRACE("received: %02X %02X %02X %02X %02X %02X", _rx[0], _rx[1], _rx[2], _rx[3], _rx[4], _rx[5]);
+    trace(uCamIII_TRACE_RX, _rx, sizeof(_rx));
+    _rxLen   = 0;
+    _stateMs = millis();
+    if (_rx[1] == uCamIII_CMD_NAK) countNak(_lastError = _rx[4]);
+    return 1;
+  }
+  if (millis() - _stateMs < timeout) return 0;
+  trace(uCamIII_TRACE_SHORT, _rx, _rxLen);
+  if (_state != uCamIII_STATE_SYNC) count(&uCamIII_Stats::timeouts);   // unanswered SYNCs are normal
+  return -1;
+}
+
+void uCamIII_Base::enter(uCamIII_STATE state)
+{
+  statePhase();
+  _state = state;
+  _step  = 0;
+
+  switch (state)
+  {
+    case uCamIII_STATE_SYNC:                                    // steps the session cache makes redundant are skipped
+      if (!_syncOnly && isSynced())
+        enter(uCamIII_STATE_FORMAT);
+      else
+      {
+        _syncTry     = 0;
+        _syncWait    = _syncWaitMs;
+        _syncStartMs = millis();
+        count(&uCamIII_Stats::syncTries);
+        issue(uCamIII_CMD_SYNC);
+      }
+      break;
+    case uCamIII_STATE_FORMAT:
+      if (cached(uCamIII_SETTING_FORMAT, _format == _capFormat && _resolution == _capResolution))
+        enter(_capFormat == uCamIII_COMP_JPEG ? uCamIII_STATE_PACKAGE_SIZE : configured());
+      else
+        issue(uCamIII_CMD_INIT, 0x00, _capFormat, _capResolution, _capResolution);
+      break;
+    case uCamIII_STATE_PACKAGE_SIZE:
+      _capPackageSize = capPackageSize();
+      if (cached(uCamIII_SETTING_PACKSIZE, _packageSize == _capPackageSize))
+        enter(configured());
+      else
+        issue(uCamIII_CMD_SET_PACKSIZE, 0x08, _capPackageSize & 0xFF, (_capPackageSize >> 8) & 0xFF);
+      break;
+    case uCamIII_STATE_SNAPSHOT:
+      if (_capType == uCamIII_TYPE_SNAPSHOT)
+        issue(uCamIII_CMD_SNAPSHOT, _capFormat == uCamIII_COMP_JPEG ? uCamIII_SNAP_JPEG : uCamIII_SNAP_RAW);
+      else
+        enter(uCamIII_STATE_GET_PICTURE);
+      break;
+    case uCamIII_STATE_GET_PICTURE:
+      _frameMs = millis();
+      if (_capType != uCamIII_TYPE_SNAPSHOT) _captureMs = _frameMs;
+      issue(uCamIII_CMD_GET_PICTURE, _capType);
+      break;
+    default:
+      break;
+  }
+}
+
+uCamIII_EVENT uCamIII_Base::fail(bool linkOk)
+{
+  uCamIII_LOG_WARN("capture failed in state %d (%02X)", _state, _rx[1] == uCamIII_CMD_NAK ? _lastError : 0);
+  if (_state == uCamIII_STATE_JPEG_DATA)
+    sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, 0xF0, 0xF0);           // terminate data request
+  if (!linkOk && _rx[1] != uCamIII_CMD_NAK)                     // no answer - let the next capture sync first
+    _synced = false;
+  statePhase();
+  captureDone(false);
+  _failedState = _state;
+  _state       = uCamIII_STATE_ERROR;
+  return uCamIII_EVENT_ERROR;
+}
+
+uCamIII_EVENT uCamIII_Base::pollRaw()
+{
+  int      n    = _cameraStream.available();
+  bool     convert = _converter && _converter->isActive();
+  uint8_t *tail    = convert ? _capBuffer + _capLen - _capSlice : _capBuffer;
+
+  if (_step == 6)                                               // the sink gave up: discard the rest of the frame
+  {
+    if (n > 0)
+    {
+      while (n-- > 0 && _cameraStream.read() >= 0) count(&uCamIII_Stats::flushedBytes);
+      _stateMs = millis();
+      return uCamIII_EVENT_NONE;
+    }
+    if (millis() - _stateMs < 20) return uCamIII_EVENT_NONE;    // not quiet yet
+    sendCmd(uCamIII_CMD_ACK, uCamIII_CMD_DATA, 0x00, 0x01, 0x00);
+    return fail(true);
+  }
+  if (_step >= 4) return pollSink();                            // previous slice still with the sink
+  if (n <= 0)
+  {
+    if (millis() - _stateMs < _timeout) return uCamIII_EVENT_NONE;
+    count(&uCamIII_Stats::timeouts);
+    return fail();
+  }
+
+  if (n > _capSlice - _capFill) n = _capSlice - _capFill;
+  if (n > _imageSize - _capReceived) n = _imageSize - _capReceived;
+  n = _cameraStream.readBytes((char*)&tail[_capFill], n);
+  count(&uCamIII_Stats::bytes, n);
+  _capFill     += n;
+  _capReceived += n;
+  _stateMs      = millis();
+
+  if (_capFill < _capSlice && _capReceived < _imageSize) return uCamIII_EVENT_NONE;
+
+  if (convert)
+    _capFill = _converter->convert(tail, _capFill, _capBuffer);
+  _sinkData = _capBuffer;
+  _sinkLeft = _capFill;
+  _sinkMs   = millis();
+  _step     = 4;
+  return pollSink();
+}
+
+uCamIII_EVENT uCamIII_Base::pollJpeg()
+{
+  int      n;
+  uint8_t *pkg = _frameCallback ? _capBuffer + _capReceived : _capBuffer;  // continuous: append packages
+  int      len = _capLen - (pkg - _capBuffer);
+
+  if (_step >= 4) return pollSink();                            // package still with the sink
+  while ((n = _cameraStream.available()) > 0)
+  {
+    _stateMs = millis();
+    switch (_step)
+    {
+      case 0:                                                   // package header: id, size
+        n = _cameraStream.read();
+        _rx[_rxLen++] = n;
+        if (_rxLen < 4) break;
+        _rxLen   = 0;
+        _capId   = _rx[0] | _rx[1] << 8;
+        _capSize = _rx[2] | _rx[3] << 8;
+        _capFill = 0;
+        _step    = 1;
+        if (!_capSize || _capSize > len)                        // garbled header -> drain and re-request
+        {
+          trace(uCamIII_TRACE_PACKAGE, _rx, 4);
+          count(&uCamIII_Stats::shortReads);
+          return retryPackage(true);
+        }
+        break;
+      case 1:                                                   // payload
+        if (n > _capSize - _capFill) n = _capSize - _capFill;
+        n         = _cameraStream.readBytes((char*)&pkg[_capFill], n);
+        _capFill += n;
+        count(&uCamIII_Stats::bytes, n);
+        if (_capFill == _capSize) _step = 2;
+        break;
+      case 2:                                                   // verify code
+        _rx[4 + _rxLen++] = _cameraStream.read();
+        if (_rxLen < 2) break;
+        _rxLen = 0;
+        trace(uCamIII_TRACE_PACKAGE, _rx, sizeof(_rx));
+        if (_rx[4] != verifyCode(_rx, pkg, _capSize) || _rx[5] != 0x00)
+        {
+          count(&uCamIII_Stats::checksumErrors);
+          return retryPackage(false);
+        }
+        count(&uCamIII_Stats::packages);
+        _capAttempt   = 0;
+        if ((n = jpegPayload(pkg, _capSize, _capId)) < 0) 
+          return fail(true);                                    // broken image, not passed on
+        _capReceived += n;
+        _sinkData     = pkg;
+        _sinkLeft     = n;
+        _sinkMs       = millis();
+        _step         = 4;
+        return pollSink();
+      default:                                                  // discard until the line goes quiet
+        while (_cameraStream.read() >= 0) count(&uCamIII_Stats::flushedBytes);
+        break;
+    }
+  }
+
+  if (_step == 3)                                               // retry once the line has gone quiet
+  {
+    if (millis() - _stateMs < 100) return uCamIII_EVENT_NONE;
+    uCamIII_LOG_INFO("retry package %u", _packageNumber + 1);
+    _step    = 0;
+    _rxLen   = 0;
+    _stateMs = millis();
+    sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, _packageNumber & 0xFF, _packageNumber >> 8);
+    return uCamIII_EVENT_NONE;
+  }
+  if (millis() - _stateMs >= _timeout)
+  {
+    count(&uCamIII_Stats::shortReads);
+    return retryPackage(true);
+  }
+  return uCamIII_EVENT_NONE;
+}
+
+// end of a frame: a single capture is done, a continuous one passes it on and goes for the next
+uCamIII_EVENT uCamIII_Base::frameDone(long size)
+{
+  statePhase();
+  captureDone(true);
+  if (!_frameCallback)
+  {
+    _state = uCamIII_STATE_DONE;
+    return uCamIII_EVENT_COMPLETE;
+  }
+
+  int r = _frameCallback(_capBuffer, size, _frameSeq, _frameMs);
+  if (!_framesDelivered && !_framesDropped) _frameStartMs = millis();   // fps counts from the first frame
+  if (r) 
+    _framesDelivered++;
+  else 
+    _framesDropped++;
+  _frameLastMs = millis();
+  if (r < 0) _frameStop = true;
+  nextFrame();
+  return uCamIII_EVENT_FRAME;
+}
+
+// schedule the next frame request: frames are requested on a 1000/fps grid starting with the 
+// first one, slots missed because the sink or the link took too long (by more than half a slot) 
+// are skipped - and their sequence numbers left out - rather than caught up on
+void uCamIII_Base::nextFrame()
+{
+  uint32_t now = millis();
+
+  if (!_frameSeq) _frameDueMs = _frameMs;                       // anchor the grid
+  _frameSeq++;
+  _capReceived = 0;
+  if (_frameStop)
+  {
+    _state = uCamIII_STATE_DONE;
+    return;
+  }
+  if (!_frameIntervalMs)
+  {
+    enter(frameRequest());
+    return;
+  }
+
+  _frameDueMs += _frameIntervalMs;
+  while ((int32_t)(now - _frameDueMs) > (int32_t)(_frameIntervalMs / 2))
+  {
+    _frameDueMs += _frameIntervalMs;
+    _frameSeq++;
+    _framesSkipped++;
+  }
+  _state = uCamIII_STATE_FRAME_WAIT;
+}
+
+// offer the rest of the current slice/package to the sink, only once it has taken all of it
+// the next raw slice is read or the next JPEG package requested (backpressure)
+uCamIII_EVENT uCamIII_Base::pollSink()
+{
+  int n = _capSink.isSet() ? _capSink.write(_sinkData, _sinkLeft, _capId) : _sinkLeft;
+
+  if (n < 0)
+  {
+    count(&uCamIII_Stats::sinkAborts);
+    return sinkFailed();
+  }
+  if (n > _sinkLeft) n = _sinkLeft;
+  _sinkData += n;
+  _sinkLeft -= n;
+  if (_sinkLeft)
+  {
+    if (_step == 4) count(&uCamIII_Stats::sinkStalls);
+    if (_step == 4 || n) _stateMs = millis();                   // timeout counts from the last progress
+    _step = 5;
+    if (millis() - _stateMs < _sinkTimeout) return uCamIII_EVENT_NONE;
+    count(&uCamIII_Stats::sinkAborts);
+    return sinkFailed();
+  }
+  if (_step == 5) count(&uCamIII_Stats::sinkWaitMs, millis() - _sinkMs);
+  _step    = 0;
+  _stateMs = millis();
+
+  if (_state == uCamIII_STATE_RAW_DATA)
+  {
+    _capId++;
+    _capFill = 0;
+    if (_capReceived < _imageSize) return uCamIII_EVENT_DATA;
+    sendCmd(uCamIII_CMD_ACK, uCamIII_CMD_DATA, 0x00, 0x01, 0x00); // report end of data request to camera
+    return frameDone(_converter && _converter->isActive() ? _converter->outputSize(_imageSize) : _imageSize);
+  }
+
+  if ((long)_capId * (_packageSize - 6) >= _imageSize || jpegEnded())
+  {
+    sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, 0xF0, 0xF0);           // report end of final data request to camera
+    return frameDone(_capReceived);
+  }
+  _packageNumber = _capId;                                      // request next package
+  sendCmd(uCamIII_CMD_ACK, 0x00, 0x00, _packageNumber & 0xFF, _packageNumber >> 8);
+  return uCamIII_EVENT_DATA;
+}
+
+// the sink doesn't want the rest: a JPEG transfer is ended right away (see fail()),
+// raw data still arrives - pollRaw() drains it as it comes and fails once the line is quiet
+uCamIII_EVENT uCamIII_Base::sinkFailed()
+{
+  uCamIII_LOG_WARN("sink gave up after %ld bytes", _capReceived);
+  if (_state != uCamIII_STATE_RAW_DATA) return fail(true);
+  _step    = 6;
+  _stateMs = millis();
+  return uCamIII_EVENT_NONE;
+}
+
+// re-request the current package - after a short read or a garbled header only once what's
+// left of it has been drained (as flushInput() does for the blocking calls), late bytes of
+// it would otherwise be taken for the retry's header
+uCamIII_EVENT uCamIII_Base::retryPackage(bool drain)
+{
+  if (_capAttempt++ >= _pkgRetryLimit) return fail();
+  count(&uCamIII_Stats::retries);
+  _step    = 3;
+  _rxLen   = 0;
+  _stateMs = millis() - (drain ? 0 : 100);                      // a package with a bad checksum is complete
+  return uCamIII_EVENT_NONE;
+}
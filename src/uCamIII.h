@@ -7,10 +7,10 @@ http://4dsystems.com.au/product/uCAM_III/
 http://www.4dsystems.com.au/productpages/uCAM-III/downloads/uCAM-III_datasheet_R_1_0.pdf
 
 Overview:
-The library implements most functions the uCamIII provides according to datasheet, 
-only baudrate selection is omitted due to the fact that up to 115200 the autodetection 
-works fine and higher baudrates available for the camera are usually not supported by 
-the microcontrollers using this library.
+The library implements most functions the uCamIII provides according to datasheet.
+The link is established at an autodetected baudrate (up to 115200) via `init()`, 
+higher rates (up to 3686400 where the UART supports it) can then be negotiated via 
+`setBaudrate()` which falls back to the previous rate when the camera can't be synced.
 
 It also supports hardware and software serial ports (e.g. `ParticleSoftSerial` on the 
 Particle side or `SoftwareSerial` and `NewSoftSerial` for Arduino) by use of 
@@ -63,6 +63,21 @@ SOFTWARE.
  #include "SoftwareSerial.h"
 #endif
 
+// log statements below uCamIII_LOG_LEVEL are compiled out together with their arguments,
+// build with -DuCamIII_LOG_LEVEL=LOG_LEVEL_TRACE to see every command and reply
+// (Log.level still filters at runtime what is compiled in)
+#ifndef uCamIII_LOG_LEVEL
+ #define uCamIII_LOG_LEVEL  LOG_LEVEL_INFO
+#endif
+#define uCamIII_LOG_TRACE(...) do { if (uCamIII_LOG_LEVEL <= LOG_LEVEL_TRACE) Log.trace(__VA_ARGS__); } while (0)
+#define uCamIII_LOG_INFO(...)  do { if (uCamIII_LOG_LEVEL <= LOG_LEVEL_INFO)  Log.info(__VA_ARGS__);  } while (0)
+#define uCamIII_LOG_WARN(...)  do { if (uCamIII_LOG_LEVEL <= LOG_LEVEL_WARN)  Log.warn(__VA_ARGS__);  } while (0)
+
+// the binary trace ring (see attachTrace()) costs a pointer test per frame, 0 removes even that
+#ifndef uCamIII_TRACE_RING
+ #define uCamIII_TRACE_RING 1
+#endif
+
 enum uCamIII_CMD
 { uCamIII_CMD_INIT          = 0x01
 , uCamIII_CMD_GET_PICTURE   = 0x04
@@ -98,6 +113,12 @@ enum uCamIII_RES
 , uCamIII_128x128           = 0x09
 };
 
+enum uCamIII_PACKAGE                  // JPEG package sizes the camera accepts (see setPackageSize())
+{ uCamIII_PACKAGE_AUTO      = 0       // chosen by the library from the transfers so far
+, uCamIII_PACKAGE_MIN       = 64
+, uCamIII_PACKAGE_MAX       = 512
+};
+
 enum uCamIII_PIC_TYPE
 { uCamIII_TYPE_SNAPSHOT     = 0x01
 , uCamIII_TYPE_RAW          = 0x02
@@ -148,56 +169,482 @@ enum uCamIII_ERROR
 , uCamIII_ERROR_CMD_HEADER  = 0xF0   
 , uCamIII_ERROR_CMD_LENGTH  = 0xF1   
 , uCamIII_ERROR_PIC_SEND    = 0xF5   
+, uCamIII_ERROR_JPEG_BROKEN = 0xF6    // the JPEG's structure didn't check out (see setJpegParser())
 , uCamIII_ERROR_CMD_SEND    = 0xFF   
 };
 
+enum uCamIII_STATE                    // non-blocking capture engine (see beginCapture()/poll())
+{ uCamIII_STATE_IDLE        = 0x00
+, uCamIII_STATE_SYNC
+, uCamIII_STATE_FORMAT
+, uCamIII_STATE_PACKAGE_SIZE
+, uCamIII_STATE_SNAPSHOT
+, uCamIII_STATE_GET_PICTURE
+, uCamIII_STATE_RAW_DATA
+, uCamIII_STATE_JPEG_DATA
+, uCamIII_STATE_FRAME_WAIT            // continuous capture waiting for the next frame slot
+, uCamIII_STATE_DONE
+, uCamIII_STATE_ERROR
+, uCamIII_STATE_ARMED                 // configured, waiting for trigger() (see setExternalTrigger())
+};
+
+enum uCamIII_EVENT
+{ uCamIII_EVENT_NONE        = 0x00
+, uCamIII_EVENT_SYNCED                // link established
+, uCamIII_EVENT_CONFIGURED            // image format (and package size) acknowledged
+, uCamIII_EVENT_SNAPPED               // snapshot taken
+, uCamIII_EVENT_IMAGE_SIZE            // DATA reply received, getImageSize() valid
+, uCamIII_EVENT_DATA                  // a chunk/package has been passed to the callback
+, uCamIII_EVENT_FRAME                 // continuous capture: a frame has been passed to the frame callback
+, uCamIII_EVENT_COMPLETE              // all image data received
+, uCamIII_EVENT_ERROR                 // see getLastError() and getFailedState()
+};
+
+enum uCamIII_SETTING                  // settings the camera acknowledged (see isKnown())
+{ uCamIII_SETTING_FORMAT    = 0x01
+, uCamIII_SETTING_CBE       = 0x02
+, uCamIII_SETTING_PACKSIZE  = 0x04
+, uCamIII_SETTING_FREQ      = 0x08
+, uCamIII_SETTING_IDLE      = 0x10
+};
+
+enum uCamIII_TRACE_TYPE               // entries of the binary trace ring
+{ uCamIII_TRACE_TX          = 0x01    // command sent
+, uCamIII_TRACE_RX          = 0x02    // reply received
+, uCamIII_TRACE_SHORT       = 0x03    // reply incomplete when the wait ended (`len` bytes valid)
+, uCamIII_TRACE_PACKAGE     = 0x04    // JPEG package id, size and verify code (`len` 4 if cut short)
+};
+
+struct uCamIII_TraceEntry
+{
+  uint32_t          us;                 // micros() when recorded
+  uint8_t           type;               // uCamIII_TRACE_TYPE
+  uint8_t           len;
+  uint8_t           data[6];
+};
+
+enum uCamIII_PHASE                    // where the time of a capture goes (see getStats())
+{ uCamIII_PHASE_SYNC        = 0x00    // sync(), hardReset() 
+, uCamIII_PHASE_CONFIG                // format, package size, CBE, ... 
+, uCamIII_PHASE_SNAPSHOT              // SNAPSHOT and the wait for its processing
+, uCamIII_PHASE_PICTURE               // GET_PICTURE until the DATA reply
+, uCamIII_PHASE_DATA                  // image data transfer
+, uCamIII_PHASES
+};
+
+struct uCamIII_Stats
+{
+  enum { NAK_CODES = 22 };
+
+  uint32_t          captures;           // images received completely
+  uint32_t          failures;           // captures given up
+  uint32_t          syncTries;          // SYNC commands sent
+  uint32_t          phaseMs[uCamIII_PHASES];
+  uint32_t          bytes;              // image data read (incl. packages that had to be re-requested)
+  uint32_t          packages;           // JPEG packages verified
+  uint32_t          retries;            // JPEG packages re-requested
+  uint32_t          checksumErrors;     // JPEG verify code mismatches
+  uint32_t          shortReads;         // JPEG packages incomplete or with garbled header
+  uint32_t          flushedBytes;       // discarded while resynchronising with the byte stream
+  uint32_t          timeouts;           // replies (other than to SYNC) and raw data not arriving in time
+  uint32_t          sinkStalls;         // chunks the sink didn't take at once
+  uint32_t          sinkWaitMs;         // spent waiting for it (part of uCamIII_PHASE_DATA)
+  uint32_t          sinkAborts;         // transfers stopped by the sink (or because it stayed busy)
+  uint32_t          jpegBroken;         // JPEGs given up by the parser (see setJpegParser())
+  uint32_t          jpegSkipped;        // bytes announced after EOI that weren't requested
+  uint16_t          naks[NAK_CODES];    // NAK replies, see nak()
+
+  inline uint16_t   nak(uint8_t error) const { return naks[nakIndex(error)]; }
+  static uint8_t    nakIndex(uint8_t error);                    // uCamIII_ERROR -> naks[] (0 = unknown code)
+};
+
 typedef int (*uCamIII_callback)(uint8_t* buffer, int len, int id);
 
+enum uCamIII_SINK_RESULT              // what a uCamIII_sinkFunc returns besides the number of bytes taken
+{ uCamIII_SINK_ABORT        = -1      // the rest of the image isn't wanted, stop the transfer
+, uCamIII_SINK_BUSY         = 0       // nothing taken, offer it again later
+};
+
+// image data sink: `context` is passed back unchanged, returns how many of the `len` bytes
+// it took - fewer than `len` (backpressure) makes the library offer the rest again before
+// it requests more data, uCamIII_SINK_ABORT ends the transfer
+typedef int (*uCamIII_sinkFunc)(void* context, uint8_t* buffer, int len, int id);
+
+struct uCamIII_Sink
+{
+  uCamIII_sinkFunc  func;
+  void             *context;
+  uCamIII_callback  callback;           // plain callback: return value ignored, takes everything
+
+  uCamIII_Sink(uCamIII_callback cb = NULL) 
+  : func(NULL), context(NULL), callback(cb) { }
+  uCamIII_Sink(uCamIII_sinkFunc fn, void *ctx) 
+  : func(fn), context(ctx), callback(NULL) { }
+
+  inline bool       isSet() const       { return func || callback; }
+  inline int        write(uint8_t *buffer, int len, int id) const
+                    { if (func) return func(context, buffer, len, id); if (callback) callback(buffer, len, id); return len; }
+};
+// continuous capture: a complete frame, its sequence number (gaps = skipped frames) and the
+// millis() it was requested at - return > 0 when taken, 0 when it had to be dropped and < 0 
+// when taken but no further frames are wanted
+typedef int (*uCamIII_frameCallback)(uint8_t* frame, long size, uint32_t seq, uint32_t ms);
+
+class uCamIII_Converter;                // see uCamIII_Converter.h
+class uCamIII_JpegParser;               // see uCamIII_JpegParser.h
+
 class uCamIII_Base {
 public:
   uCamIII_Base(Stream& cameraStream, int resetPin = -1, uint32_t timeout = 500) 
-  : _cameraStream(cameraStream), _resetPin(resetPin), _timeout(timeout), _imageSize(0), _packageSize(64), _packageNumber(0), _lastError(0) { } 
+  : _cameraStream(cameraStream), _resetPin(resetPin), _timeout(timeout), _baudrate(0), _imageSize(0), _packageSize(64), _packageNumber(0), _lastError(0)
+  , _format(uCamIII_COMP_JPEG), _resolution(uCamIII_640x480), _converter(NULL), _jpegParser(NULL), _jpegDone(false), _jpegFed(0)
+  , _pkgRetryLimit(3), _pkgAuto(false), _pkgMin(uCamIII_PACKAGE_MIN), _pkgMax(uCamIII_PACKAGE_MAX), _pkgTuned(uCamIII_PACKAGE_MAX)
+  , _pkgLearned(false), _pkgOverheadUs(0), _pkgPenaltyUs(100000), _pkgErrorRate(0), _pkgGoodput(0)
+  , _synced(false), _known(0), _idleTime(15), _lastCmdMs(0), _skippedCmds(0)
+  , _syncWaitMs(5), _syncLastTries(1), _syncLastMs(0), _syncMaxMs(0), _syncCount(0), _syncFailures(0)
+  , _snapMs(0), _captureMs(0), _snapKey(0), _snapLatency(0), _snapTimeout(2000), _snapProbeMs(5), _snapPending(false), _snapProbe(0), _snapNotReady(0)
+  , _stats(), _capStats(), _statsOpen(false), _phaseMs(0), _sinkTimeout(5000)
+  , _trace(NULL), _traceSize(0), _traceHead(0), _traceCount(0)
+  , _state(uCamIII_STATE_IDLE), _failedState(uCamIII_STATE_IDLE), _capHold(false), _frameCallback(NULL) { } 
 
   long              sync(int maxTry = 60);
   long              getPicture(uCamIII_PIC_TYPE type = uCamIII_TYPE_JPEG);
-  long              getJpegData(uint8_t *buffer, int len, uCamIII_callback callback = NULL, int package = -1);
-  long              getRawData(uint8_t *buffer, int len, uCamIII_callback callback = NULL);
+  long              getJpegData(uint8_t *buffer, int len, const uCamIII_Sink& sink = uCamIII_Sink(), int package = -1);
+  long              getRawData(uint8_t *buffer, int len, const uCamIII_Sink& sink = uCamIII_Sink());
+  long              streamRawData(uint8_t *buffer, int len, const uCamIII_Sink& sink, int sliceSize = 0);
+  void              skipImage();                                // instead of the data calls, when the image isn't wanted
   void              hardReset();
   
-  inline long       setImageFormat(uCamIII_IMAGE_FORMAT format = uCamIII_COMP_JPEG, uCamIII_RES resolution = uCamIII_640x480)
-                    { Log.trace(__FUNCTION__); return sendCmdWithAck(uCamIII_CMD_INIT, 0x00, format, resolution, resolution); }
-  inline long       takeSnapshot(uCamIII_SNAP_TYPE type = uCamIII_SNAP_JPEG, uint16_t frame = 0)
-                    { Log.trace(__FUNCTION__); long r = sendCmdWithAck(uCamIII_CMD_SNAPSHOT, type, frame & 0xFF, (frame >> 8) & 0xFF); delay(_timeout); return r; }
-  inline long       reset(uCamIII_RESET_TYPE type = uCamIII_RESET_FULL, bool force = true)
-                    { Log.trace(__FUNCTION__); return sendCmdWithAck(uCamIII_CMD_RESET, type, 0x00, 0x00, force ? uCamIII_RESET_FORCE : 0x00); }
-  inline long       setFrequency(uCamIII_FREQ frequency = uCamIII_50Hz)
-                    { Log.trace(__FUNCTION__); return sendCmdWithAck(uCamIII_CMD_SET_FREQ, frequency); }
-  inline long       setCBE(uCamIII_CBE contrast = uCamIII_DEFAULT, uCamIII_CBE brightness = uCamIII_DEFAULT, uCamIII_CBE exposure = uCamIII_DEFAULT)
-                    { Log.trace(__FUNCTION__); return sendCmdWithAck(uCamIII_CMD_SET_CBE, contrast, brightness, exposure); }
-  inline long       setIdleTime(uint8_t seconds = 15)
-                    { Log.trace(__FUNCTION__); return sendCmdWithAck(uCamIII_CMD_SLEEP, seconds); }
-  inline long       setPackageSize(uint16_t size = 64)
-                    { Log.trace(__FUNCTION__); return sendCmdWithAck(uCamIII_CMD_SET_PACKSIZE, 0x08, size & 0xFF, (size >> 8) & 0xFF) ? (_packageSize = size) : 0; }
+  long              setImageFormat(uCamIII_IMAGE_FORMAT format = uCamIII_COMP_JPEG, uCamIII_RES resolution = uCamIII_640x480);
+  long              takeSnapshot(uCamIII_SNAP_TYPE type = uCamIII_SNAP_JPEG, uint16_t frame = 0);
+  long              reset(uCamIII_RESET_TYPE type = uCamIII_RESET_FULL, bool force = true);
+  long              setFrequency(uCamIII_FREQ frequency = uCamIII_50Hz);
+  long              setCBE(uCamIII_CBE contrast = uCamIII_DEFAULT, uCamIII_CBE brightness = uCamIII_DEFAULT, uCamIII_CBE exposure = uCamIII_DEFAULT);
+  long              setIdleTime(uint8_t seconds = 15);
+  long              setPackageSize(uint16_t size = 64);
+  inline uint16_t   getPackageSize()   { return _packageSize; }
   inline uint8_t    getLastError() 
-                    { Log.trace(__FUNCTION__); return _lastError; }
+                    { uCamIII_LOG_TRACE(__FUNCTION__); return _lastError; }
+  inline uint32_t   getBaudrate()
+                    { return _baudrate; }
+  static bool       baudrateDividers(uint32_t baudrate, uint8_t& div1, uint8_t& div2);
+
+  // geometry of the currently set image format
+  inline uCamIII_IMAGE_FORMAT getImageFormat() { return _format; }
+  inline uCamIII_RES getResolution()   { return _resolution; }
+  inline int        getRowBytes()      
+                    { int w, h; return dimensions(_format, _resolution, w, h) ? w * bytesPerPixel(_format) : 0; }
+  static bool       dimensions(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, int& width, int& height);
+  static int        bytesPerPixel(uCamIII_IMAGE_FORMAT format);
+
+  // session cache: the set...() functions above only send a command when the setting differs
+  // from what the camera last acknowledged, the cache is dropped by hardReset()/reset() and
+  // when the camera stops answering
+  long              ensureSync(int maxTry = 60);               // sync only if the link may be lost, reset if it is
+  inline bool       isSynced()                                 // synced and not idle long enough to have gone to sleep
+                    { return _synced && (!_idleTime || millis() - _lastCmdMs + _timeout < _idleTime * 1000UL); }
+  inline bool       isKnown(uCamIII_SETTING setting)   { return _known & setting; }
+  inline void       invalidateSession()                { _synced = false; _known = 0; }
+  inline uint32_t   getSkippedCommands()               { return _skippedCmds; }
+
+  // sync() starts with the reply wait that worked last time and backs off exponentially 
+  // (bounded by the timeout) once past the number of tries the last sync needed
+  inline uint16_t   getSyncWaitMs()     { return _syncWaitMs; }           // learned reply wait
+  inline uint16_t   getSyncLastTries()  { return _syncLastTries; }
+  inline uint32_t   getSyncLastMs()     { return _syncLastMs; }           // duration of the last sync
+  inline uint32_t   getSyncMaxMs()      { return _syncMaxMs; }
+  inline uint32_t   getSyncCount()      { return _syncCount; }            // successful syncs
+  inline uint32_t   getSyncFailures()   { return _syncFailures; }
+  inline uint32_t   getSyncTries()      { return _stats.syncTries; }      // SYNC commands sent
+  inline void       clearSyncCounters() 
+                    { _syncLastMs = _syncMaxMs = _syncCount = _syncFailures = _stats.syncTries = 0; }
+
+  // takeSnapshot() returns as soon as the camera acknowledged it, getPicture(uCamIII_TYPE_SNAPSHOT)
+  // then waits for the processing time learned for the current format/resolution and probes
+  // the camera (re-requesting while it NAKs with uCamIII_ERROR_PIC_NOT_RDY) for up to `timeout` ms;
+  // work done in between overlaps the camera's processing
+  inline void       setSnapshotTimeout(uint16_t timeout = 2000, uint8_t probeMs = 5)
+                    { _snapTimeout = timeout; _snapProbeMs = probeMs ? probeMs : 1; }
+  uint32_t          getSnapshotWait();                          // ms until the snapshot is expected to be ready
+  inline uint16_t   getSnapshotLatency() { return _snapLatency; }        // learned processing time (0 = unknown)
+  inline uint32_t   getSnapshotProbes()  { return _snapNotReady; }       // PIC_NOT_RDY replies
+
+  // binary trace ring: commands, replies and JPEG package headers are copied (unformatted, 
+  // with a timestamp) into `entries` caller provided slots, the oldest being overwritten;
+  // cheap enough to keep attached and dump after a failure
+  inline void       attachTrace(uCamIII_TraceEntry *ring, uint16_t entries)
+                    { _trace = ring; _traceSize = ring ? entries : 0; _traceHead = _traceCount = 0; }
+  inline uint16_t   getTraceCount()     { return _traceCount; }
+  const uCamIII_TraceEntry* getTraceEntry(uint16_t index);      // 0 = oldest
+  void              dumpTrace(Print& out);
+  inline void       clearTrace()        { _traceHead = _traceCount = 0; }
+
+  // pixel conversion applied to raw data as it is read (NULL to turn off)
+  // with a converter getRawData() needs a buffer of converter->outputFrameBytes() and 
+  // streamRawData()/poll() pass converted slices of at most `len` bytes to the callback
+  inline void       setConverter(uCamIII_Converter *converter) 
+                    { _converter = converter; }
+  inline uCamIII_Converter* getConverter() { return _converter; }
+
+  // JPEG structure check applied to each package as it arrives (NULL to turn off): the
+  // transfer ends with EOI - getImageSize() then is the JPEG's length, bytes the camera 
+  // announced beyond it aren't requested - and a broken image is given up right away 
+  // (getLastError() == uCamIII_ERROR_JPEG_BROKEN) without the package it showed in
+  inline void       setJpegParser(uCamIII_JpegParser *parser) 
+                    { _jpegParser = parser; }
+  inline uCamIII_JpegParser* getJpegParser() { return _jpegParser; }
+
+  // JPEG packages failing verification or arriving incomplete are re-requested up to 
+  // `retries` times before the transfer is given up
+  inline void       setPackageRetries(uint8_t retries = 3)
+                    { _pkgRetryLimit = retries; }
+  inline uint32_t   getPackageRetries()        { return _stats.retries; }
+  inline uint32_t   getPackageChecksumErrors() { return _stats.checksumErrors; }
+  inline uint32_t   getPackageShortReads()     { return _stats.shortReads; }
+  inline void       clearPackageCounters()     
+                    { _stats.retries = _stats.checksumErrors = _stats.shortReads = 0; }
+
+  // package size tuning: each JPEG transfer teaches the fixed cost of a package (request,
+  // header, turnaround - spread over more bytes by bigger packages) and the rate at which 
+  // packages fail (more of them the bigger they are, each costing a re-request); with
+  // setPackageSize(uCamIII_PACKAGE_AUTO) before each capture, or uCamIII_PACKAGE_AUTO passed
+  // to beginCapture()/beginContinuous(), the size in `minSize`..`maxSize` with the best 
+  // predicted goodput is used - buffers passed to getJpegData() then have to hold maxSize - 6
+  inline void       setPackageRange(uint16_t minSize = uCamIII_PACKAGE_MIN, uint16_t maxSize = uCamIII_PACKAGE_MAX)
+                    { _pkgMin = constrain(minSize, (uint16_t)uCamIII_PACKAGE_MIN, (uint16_t)uCamIII_PACKAGE_MAX); 
+                      _pkgMax = constrain(maxSize, _pkgMin, (uint16_t)uCamIII_PACKAGE_MAX); 
+                      _pkgTuned = constrain(_pkgTuned, _pkgMin, _pkgMax); }
+  inline bool       isPackageAuto()             { return _pkgAuto; }
+  inline uint16_t   getAutoPackageSize()        { return autoPackageSize(uCamIII_PACKAGE_MAX); }  // size the next capture gets
+  inline float      getGoodput()                { return _pkgGoodput; }     // image bytes/s of the last JPEG transfer
+  inline uint32_t   getPackageOverheadUs()      { return _pkgOverheadUs; }  // learned fixed cost per package
+  inline float      getPackageErrorRate()       { return _pkgErrorRate; }   // learned failures per package byte
+
+  // a sink that takes less than it's offered holds up the transfer: the next JPEG package is
+  // only requested (the next raw slice only read - the camera keeps sending raw data though, 
+  // the UART has to buffer it) once it has taken everything; after `timeout` ms of no 
+  // progress, or when it returns uCamIII_SINK_ABORT, the transfer is ended (raw data is drained)
+  inline void       setSinkTimeout(uint16_t timeout = 5000) { _sinkTimeout = timeout; }
+
+  // statistics, cumulative since clearStats() and for the current (or last) capture, which
+  // ends with the last image byte or when the capture is given up - the next counted 
+  // event starts a new one; counting is a handful of additions per command/package
+  inline const uCamIII_Stats& getStats()        { return _stats; }
+  inline const uCamIII_Stats& getCaptureStats() { return _capStats; }
+  inline void       clearStats()        { memset(&_stats, 0, sizeof(_stats)); }
+
+  // non-blocking capture engine
+  // begin...() only sends the first command, poll() has to be called regularly (e.g. from loop())
+  // and only consumes the bytes already available() - it never waits for the camera.
+  // For JPEG `len` has to hold a package payload (packageSize - 6), for raw formats the 
+  // callback gets the image in slices of `len` bytes (e.g. getRowBytes() for whole rows).
+  // Don't mix with the blocking functions above while isBusy().
+  bool              beginSync(int maxTry = 60);
+  bool              beginCapture(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, 
+                                 uint8_t *buffer, int len, const uCamIII_Sink& sink = uCamIII_Sink(),
+                                 uCamIII_PIC_TYPE type = uCamIII_TYPE_SNAPSHOT, uint16_t packageSize = 512,
+                                 bool sync = true);
+  // continuous capture (live preview): keeps the camera configured and requests RAW/JPEG 
+  // frames back to back (or every 1000/fps ms, skipping slots the sink made it miss); each
+  // frame is assembled in `buffer`, which has to hold a whole (converted) frame - JPEG frames
+  // that don't fit are dropped
+  bool              beginContinuous(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, 
+                                    uint8_t *buffer, int len, uCamIII_frameCallback callback,
+                                    float fps = 0, uint16_t packageSize = 512);
+  inline void       endContinuous()     { _frameStop = true; }   // stop after the current frame
+  // with an external trigger captures begun afterwards stop in uCamIII_STATE_ARMED once the
+  // camera is configured and only take their snapshot (or request the first frame) when 
+  // trigger() is called, e.g. to have several cameras snap at the same moment; a capture
+  // still armed when the camera may have gone to sleep (see setIdleTime()) fails
+  inline void       setExternalTrigger(bool hold)      { _capHold = hold; }
+  bool              trigger();                          // false if not armed
+  inline bool       isArmed()           { return _state == uCamIII_STATE_ARMED; }
+  inline uint32_t   getFrameCount()     { return _framesDelivered; }
+  inline uint32_t   getFramesSkipped()  { return _framesSkipped; }
+  inline uint32_t   getFramesDropped()  { return _framesDropped; }
+  float             getFps();                                   // frames received per second
+  uCamIII_EVENT     poll();
+  void              abort();
+  inline bool       isBusy() 
+                    { return _state != uCamIII_STATE_IDLE && _state != uCamIII_STATE_DONE && _state != uCamIII_STATE_ERROR; }
+  inline uCamIII_STATE getState()       { return _state; }
+  inline uCamIII_STATE getFailedState() { return _failedState; }
+  inline long       getImageSize()      { return _imageSize; }
+  inline uint32_t   getCaptureMs()      { return _captureMs; }  // millis() the image was taken (snapshot ACK or GET_PICTURE)
+  long              getOutputSize();                            // image size after the converter (if any)
+  inline long       getReceived()       { return _capReceived; }
   
 protected:
   Stream&           _cameraStream;
   int               _resetPin;
   unsigned long     _timeout;
+  uint32_t          _baudrate;
   long              _imageSize;
   short             _packageSize;
   unsigned short    _packageNumber;
   uint8_t           _lastError;
+  uCamIII_IMAGE_FORMAT _format;
+  uCamIII_RES       _resolution;
+  uCamIII_Converter *_converter;
+  uCamIII_JpegParser *_jpegParser;
+  bool              _jpegDone;                                  // getJpegData() delivered the last package
+  uint16_t          _jpegFed;                                   // last package id the parser has seen
+  uint8_t           _pkgRetryLimit;
+
+  // package size tuning
+  bool              _pkgAuto;                                   // setPackageSize(uCamIII_PACKAGE_AUTO)
+  uint16_t          _pkgMin;
+  uint16_t          _pkgMax;
+  uint16_t          _pkgTuned;                                  // size chosen for the next capture
+  bool              _pkgLearned;                                // overhead measured at least once
+  uint32_t          _pkgOverheadUs;
+  uint32_t          _pkgPenaltyUs;                              // cost of a failed package incl. its attempt
+  float             _pkgErrorRate;
+  float             _pkgGoodput;
+
+  // session cache
+  bool              _synced;
+  uint8_t           _known;                                     // uCamIII_SETTING flags
+  uint8_t           _contrast;
+  uint8_t           _brightness;
+  uint8_t           _exposure;
+  uint8_t           _frequency;
+  uint8_t           _idleTime;                                  // seconds, camera default 15
+  uint32_t          _lastCmdMs;                                 // camera's idle timer restarts with each command
+  uint32_t          _skippedCmds;                               // set...() calls answered from the cache
+
+  // adaptive sync
+  uint16_t          _syncWaitMs;                                // reply wait for the first SYNC
+  uint16_t          _syncLastTries;
+  uint32_t          _syncLastMs;
+  uint32_t          _syncMaxMs;
+  uint32_t          _syncCount;
+  uint32_t          _syncFailures;
+
+  // deferred snapshot completion
+  uint32_t          _snapMs;                                    // when the camera acknowledged the snapshot
+  uint32_t          _captureMs;                                 // when the current image was taken
+  uint16_t          _snapKey;                                   // format/resolution _snapLatency was learned for
+  uint16_t          _snapLatency;
+  uint16_t          _snapTimeout;
+  uint8_t           _snapProbeMs;                               // interval between GET_PICTURE probes
+  bool              _snapPending;
+  uint16_t          _snapProbe;                                 // probes for the current snapshot
+  uint32_t          _snapNotReady;
+
+  // statistics
+  uCamIII_Stats     _stats;
+  uCamIII_Stats     _capStats;
+  bool              _statsOpen;                                 // _capStats belongs to a capture in progress
+  uint32_t          _phaseMs;                                   // engine: start of the current state's phase
+
+  // sink backpressure
+  uint16_t          _sinkTimeout;
+
+  // binary trace ring
+  uCamIII_TraceEntry *_trace;
+  uint16_t          _traceSize;
+  uint16_t          _traceHead;                                 // next slot to write
+  uint16_t          _traceCount;
+
+  // non-blocking capture engine
+  uCamIII_STATE     _state;
+  uCamIII_STATE     _failedState;
+  uint8_t           _step;                                      // sub-step within _state
+  uint32_t          _stateMs;                                   // start of current wait
+  uint8_t           _rx[6];                                     // reply/package header being assembled
+  uint8_t           _rxLen;
+  uint8_t           _pendingCmd;
+  uint32_t          _issueMs;                                   // when _pendingCmd was sent
+  int               _syncTry;
+  int               _syncMaxTry;
+  uint16_t          _syncWait;                                  // reply wait for the current try
+  uint32_t          _syncLatency;
+  uint32_t          _syncStartMs;
+  bool              _syncOnly;
+  uCamIII_IMAGE_FORMAT _capFormat;
+  uCamIII_RES       _capResolution;
+  uCamIII_PIC_TYPE  _capType;
+  uint16_t          _capPackageSize;
+  bool              _capAuto;                                   // uCamIII_PACKAGE_AUTO
+  uint8_t          *_capBuffer;
+  int               _capLen;
+  int               _capFill;
+  int               _capSlice;                                  // raw input bytes per callback
+  uCamIII_Sink      _capSink;
+  uint8_t          *_sinkData;                                  // rest of the chunk the sink hasn't taken yet
+  int               _sinkLeft;
+  uint32_t          _sinkMs;                                    // when the chunk was offered
+  bool              _capHold;                                   // stop in ARMED until trigger()
+  long              _capReceived;
+  uint16_t          _capId;
+  uint16_t          _capSize;
+  uint8_t           _capAttempt;
+  uCamIII_frameCallback _frameCallback;                         // NULL for single captures
+  uint32_t          _frameIntervalMs;                           // 0 = back to back
+  uint32_t          _frameDueMs;
+  uint32_t          _frameMs;                                   // request time of the current frame
+  uint32_t          _frameSeq;
+  uint32_t          _frameStartMs;                              // for getFps()
+  uint32_t          _frameLastMs;
+  uint32_t          _framesDelivered;
+  uint32_t          _framesSkipped;
+  uint32_t          _framesDropped;
+  bool              _frameStop;
+
+  void              issue(uCamIII_CMD cmd, uint8_t p1 = 0, uint8_t p2 = 0, uint8_t p3 = 0, uint8_t p4 = 0);
+  int               pollReply(uint32_t timeout);
+  void              enter(uCamIII_STATE state);
+  inline uCamIII_STATE configured()     { return _capHold ? uCamIII_STATE_ARMED : uCamIII_STATE_SNAPSHOT; }
+  inline uint16_t   capPackageSize()                            // the tuned size where it's up to the library
+                    { return _capAuto ? autoPackageSize(_capLen + 6) : _capPackageSize; }
+  inline uCamIII_STATE frameRequest()                           // continuous: retune between frames
+                    { return (_capAuto && _capFormat == uCamIII_COMP_JPEG && capPackageSize() != _packageSize) 
+                           ? uCamIII_STATE_PACKAGE_SIZE : uCamIII_STATE_GET_PICTURE; }
+  uCamIII_EVENT     fail(bool linkOk = false);
+  uCamIII_EVENT     pollRaw();
+  uCamIII_EVENT     pollJpeg();
+  uCamIII_EVENT     retryPackage(bool drain);                   // drain: the line has to go quiet first
+  uCamIII_EVENT     pollSink();                               // _step 4: chunk offered, 5: sink stalled
+  uCamIII_EVENT     sinkFailed();
+  uCamIII_EVENT     frameDone(long size);
+  void              nextFrame();
   
   long              sendCmd(uCamIII_CMD cmd, uint8_t p1 = 0, uint8_t p2 = 0, uint8_t p3 = 0, uint8_t p4 = 0);
   long              sendCmdWithAck(uCamIII_CMD cmd, uint8_t p1 = 0, uint8_t p2 = 0, uint8_t p3 = 0, uint8_t p4 = 0);
   long              expectPackage(uCamIII_CMD pkg, uint8_t option = uCamIII_DONT_CARE);
+  bool              cached(uCamIII_SETTING setting, bool same);
+  bool              scanFrame(uint8_t cmd, uint8_t option, uint32_t ms);
+  void              drainInput(uint32_t quietMs);
+  uint16_t          syncBackoff(uint16_t wait, int tries);
+  void              syncDone(int tries, uint32_t latency, uint32_t startMs);
+  void              snapshotProbed(bool ready);
+  inline void       trace(uint8_t type, const uint8_t *data, uint8_t len)
+                    { if (uCamIII_TRACE_RING && _trace) traceRecord(type, data, len); }
+  void              traceRecord(uint8_t type, const uint8_t *data, uint8_t len);
+  inline void       count(uint32_t uCamIII_Stats::*field, uint32_t n = 1)
+                    { if (!_statsOpen) openStats(); _stats.*field += n; _capStats.*field += n; }
+  void              openStats();
+  void              countNak(uint8_t error);
+  void              phase(uCamIII_PHASE phase, uint32_t startMs);
+  void              statePhase();
+  void              captureDone(bool ok);
+  void              tunePackages(bool ok);
+  uint16_t          autoPackageSize(long room);
+  float             packageGoodput(int size);
+  bool              deliver(const uCamIII_Sink& sink, uint8_t *buffer, int len, int id);
   long              init();
+  int               readPackage(uint8_t *buffer, int len, uint16_t& id, uint16_t& size);
+  void              flushInput();
+  bool              converting();
+  int               jpegPayload(uint8_t *data, int len, uint16_t id);
+  bool              jpegEnded();
+  int               rawSlice(int len, int sliceSize);
+  static uint8_t    verifyCode(const uint8_t *info, const uint8_t *data, int size);
   
 #if defined(PARTICLE)
   inline void       yield() 
-                    { Log.trace(__FUNCTION__); Particle.process(); }
+                    { uCamIII_LOG_TRACE(__FUNCTION__); Particle.process(); }
 #else
   inline void       yield() 
                     { }
@@ -214,17 +661,49 @@ public:
   : uCamIII_Base(*camera, resetPin, timeout), _cameraInterface(*camera) { } 
 
   long init(int baudrate = 9600) { 
-    Log.trace("uCAMIII: %s", __FUNCTION__);
+    uCamIII_LOG_TRACE("uCAMIII: %s", __FUNCTION__);
     _cameraInterface.end();
     delay(100);
     _cameraInterface.begin(baudrate);
     _cameraInterface.setTimeout(_timeout);
     delay(100);
+    _baudrate = baudrate;
     return uCamIII_Base::init();
   }
 
+  // switch camera and UART to one of the rates the camera supports (see baudrateDividers())
+  // returns the new rate or 0 if the switch failed and the link has been reestablished 
+  // at the previous rate (via reset pin if necessary)
+  long setBaudrate(uint32_t baudrate, int maxTry = 10) {
+    uCamIII_LOG_TRACE("uCAMIII: %s(%lu)", __FUNCTION__, baudrate);
+    uint8_t  div1, div2;
+    uint32_t previous = _baudrate;
+
+    if (!baudrateDividers(baudrate, div1, div2)) return 0;
+    if (baudrate == previous) return baudrate;
+    if (!sendCmdWithAck(uCamIII_CMD_SET_BAUDRATE, div1, div2)) return 0;   // camera kept the current rate
+
+    restart(baudrate);
+    if (sync(maxTry)) return (_baudrate = baudrate);
+
+    uCamIII_LOG_WARN("no sync at %lu baud, falling back to %lu", baudrate, previous);
+    restart(previous);
+    if (sync(maxTry)) return 0;                                 // camera didn't switch after all
+    hardReset();                                                // back to autodetection
+    sync();
+    return 0;
+  }
+
 private:
   serial& _cameraInterface;
+
+  void restart(uint32_t baudrate) {
+    _cameraInterface.flush();
+    _cameraInterface.end();
+    _cameraInterface.begin(baudrate);
+    _cameraInterface.setTimeout(_timeout);
+    delay(10);
+  }
 };
 
 #endif
@@ -0,0 +1,468 @@
+#include "uCamIII_Converter.h"
+
+#if defined(__SSE2__)
+ #include <emmintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+ #define uCamIII_LITTLE_ENDIAN 1
+#endif
+
+static inline uint32_t load32(const uint8_t *p)                // unaligned access compiles to a plain
+{                                                               // load on Cortex-M3/M4 and x86
+  uint32_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static inline void store32(uint8_t *p, uint32_t w)
+{
+  memcpy(p, &w, sizeof(w));
+}
+
+static inline uint8_t clamp8(int v)
+{
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+bool uCamIII_Converter::begin(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution)
+{
+  _kernel   = NULL;
+  _pos      = 0;
+  _outPx    = 0;
+  _staged   = 0;
+  _windowed = false;
+  _format   = format;
+  _inBpp    = uCamIII_Base::bytesPerPixel(format);
+  if (!_inBpp || !uCamIII_Base::dimensions(format, resolution, _width, _height)) return false;
+
+  // window resolved against this frame's geometry
+  _step      = (_winStep < 1) ? 1 : (_winStep > 16) ? 16 : _winStep;
+  _x         = (_winX < 0) ? 0 : (_winX > _width)  ? _width  : _winX;
+  _y         = (_winY < 0) ? 0 : (_winY > _height) ? _height : _winY;
+  _outWidth  = ((_winWidth  <= 0 || _winWidth  > _width  - _x) ? _width  - _x : _winWidth)  / _step;
+  _outHeight = ((_winHeight <= 0 || _winHeight > _height - _y) ? _height - _y : _winHeight) / _step;
+  if (format == uCamIII_RAW_16BIT_CRYCBY)
+  {                                                             // whole Cr Y Cb Y pairs in and out
+    _x        &= ~1;
+    _outWidth &= ~1;
+  }
+  _windowed  = _step > 1 || _x || _y || _outWidth != _width || _outHeight != _height;
+  _average   = _step > 1 && _sums;
+  if (_average && _sumCount < _outWidth * 3)
+  {
+    uCamIII_LOG_WARN("%d sums for a %d pixel wide window, subsampling instead", _sumCount, _outWidth);
+    _average = false;
+  }
+  if (_average) memset(_sums, 0, _outWidth * 3 * sizeof(*_sums));
+
+  switch (_pixel)
+  {
+    case uCamIII_PIXEL_GRAY8:
+      _outBpp = 1;
+      _kernel = (format == uCamIII_RAW_8BIT)         ? copy
+              : (format == uCamIII_RAW_16BIT_RGB565) ? rgb565ToGray8 
+              :                                        crycbyToGray8;
+      break;
+    case uCamIII_PIXEL_RGB565:
+      _outBpp = 2;
+      _kernel = (format == uCamIII_RAW_8BIT)         ? gray8ToRgb565
+              : (format == uCamIII_RAW_16BIT_RGB565) ? swap16 
+              :                                        crycbyToRgb565;
+      break;
+    case uCamIII_PIXEL_RGB888:
+      _outBpp = 3;
+      _kernel = (format == uCamIII_RAW_8BIT)         ? gray8ToRgb888
+              : (format == uCamIII_RAW_16BIT_RGB565) ? rgb565ToRgb888 
+              :                                        crycbyToRgb888;
+      break;
+    case uCamIII_PIXEL_BGR888:
+      _outBpp = 3;
+      _kernel = (format == uCamIII_RAW_8BIT)         ? gray8ToRgb888     // same for gray
+              : (format == uCamIII_RAW_16BIT_RGB565) ? rgb565ToBgr888 
+              :                                        crycbyToBgr888;
+      break;
+    default:
+      _outBpp = _inBpp;
+      _kernel = (_inBpp == 1) ? copy : copy16;
+      break;
+  }
+  return true;
+}
+
+int uCamIII_Converter::convert(const uint8_t *src, int len, uint8_t *dst)
+{
+  if (!_kernel) return 0;
+  if (_windowed) return window(src, len, dst, NULL);
+  _kernel(dst, src, len / _inBpp);
+  return outputSize(len);
+}
+
+int uCamIII_Converter::place(const uint8_t *src, int len, uint8_t *frame)
+{
+  if (!_kernel) return 0;
+  if (_windowed) return window(src, len, NULL, frame);
+
+  long px  = _pos / _inBpp;
+  int  n   = len / _inBpp;
+  int  out = 0;
+
+  while (n > 0 && px < (long)_width * _height)
+  {
+    int      row = px / _width;
+    int      col = px % _width;
+    int      run = (_width - col < n) ? _width - col : n;       // don't cross row boundaries
+    uint8_t *dst = frame + (long)(_bottomUp ? _height - 1 - row : row) * outputRowBytes() + col * _outBpp;
+
+    _kernel(dst, src, run);
+    src += run * _inBpp;
+    px  += run;
+    n   -= run;
+    out += run * _outBpp;
+  }
+  _pos = px * _inBpp;
+  return out;
+}
+
+// ------------------------------------ window -------------------------------------------
+
+// crop/decimate the next len bytes of the frame, kept pixels go through the kernel either
+// sequentially to dst or into their place within frame - returns the output bytes
+int uCamIII_Converter::window(const uint8_t *src, int len, uint8_t *dst, uint8_t *frame)
+{
+  long px     = _pos / _inBpp;
+  int  n      = len / _inBpp;
+  int  right  = _x + _outWidth  * _step;                        // first column/row past the window
+  int  bottom = _y + _outHeight * _step;
+  int  ch[3];
+
+  _dst      = dst;
+  _frame    = frame;
+  _produced = 0;
+  while (n > 0 && px < (long)_width * _height)
+  {
+    int row = px / _width;
+    int col = px % _width;
+    int run = (_width - col < n) ? _width - col : n;            // don't cross row boundaries
+    int a   = (col > _x) ? col : _x;                            // part of the run within the window
+    int b   = (col + run < right) ? col + run : right;
+    int r   = row - _y;
+
+    if (row >= _y && row < bottom && a < b)
+    {
+      if (_step == 1)                                           // crop only: straight through the kernel
+        emit(src + (a - col) * _inBpp, b - a);
+      else if (!_average)
+      {
+        if (r % _step == 0)
+          for (int c = a + (_step - (a - _x) % _step) % _step; c < b; c += _step)
+          {
+            channels(src, c - col, ch);
+            stage(ch);
+          }
+      }
+      else
+      {
+        uint16_t *sum  = &_sums[(a - _x) / _step * 3];
+        int       k    = (a - _x) % _step;
+        bool      last = (r % _step == _step - 1);              // last row of a block row: blocks complete here
+        int       area = _step * _step;
+
+        for (int c = a; c < b; c++)
+        {
+          channels(src, c - col, ch);
+          sum[0] += ch[0];
+          sum[1] += ch[1];
+          sum[2] += ch[2];
+          if (++k < _step) continue;
+          if (last)                                             // the block's mean as soon as it's complete
+          {
+            for (k = 0; k < 3; k++)
+            {
+              ch[k]  = (sum[k] + area / 2) / area;
+              sum[k] = 0;
+            }
+            stage(ch);
+          }
+          k    = 0;
+          sum += 3;
+        }
+      }
+    }
+    src += run * _inBpp;
+    px  += run;
+    n   -= run;
+  }
+  flush(false);                                                 // nothing held back that isn't needed
+  _pos = px * _inBpp;
+  return _produced;
+}
+
+// channel values of pixel i of src, which starts at an even pixel (so at a CrYCbY pair)
+void uCamIII_Converter::channels(const uint8_t *src, int i, int *ch)
+{
+  switch (_format)
+  {
+    case uCamIII_RAW_16BIT_RGB565:
+    {
+      uint16_t v = src[i * 2] << 8 | src[i * 2 + 1];
+      ch[0] = v >> 11;
+      ch[1] = (v >> 5) & 0x3F;
+      ch[2] = v & 0x1F;
+      break;
+    }
+    case uCamIII_RAW_16BIT_CRYCBY:
+    {
+      const uint8_t *pair = src + (i & ~1) * 2;
+      ch[0] = pair[1 + (i & 1) * 2];
+      ch[1] = pair[0];
+      ch[2] = pair[2];
+      break;
+    }
+    default:
+      ch[0] = src[i];
+      ch[1] = ch[2] = 0;
+      break;
+  }
+}
+
+// append a kept pixel in camera format, a CrYCbY pair's second pixel averages the pair's Cr/Cb
+void uCamIII_Converter::stage(const int *ch)
+{
+  uint8_t *p = &_stage[_staged * _inBpp];
+
+  switch (_format)
+  {
+    case uCamIII_RAW_16BIT_RGB565:
+    {
+      uint16_t v = ch[0] << 11 | ch[1] << 5 | ch[2];
+      p[0] = v >> 8;
+      p[1] = v;
+      break;
+    }
+    case uCamIII_RAW_16BIT_CRYCBY:
+      if (!(_staged & 1))
+      {
+        p[0] = ch[1];
+        p[1] = ch[0];
+        p[2] = ch[2];
+      }
+      else
+      {
+        p[-2] = (p[-2] + ch[1] + 1) >> 1;
+        p[0]  = (p[0]  + ch[2] + 1) >> 1;
+        p[1]  = ch[0];
+      }
+      break;
+    default:
+      p[0] = ch[0];
+      break;
+  }
+  if (++_staged * _inBpp >= (int)sizeof(_stage) || (_outPx + _staged) % _outWidth == 0) flush();
+}
+
+// emit the staged pixels, except for the first half of a CrYCbY pair unless all
+void uCamIII_Converter::flush(bool all)
+{
+  int n = (!all && _format == uCamIII_RAW_16BIT_CRYCBY) ? _staged & ~1 : _staged;
+
+  if (!n) return;
+  emit(_stage, n);
+  _staged -= n;
+  if (_staged) memmove(_stage, &_stage[n * _inBpp], 4);        // the half pair's Cr Y Cb
+}
+
+// convert pixels (within one output row) to the next output position
+void uCamIII_Converter::emit(const uint8_t *src, int pixels)
+{
+  long     row = _outPx / _outWidth;
+  int      col = _outPx % _outWidth;
+  uint8_t *dst = _frame ? _frame + (long)(_bottomUp ? _outHeight - 1 - row : row) * outputRowBytes() + col * _outBpp
+                        : _dst + _produced;
+
+  _kernel(dst, src, pixels);
+  _outPx    += pixels;
+  _produced += pixels * _outBpp;
+}
+
+// ------------------------------------ kernels ------------------------------------------
+
+void uCamIII_Converter::copy(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  if (dst != src) memmove(dst, src, pixels);
+}
+
+void uCamIII_Converter::copy16(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  if (dst != src) memmove(dst, src, pixels * 2);
+}
+
+void uCamIII_Converter::swap16(uint8_t *dst, const uint8_t *src, int pixels)
+{
+#if defined(__SSE2__)
+  for (; pixels >= 8; pixels -= 8, src += 16, dst += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)src);
+    _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+  }
+#endif
+  for (; pixels >= 2; pixels -= 2, src += 4, dst += 4)          // swap bytes of both halfwords (REV16)
+  {
+    uint32_t w = load32(src);
+    store32(dst, ((w & 0x00FF00FF) << 8) | ((w >> 8) & 0x00FF00FF));
+  }
+  if (pixels)
+  {
+    uint8_t hi = src[0];
+    dst[0] = src[1];
+    dst[1] = hi;
+  }
+}
+
+void uCamIII_Converter::crycbyToGray8(uint8_t *dst, const uint8_t *src, int pixels)
+{
+#if defined(__SSE2__)
+  for (; pixels >= 16; pixels -= 16, src += 32, dst += 16)      // Y is the high byte of each 16-bit lane
+  {
+    __m128i y0 = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)src), 8);
+    __m128i y1 = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(src + 16)), 8);
+    _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(y0, y1));
+  }
+#endif
+#if defined(uCamIII_LITTLE_ENDIAN)
+  for (; pixels >= 4; pixels -= 4, src += 8, dst += 4)          // two words Cr Y Cb Y -> one word Y Y Y Y
+  {
+    uint32_t w0 = load32(src);
+    uint32_t w1 = load32(src + 4);
+    store32(dst, ((w0 >> 8) & 0x000000FF) | ((w0 >> 16) & 0x0000FF00)
+               | ((w1 << 8) & 0x00FF0000) |  (w1        & 0xFF000000));
+  }
+#endif
+  for (; pixels > 0; pixels--, src += 2)
+    *dst++ = src[1];
+}
+
+void uCamIII_Converter::rgb565ToGray8(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  for (; pixels > 0; pixels--, src += 2)
+  {
+    uint16_t v = src[0] << 8 | src[1];
+    int      r = ((v >> 8) & 0xF8) | (v >> 13);
+    int      g = ((v >> 3) & 0xFC) | ((v >> 9) & 0x03);
+    int      b = ((v << 3) & 0xF8) | ((v >> 2) & 0x07);
+    *dst++ = (77 * r + 150 * g + 29 * b) >> 8;
+  }
+}
+
+void uCamIII_Converter::rgb565ToRgb888(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  for (; pixels > 0; pixels--, src += 2, dst += 3)
+  {
+    uint16_t v = src[0] << 8 | src[1];
+    dst[0] = ((v >> 8) & 0xF8) | (v >> 13);
+    dst[1] = ((v >> 3) & 0xFC) | ((v >> 9) & 0x03);
+    dst[2] = ((v << 3) & 0xF8) | ((v >> 2) & 0x07);
+  }
+}
+
+void uCamIII_Converter::rgb565ToBgr888(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  for (; pixels > 0; pixels--, src += 2, dst += 3)
+  {
+    uint16_t v = src[0] << 8 | src[1];
+    dst[2] = ((v >> 8) & 0xF8) | (v >> 13);
+    dst[1] = ((v >> 3) & 0xFC) | ((v >> 9) & 0x03);
+    dst[0] = ((v << 3) & 0xF8) | ((v >> 2) & 0x07);
+  }
+}
+
+// full range YCbCr (JFIF) -> RGB with 8 bit fixed point coefficients, 
+// one Cr/Cb pair is shared by two pixels
+static inline void yuvToRgb(int y, int cr, int cb, uint8_t& r, uint8_t& g, uint8_t& b)
+{
+  r = clamp8(y + ((359 * cr) >> 8));
+  g = clamp8(y - ((88 * cb + 183 * cr) >> 8));
+  b = clamp8(y + ((454 * cb) >> 8));
+}
+
+void uCamIII_Converter::crycbyToRgb565(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  for (; pixels >= 2; pixels -= 2, src += 4, dst += 4)
+  {
+    int      cr = src[0] - 128, cb = src[2] - 128;
+    uint8_t  y0 = src[1], y1 = src[3];
+    uint8_t  r, g, b;
+    uint16_t v;
+
+    yuvToRgb(y0, cr, cb, r, g, b);
+    v = (r & 0xF8) << 8 | (g & 0xFC) << 3 | b >> 3;
+    yuvToRgb(y1, cr, cb, r, g, b);
+    dst[0] = v;
+    dst[1] = v >> 8;
+    v = (r & 0xF8) << 8 | (g & 0xFC) << 3 | b >> 3;
+    dst[2] = v;
+    dst[3] = v >> 8;
+  }
+}
+
+void uCamIII_Converter::crycbyToRgb888(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  for (; pixels >= 2; pixels -= 2, src += 4, dst += 6)
+  {
+    int     cr = src[0] - 128, cb = src[2] - 128;
+    uint8_t y0 = src[1], y1 = src[3];
+    yuvToRgb(y0, cr, cb, dst[0], dst[1], dst[2]);
+    yuvToRgb(y1, cr, cb, dst[3], dst[4], dst[5]);
+  }
+}
+
+void uCamIII_Converter::crycbyToBgr888(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  for (; pixels >= 2; pixels -= 2, src += 4, dst += 6)
+  {
+    int     cr = src[0] - 128, cb = src[2] - 128;
+    uint8_t y0 = src[1], y1 = src[3];
+    yuvToRgb(y0, cr, cb, dst[2], dst[1], dst[0]);
+    yuvToRgb(y1, cr, cb, dst[5], dst[4], dst[3]);
+  }
+}
+
+void uCamIII_Converter::gray8ToRgb565(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  for (; pixels > 0; pixels--, dst += 2)
+  {
+    uint8_t  g = *src++;
+    uint16_t v = (g & 0xF8) << 8 | (g & 0xFC) << 3 | g >> 3;
+    dst[0] = v;
+    dst[1] = v >> 8;
+  }
+}
+
+void uCamIII_Converter::gray8ToRgb888(uint8_t *dst, const uint8_t *src, int pixels)
+{
+  for (; pixels > 0; pixels--, dst += 3)
+    dst[0] = dst[1] = dst[2] = *src++;
+}
+
+void uCamIII_Converter::reverseRows(uint8_t *frame, int rowBytes, int rows)
+{
+  uint8_t *top    = frame;
+  uint8_t *bottom = frame + (long)(rows - 1) * rowBytes;
+
+  for (; top < bottom; top += rowBytes, bottom -= rowBytes)
+  {
+    int i = 0;
+    for (; i + 4 <= rowBytes; i += 4)
+    {
+      uint32_t w = load32(top + i);
+      store32(top + i, load32(bottom + i));
+      store32(bottom + i, w);
+    }
+    for (; i < rowBytes; i++)
+    {
+      uint8_t c = top[i];
+      top[i]    = bottom[i];
+      bottom[i] = c;
+    }
+  }
+}
@@ -0,0 +1,137 @@
+/* *************************************************************************************
+
+Pixel conversion for raw uCamIII images
+
+The camera sends RGB565 big-endian, CrYCbY as Cr Y Cb Y byte quadruples per pixel pair
+and all raw formats top row first. `uCamIII_Converter` turns that into what the sink 
+needs while the data is still hot - i.e. on each chunk as it is read from the camera - 
+instead of in a separate pass over a complete frame:
+
+ - endianness (RGB565 big-endian -> little-endian)
+ - colour space (CrYCbY/RGB565/gray8 -> RGB565, RGB888/BGR888 or gray8)
+ - row order (bottom-up as BMP wants it, when writing into a whole frame via `place()`)
+ - region of interest and decimation: `setWindow()` keeps only a rectangle of the image
+   and of that every step-th pixel of every step-th row, or with `setAveraging()` the mean
+   of each step x step block (box filter) - pixels outside are never stored or forwarded
+
+Attach it via `uCamIII_Base::setConverter()` to have `getRawData()`, `streamRawData()`
+and the `poll()` engine apply it, or call `convert()`/`place()` directly.
+The byte swap (RGB565 -> RGB565) and CrYCbY -> gray8 work on 32-bit words (16 bytes with
+SSE2 on host builds), the colour space kernels convert one pixel (pair) at a time.
+
+Chunks have to be a multiple of `unitBytes()` (4 for CrYCbY, 2 for RGB565), which is
+the case for the slices the library produces as long as their size is.
+
+  uint16_t sums[80 * 3];                                   // output width x 3 channels
+  conv.setWindow(160, 120, 320, 240, 4);                   // centre of 640x480, 1/4 -> 80x60
+  conv.setAveraging(sums, 80 * 3);
+
+CrYCbY windows start at an even column and are an even number of pixels wide, a pixel pair's
+Cr/Cb is the mean of the two pixels it's made of.
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_CONVERTER_h_
+#define _UCAMIII_CONVERTER_h_
+
+#include "uCamIII.h"
+
+enum uCamIII_PIXEL
+{ uCamIII_PIXEL_RAW         = 0x00    // as sent by the camera
+, uCamIII_PIXEL_GRAY8       = 0x01
+, uCamIII_PIXEL_RGB565      = 0x02    // little-endian
+, uCamIII_PIXEL_RGB888      = 0x03    // R G B (e.g. PPM)
+, uCamIII_PIXEL_BGR888      = 0x04    // B G R (e.g. BMP)
+};
+
+class uCamIII_Converter {
+public:
+  typedef void    (*kernel)(uint8_t *dst, const uint8_t *src, int pixels);
+
+  uCamIII_Converter(uCamIII_PIXEL pixel = uCamIII_PIXEL_RAW, bool bottomUp = false) 
+  : _pixel(pixel), _bottomUp(bottomUp), _kernel(NULL), _width(0), _height(0), _inBpp(0), _outBpp(0), _pos(0)
+  , _winX(0), _winY(0), _winWidth(0), _winHeight(0), _winStep(1), _sums(NULL), _sumCount(0)
+  , _x(0), _y(0), _step(1), _outWidth(0), _outHeight(0), _windowed(false), _average(false), _outPx(0), _staged(0) { }
+
+  inline void       setOutput(uCamIII_PIXEL pixel, bool bottomUp = false)
+                    { _pixel = pixel; _bottomUp = bottomUp; }
+  // keep only (x, y, width, height) of the camera's image - 0 width/height up to the edge - 
+  // and of that every step-th pixel (1..16), takes effect with the next begin()
+  inline void       setWindow(int x = 0, int y = 0, int width = 0, int height = 0, int step = 1)
+                    { _winX = x; _winY = y; _winWidth = width; _winHeight = height; _winStep = step; }
+  // average step x step blocks instead, using count >= output width x 3 sums (NULL: subsample)
+  inline void       setAveraging(uint16_t *sums, int count)
+                    { _sums = sums; _sumCount = sums ? count : 0; }
+  bool              begin(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution);  // start of a new frame
+
+  // sequential conversion, `dst` may be `src` or lie before it as long as the output
+  // (outputSize(len)) doesn't run into input not yet converted
+  int               convert(const uint8_t *src, int len, uint8_t *dst);
+  // convert into the final position within a frame buffer of outputFrameBytes() (honours bottomUp)
+  int               place(const uint8_t *src, int len, uint8_t *frame);
+
+  inline bool       isActive()         { return _kernel && ((_kernel != copy && _kernel != copy16) || _bottomUp || _windowed); }  // anything to do?
+  inline bool       isBottomUp()       { return _bottomUp; }
+  inline bool       isWindowed()       { return _windowed; }
+  inline int        unitBytes()        { return _inBpp == 2 ? 4 : 1; }
+  // output of inputBytes from the start of a frame: exact for whole frames, at most for chunks
+  inline long       outputSize(long inputBytes) 
+                    { return !_inBpp    ? inputBytes 
+                           : !_windowed ? inputBytes / _inBpp * _outBpp
+                           : inputBytes >= (long)_width * _height * _inBpp ? outputFrameBytes()
+                           : (inputBytes / _inBpp + 1) * _outBpp; }              // + a CrYCbY pixel held back
+  inline int        outputWidth()      { return _outWidth; }
+  inline int        outputHeight()     { return _outHeight; }
+  inline int        outputRowBytes()   { return _outWidth * _outBpp; }
+  inline long       outputFrameBytes() { return (long)_outWidth * _outHeight * _outBpp; }
+  inline int        outputBytesPerPixel() { return _outBpp; }
+
+  // kernels, RGB565 input is big-endian as sent by the camera, RGB565 output little-endian
+  static void       copy(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       copy16(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       swap16(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       rgb565ToGray8(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       rgb565ToRgb888(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       rgb565ToBgr888(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       crycbyToGray8(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       crycbyToRgb565(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       crycbyToRgb888(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       crycbyToBgr888(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       gray8ToRgb565(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       gray8ToRgb888(uint8_t *dst, const uint8_t *src, int pixels);
+  static void       reverseRows(uint8_t *frame, int rowBytes, int rows);
+
+protected:
+  uCamIII_PIXEL     _pixel;
+  bool              _bottomUp;
+  kernel            _kernel;
+  int               _width;
+  int               _height;
+  int               _inBpp;
+  int               _outBpp;
+  long              _pos;                                       // input bytes of the current frame seen by place()/window()
+  uCamIII_IMAGE_FORMAT _format;
+
+  int               _winX, _winY, _winWidth, _winHeight, _winStep;  // as requested
+  uint16_t         *_sums;
+  int               _sumCount;
+  int               _x, _y, _step;                              // window resolved for this frame
+  int               _outWidth;
+  int               _outHeight;
+  bool              _windowed;
+  bool              _average;
+  long              _outPx;                                     // output pixels of the current frame
+  uint8_t           _stage[16];                                 // kept pixels in camera format, waiting for the kernel
+  int               _staged;
+  uint8_t          *_dst;                                       // target of the current window() call:
+  uint8_t          *_frame;                                     //   sequential or placed within a frame
+  int               _produced;
+
+  int               window(const uint8_t *src, int len, uint8_t *dst, uint8_t *frame);
+  void              channels(const uint8_t *src, int i, int *ch);   // gray | R G B fields | Y Cr Cb
+  void              stage(const int *ch);
+  void              flush(bool all = true);
+  void              emit(const uint8_t *src, int pixels);
+};
+
+#endif
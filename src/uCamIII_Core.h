@@ -0,0 +1,442 @@
+/* *************************************************************************************
+
+Header-only protocol core for uCamIII
+
+uCamIII<serial> only wraps init() and setBaudrate() around uCamIII_Base, which talks to
+the camera through a Stream& - every reply and image byte goes through the virtual
+read()/available() and Stream::readBytes() with its timeout check per byte.
+`uCamIII_Core<serial>` is the blocking command set of uCamIII_Base as a template on the
+concrete serial type, all of it in this header:
+
+ - bytes are taken with qualified calls (`serial::read()`, `serial::available()`) which
+   bind statically, so they inline wherever the port's functions are visible (e.g. a
+   software serial's ring buffer); only an empty RX buffer falls back to the Stream's
+   timed read to wait for the next byte
+ - frames with fixed contents (SYNC, the ACKs ending a transfer, setImageFormat<>() and
+   setPackageSize<>() with template arguments) are constexpr arrays in flash, the command
+   of all others is a template argument - the reply to expect and the frame layout are
+   resolved at compile time
+ - the JPEG verify code is summed while the package is read instead of in a second pass
+ - there is no engine, statistics, trace ring, session cache, converter or JPEG parser,
+   and as a template only what is called ends up in flash - use uCamIII<serial> for those
+
+  uCamIII_Core<USARTSerial> ucam(Serial1, D6);
+  ucam.init(115200);
+  ucam.setImageFormat<uCamIII_COMP_JPEG, uCamIII_640x480>();
+  ucam.setPackageSize<512>();
+  if (ucam.takeSnapshot() && (size = ucam.getPicture(uCamIII_TYPE_SNAPSHOT)))
+    while (ucam.getJpegData(package, sizeof(package), sink) > 0);
+
+Functions return what their uCamIII_Base counterparts return (0 on failure, see
+getLastError() for the camera's NAK). `serial` has to be the port's own class: a qualified
+call of Stream's pure virtual read() wouldn't link.
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_CORE_h_
+#define _UCAMIII_CORE_h_
+
+#include "uCamIII.h"
+
+// a command frame with fixed contents
+template <uint8_t cmd, uint8_t p1 = 0x00, uint8_t p2 = 0x00, uint8_t p3 = 0x00, uint8_t p4 = 0x00>
+struct uCamIII_CommandFrame
+{
+  static constexpr uint8_t bytes[6] = { uCamIII_STARTBYTE, cmd, p1, p2, p3, p4 };
+};
+template <uint8_t cmd, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t p4>
+constexpr uint8_t uCamIII_CommandFrame<cmd, p1, p2, p3, p4>::bytes[6];
+
+template <class serial>
+class uCamIII_Core {
+public:
+  uCamIII_Core(serial& camera, int resetPin = -1, uint32_t timeout = 500)
+  : _port(camera), _resetPin(resetPin), _timeout(timeout), _baudrate(0), _imageSize(0), _packageSize(64), _packageNumber(0)
+  , _lastError(0), _pkgRetryLimit(3), _format(uCamIII_COMP_JPEG), _resolution(uCamIII_640x480)
+  , _snapMs(0), _snapTimeout(2000), _snapProbeMs(5), _snapPending(false), _sinkTimeout(5000) { }
+  uCamIII_Core(serial *camera, int resetPin = -1, uint32_t timeout = 500)
+  : _port(*camera), _resetPin(resetPin), _timeout(timeout), _baudrate(0), _imageSize(0), _packageSize(64), _packageNumber(0)
+  , _lastError(0), _pkgRetryLimit(3), _format(uCamIII_COMP_JPEG), _resolution(uCamIII_640x480)
+  , _snapMs(0), _snapTimeout(2000), _snapProbeMs(5), _snapPending(false), _sinkTimeout(5000) { }
+
+  long init(int baudrate = 9600) {
+    uCamIII_LOG_TRACE("uCAMIII_Core: %s", __FUNCTION__);
+    _port.end();
+    delay(100);
+    _port.begin(baudrate);
+    _port.setTimeout(_timeout);
+    delay(100);
+    _baudrate = baudrate;
+    hardReset();
+    return sync();
+  }
+
+  // the reply to a SYNC may only arrive during the next try, so the ACK is looked for
+  // anywhere in the byte stream; the wait per try starts at 5ms and grows by 1ms (datasheet)
+  long sync(int maxTry = 60) {
+    uCamIII_LOG_TRACE(__FUNCTION__);
+    uint32_t wait = 5;
+
+    for (int tries = 1; tries <= maxTry; tries++, wait += (wait < _timeout))
+    {
+      send<SyncFrame>();
+      if (!scanFrame(uCamIII_CMD_ACK, uCamIII_CMD_SYNC, wait)) continue;
+      if (!scanFrame(uCamIII_CMD_SYNC, 0x00, _timeout)) break;
+      send<SyncAckFrame>();
+      if (tries > 1) drainInput(wait);                          // replies to earlier tries may still be on their way
+      return tries;
+    }
+    uCamIII_LOG_WARN("no sync");
+    return 0;
+  }
+
+  void hardReset() {
+    uCamIII_LOG_TRACE(__FUNCTION__);
+    if (_resetPin <= 0) return;
+    pinMode(_resetPin, OUTPUT);
+    digitalWrite(_resetPin, LOW);
+    delay(10);
+    pinMode(_resetPin, INPUT);
+    delay(10);
+  }
+
+  // as uCamIII<serial>::setBaudrate(): the new rate, or 0 with the link back at the previous one
+  long setBaudrate(uint32_t baudrate, int maxTry = 10) {
+    uCamIII_LOG_TRACE("uCAMIII_Core: %s(%lu)", __FUNCTION__, baudrate);
+    uint8_t  div1, div2;
+    uint32_t previous = _baudrate;
+
+    if (!uCamIII_Base::baudrateDividers(baudrate, div1, div2)) return 0;
+    if (baudrate == previous) return baudrate;
+    if (!sendCmdWithAck<uCamIII_CMD_SET_BAUDRATE>(div1, div2)) return 0;
+
+    restart(baudrate);
+    if (sync(maxTry)) return (_baudrate = baudrate);
+
+    uCamIII_LOG_WARN("no sync at %lu baud, falling back to %lu", baudrate, previous);
+    restart(previous);
+    if (sync(maxTry)) return 0;
+    hardReset();
+    sync();
+    return 0;
+  }
+
+  long setImageFormat(uCamIII_IMAGE_FORMAT format = uCamIII_COMP_JPEG, uCamIII_RES resolution = uCamIII_640x480) {
+    if (!sendCmdWithAck<uCamIII_CMD_INIT>(0x00, format, resolution, resolution)) return 0;
+    _format     = format;
+    _resolution = resolution;
+    return 1;
+  }
+  template <uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution>
+  long setImageFormat() {
+    if (!sendWithAck< uCamIII_CommandFrame<uCamIII_CMD_INIT, 0x00, format, resolution, resolution> >()) return 0;
+    _format     = format;
+    _resolution = resolution;
+    return 1;
+  }
+
+  long setPackageSize(uint16_t size = 64) {
+    if (!sendCmdWithAck<uCamIII_CMD_SET_PACKSIZE>(0x08, size & 0xFF, size >> 8)) return 0;
+    return (_packageSize = size);
+  }
+  template <uint16_t size>
+  long setPackageSize() {
+    static_assert(size >= 64 && size <= 512, "uCamIII package size is 64..512 bytes");
+    if (!sendWithAck< uCamIII_CommandFrame<uCamIII_CMD_SET_PACKSIZE, 0x08, (size & 0xFF), (size >> 8)> >()) return 0;
+    return (_packageSize = size);
+  }
+
+  long setCBE(uCamIII_CBE contrast = uCamIII_DEFAULT, uCamIII_CBE brightness = uCamIII_DEFAULT, uCamIII_CBE exposure = uCamIII_DEFAULT)
+                    { return sendCmdWithAck<uCamIII_CMD_SET_CBE>(contrast, brightness, exposure); }
+  long setFrequency(uCamIII_FREQ frequency = uCamIII_50Hz)
+                    { return sendCmdWithAck<uCamIII_CMD_SET_FREQ>(frequency); }
+  long setIdleTime(uint8_t seconds = 15)
+                    { return sendCmdWithAck<uCamIII_CMD_SLEEP>(seconds); }
+  long reset(uCamIII_RESET_TYPE type = uCamIII_RESET_FULL, bool force = true)
+                    { return sendCmdWithAck<uCamIII_CMD_RESET>(type, 0x00, 0x00, force ? uCamIII_RESET_FORCE : 0x00); }
+
+  long takeSnapshot(uCamIII_SNAP_TYPE type = uCamIII_SNAP_JPEG, uint16_t frame = 0) {
+    if (!sendCmdWithAck<uCamIII_CMD_SNAPSHOT>(type, frame & 0xFF, frame >> 8)) return 0;
+    _snapMs      = millis();
+    _snapPending = true;
+    return 1;
+  }
+
+  // for a snapshot taken just before, the camera is probed every `probeMs` while it NAKs
+  // with uCamIII_ERROR_PIC_NOT_RDY, up to the snapshot timeout
+  long getPicture(uCamIII_PIC_TYPE type = uCamIII_TYPE_JPEG) {
+    uCamIII_LOG_TRACE(__FUNCTION__);
+    bool probe = (type == uCamIII_TYPE_SNAPSHOT && _snapPending);
+
+    _snapPending = false;
+    while (!sendCmdWithAck<uCamIII_CMD_GET_PICTURE>(type))
+    {
+      if (!probe || _lastError != uCamIII_ERROR_PIC_NOT_RDY || millis() - _snapMs >= _snapTimeout) return 0;
+      delay(_snapProbeMs);
+    }
+    _packageNumber = 0;
+    return (_imageSize = expect<uCamIII_CMD_DATA>(type) & 0x00FFFFFF);
+  }
+
+  long getJpegData(uint8_t *buffer, int len, const uCamIII_Sink& sink = uCamIII_Sink(), int package = -1) {
+    uint16_t id   = 0xF0F0;
+    uint16_t size = 0;
+
+    if (package >= 0) _packageNumber = package;             // request specific package
+    for (int attempt = 0; ; attempt++)
+    {
+      if (!sendCmd<uCamIII_CMD_ACK>(0x00, 0x00, _packageNumber & 0xFF, _packageNumber >> 8)) break;
+
+      int r = readPackage(buffer, len, id, size);
+      if (r > 0) break;                                     // package complete and verified
+      if (!r) flushInput();                                 // the expected data didn't arrive in time
+      id = 0xF0F0;                                          // prepare for termination of request
+      if (attempt >= _pkgRetryLimit) break;
+      uCamIII_LOG_INFO("retry package %u (%s)", _packageNumber + 1, r < 0 ? "checksum" : "short read");
+    }
+
+    if (id < 0xF0F0 && !deliver(sink, buffer, size, id))
+      id = 0xF0F0;                                          // sink gave up -> don't fetch the rest
+    if (id == 0xF0F0 || (long)id * (_packageSize - 6) >= _imageSize)
+      send<JpegEndFrame>();                                 // report end of final data request to camera
+    else
+      _packageNumber = id;                                  // prepare to request next package
+    return (id < 0xF0F0) ? size : 0;
+  }
+
+  long getRawData(uint8_t *buffer, int len, const uCamIII_Sink& sink = uCamIII_Sink()) {
+    long received = 0;
+
+    if (len >= _imageSize) received = readBytes(buffer, _imageSize);
+    if (len >= _imageSize && received == _imageSize)
+    {                                                       // success -> report end of data request to camera
+      send<DataEndFrame>();
+      return deliver(sink, buffer, received, 0) ? received : 0;
+    }
+    flushInput();                                           // incomplete or no room - the camera sends it anyway
+    return 0;
+  }
+
+  // raw image data in slices of sliceSize (default len) bytes via buffer - the camera doesn't
+  // wait, so the sink has to keep up with the wire
+  long streamRawData(uint8_t *buffer, int len, const uCamIII_Sink& sink, int sliceSize = 0) {
+    long received = 0;
+    int  id       = 0;
+
+    if (!sink.isSet() || len <= 0) return 0;
+    if (sliceSize <= 0 || sliceSize > len) sliceSize = len;
+    while (received < _imageSize)
+    {
+      int n = (_imageSize - received < sliceSize) ? _imageSize - received : sliceSize;
+      if (readBytes(buffer, n) != n)
+      {                                                     // if the expected data didn't arrive in time
+        flushInput();
+        return 0;
+      }
+      received += n;
+      if (!deliver(sink, buffer, n, id++))
+      {                                                     // the camera can't be stopped, let it finish
+        drainInput(20);
+        send<DataEndFrame>();
+        return 0;
+      }
+    }
+    send<DataEndFrame>();
+    return received;
+  }
+
+  // give up the image getPicture() announced (see uCamIII_Base::skipImage())
+  void skipImage() {
+    if (_format == uCamIII_COMP_JPEG)
+      send<JpegEndFrame>();
+    else
+    {
+      drainInput(20);
+      send<DataEndFrame>();
+    }
+  }
+
+  inline uint16_t   getPackageSize()    { return _packageSize; }
+  inline uint8_t    getLastError()      { return _lastError; }
+  inline uint32_t   getBaudrate()       { return _baudrate; }
+  inline long       getImageSize()      { return _imageSize; }
+  inline uCamIII_IMAGE_FORMAT getImageFormat() { return _format; }
+  inline uCamIII_RES getResolution()    { return _resolution; }
+  inline int        getRowBytes()
+                    { int w, h; return uCamIII_Base::dimensions(_format, _resolution, w, h) ? w * uCamIII_Base::bytesPerPixel(_format) : 0; }
+  inline void       setPackageRetries(uint8_t retries = 3)      { _pkgRetryLimit = retries; }
+  inline void       setSnapshotTimeout(uint16_t timeout = 2000, uint8_t probeMs = 5)
+                    { _snapTimeout = timeout; _snapProbeMs = probeMs ? probeMs : 1; }
+  inline void       setSinkTimeout(uint16_t timeout = 5000)     { _sinkTimeout = timeout; }
+
+protected:
+  typedef uCamIII_CommandFrame<uCamIII_CMD_SYNC>                                    SyncFrame;
+  typedef uCamIII_CommandFrame<uCamIII_CMD_ACK, uCamIII_CMD_SYNC>                   SyncAckFrame;
+  typedef uCamIII_CommandFrame<uCamIII_CMD_ACK, uCamIII_CMD_DATA, 0x00, 0x01, 0x00> DataEndFrame;
+  typedef uCamIII_CommandFrame<uCamIII_CMD_ACK, 0x00, 0x00, 0xF0, 0xF0>             JpegEndFrame;
+
+  serial&           _port;
+  int               _resetPin;
+  unsigned long     _timeout;
+  uint32_t          _baudrate;
+  long              _imageSize;
+  short             _packageSize;
+  unsigned short    _packageNumber;
+  uint8_t           _lastError;
+  uint8_t           _pkgRetryLimit;
+  uCamIII_IMAGE_FORMAT _format;
+  uCamIII_RES       _resolution;
+  uint32_t          _snapMs;                                    // millis() of the last takeSnapshot()
+  uint16_t          _snapTimeout;
+  uint8_t           _snapProbeMs;
+  bool              _snapPending;
+  uint16_t          _sinkTimeout;
+
+  template <class frame>
+  inline long send() {
+    uCamIII_LOG_TRACE("sendCmd: %02X %02X %02X %02X %02X %02X", frame::bytes[0], frame::bytes[1], frame::bytes[2], frame::bytes[3], frame::bytes[4], frame::bytes[5]);
+    return _port.serial::write(frame::bytes, 6);
+  }
+  template <uint8_t cmd>
+  inline long sendCmd(uint8_t p1 = 0x00, uint8_t p2 = 0x00, uint8_t p3 = 0x00, uint8_t p4 = 0x00) {
+    uint8_t buf[6] = { uCamIII_STARTBYTE, cmd, p1, p2, p3, p4 };
+    uCamIII_LOG_TRACE("sendCmd: %02X %02X %02X %02X %02X %02X", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+    return _port.serial::write(buf, 6);
+  }
+  template <class frame>
+  inline long sendWithAck()     { send<frame>(); return expect<uCamIII_CMD_ACK>(frame::bytes[1]); }
+  template <uint8_t cmd>
+  inline long sendCmdWithAck(uint8_t p1 = 0x00, uint8_t p2 = 0x00, uint8_t p3 = 0x00, uint8_t p4 = 0x00)
+                                { sendCmd<cmd>(p1, p2, p3, p4); return expect<uCamIII_CMD_ACK>(cmd); }
+
+  // reply `AA pkg option p1 p2 p3`: p1..p3 | 0x1000000 if it is the one expected, 0 otherwise
+  template <uint8_t pkg>
+  long expect(uint8_t option) {
+    uint8_t buf[6];
+
+    _lastError = 0;
+    if (readBytes(buf, sizeof(buf)) != sizeof(buf))
+    {
+      uCamIII_LOG_WARN("timeout waiting for %02X %02X (%lu)", pkg, option, _timeout);
+      return 0;
+    }
+    uCamIII_LOG_TRACE("received: %02X %02X %02X %02X %02X %02X", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+    if (buf[1] == pkg && (buf[2] == option || option == uCamIII_DONT_CARE))
+      return buf[3] | buf[4] << 8 | buf[5] << 16 | 0x1000000;
+    if (buf[1] == uCamIII_CMD_NAK) _lastError = buf[4];
+    return 0;
+  }
+
+  // n bytes into buffer, adding them to sum: what's in the RX buffer is taken by direct
+  // calls, only an empty one waits (up to the timeout) via the Stream's timed read
+  int readBytes(uint8_t *buffer, int n, uint8_t& sum) {
+    uint8_t *p   = buffer;
+    uint8_t *end = buffer + n;
+    uint8_t  s   = sum;
+
+    while (p < end)
+    {
+      int avail = _port.serial::available();
+      if (avail <= 0)
+      {
+        if (_port.readBytes((char*)p, 1) != 1) break;
+        s += *p++;
+        continue;
+      }
+      if (avail > end - p) avail = end - p;
+      for (uint8_t *stop = p + avail; p < stop; p++)
+        s += (*p = _port.serial::read());
+    }
+    sum = s;
+    return p - buffer;
+  }
+  inline int readBytes(uint8_t *buffer, int n)  { uint8_t sum = 0; return readBytes(buffer, n, sum); }
+
+  // read one JPEG package: 1 verified, -1 checksum mismatch, 0 short read or bad header
+  int readPackage(uint8_t *buffer, int len, uint16_t& id, uint16_t& size) {
+    uint8_t info[4];
+    uint8_t chk[2];
+    uint8_t sum = 0;                                            // low byte of the sum over id, size and data
+
+    if (readBytes(info, sizeof(info), sum) != sizeof(info)) return 0;
+    id   = info[0] | info[1] << 8;
+    size = info[2] | info[3] << 8;
+    if (!size || size > len || readBytes(buffer, size, sum) != size || readBytes(chk, sizeof(chk)) != sizeof(chk)) return 0;
+    return (chk[0] == sum && chk[1] == 0x00) ? 1 : -1;
+  }
+
+  // next byte, waiting up to `ms` for it - -1 if none came
+  int nextByte(uint32_t ms) {
+    char c;
+    bool got;
+
+    if (_port.serial::available() > 0) return _port.serial::read();
+    _port.setTimeout(ms);
+    got = (_port.readBytes(&c, 1) == 1);
+    _port.setTimeout(_timeout);
+    return got ? (uint8_t)c : -1;
+  }
+
+  // read until a frame `AA cmd option ...` has been seen or `ms` have passed, at any byte offset
+  bool scanFrame(uint8_t cmd, uint8_t option, uint32_t ms) {
+    uint8_t  win[6];
+    int      n     = 0;
+    uint32_t start = millis();
+    uint32_t elapsed;
+    int      c;
+
+    while ((elapsed = millis() - start) < ms && (c = nextByte(ms - elapsed)) >= 0)
+    {
+      if (n == sizeof(win))
+      {
+        memmove(win, win + 1, sizeof(win) - 1);
+        n--;
+      }
+      win[n++] = c;
+      if (n == sizeof(win) && win[0] == uCamIII_STARTBYTE && win[1] == cmd && win[2] == option) return true;
+    }
+    return false;
+  }
+
+  // discard input until nothing has arrived for `quietMs`
+  void drainInput(uint32_t quietMs) {
+    while (nextByte(quietMs) >= 0);
+  }
+
+  void flushInput() {
+    uint32_t ms;
+    delay(100);                                                 // allow for extra bytes to trickle in and then
+    ms = millis();                                              // flush the RX buffer
+    while (_port.serial::read() >= 0 && millis() - ms < _timeout);
+  }
+
+  // hand `len` bytes to the sink, waiting (up to the sink timeout without progress) while it's busy
+  bool deliver(const uCamIII_Sink& sink, uint8_t *buffer, int len, int id) {
+    uint32_t last = millis();
+    int      n;
+
+    if (!sink.isSet()) return true;
+    while (len > 0)
+    {
+      if ((n = sink.write(buffer, len, id)) < 0) return false;
+      if (n > len) n = len;
+      buffer += n;
+      len    -= n;
+      if (!len) break;
+      if (n) last = millis();
+      if (millis() - last >= _sinkTimeout) return false;
+      delay(1);
+    }
+    return true;
+  }
+
+  void restart(uint32_t baudrate) {
+    _port.flush();
+    _port.end();
+    _port.begin(baudrate);
+    _port.setTimeout(_timeout);
+    delay(10);
+  }
+};
+
+#endif
@@ -0,0 +1,213 @@
+#include "uCamIII_Encoder.h"
+#include "uCamIII_Converter.h"
+
+struct uCamIII_BmpFileHeader
+{
+  uint16_t   bfType;            // file type BM (0x424d)                        [  0]
+  uint32_t   bfSize;            // file size all together                       [  2]
+  uint16_t   bfReserved1;       //                                              [  6]
+  uint16_t   bfReserved2;       //                                              [  8]
+  uint32_t   bfOffBits;         // offset of actual image data                  [ 10]
+} __attribute__((__packed__));  //                                              ( 14)
+
+// https://msdn.microsoft.com/en-us/library/windows/desktop/dd183381(v=vs.85).aspx
+// (only up to the V3 fields, which is what the browsers need for bitfields)
+struct uCamIII_BmpV5Header
+{
+  // --------------------------------------------------------------------------
+  // legacy BITMAPINFOHEADER:
+  uint32_t Size;              // Size of this header in bytes               [  0][ 14]
+  int32_t  Width;             // Image width in pixels                      [  4][ 18]
+  int32_t  Height;            // Image height in pixels                     [  8][ 22]
+  uint16_t Planes;            // Number of color planes                     [ 12][ 26]
+  uint16_t BitsPerPixel;      // Number of bits per pixel                   [ 14][ 28]
+  uint32_t Compression;       // Compression methods used                   [ 16][ 30]
+  uint32_t SizeOfBitmap;      // Size of bitmap in bytes                    [ 20][ 34]
+  int32_t  HorzResolution;    // Horizontal resolution in pixels per meter  [ 24][ 38]
+  int32_t  VertResolution;    // Vertical resolution in pixels per meter    [ 28][ 42]
+  uint32_t ColorsUsed;        // Number of colors in the image              [ 32][ 46]
+  uint32_t ColorsImportant;   // Minimum number of important colors         [ 36][ 50]
+  // --------------------------------------------------------------------   ( 40)( 54)
+  // Fields added for V2:
+  uint32_t RedMask;           // Mask identifying bits of red component     [ 40][ 54]
+  uint32_t GreenMask;         // Mask identifying bits of green component   [ 44][ 58]
+  uint32_t BlueMask;          // Mask identifying bits of blue component    [ 48][ 62]
+  // --------------------------------------------------------------------   ( 52)( 66)
+  // Fields added for V3:
+  uint32_t AlphaMask;         // Mask identifying bits of alpha component   [ 52][ 66]
+} __attribute__((__packed__));  //                                          ( 56)( 70)
+
+bool uCamIII_Encoder::begin(int width, int height, int bits, bool bottomUp)
+{
+  _width      = width;
+  _height     = height;
+  _bits       = bits;
+  _bottomUp   = bottomUp;
+  _col        =
+  _row        =
+  _padLeft    =
+  _id         = 0;
+  _headerSize =
+  _headerSent = 0;
+
+  switch (_container)
+  {
+    case uCamIII_CONTAINER_BMP:
+      if (bits != 8 && bits != 16 && bits != 24) break;
+      _headerSize = sizeof(uCamIII_BmpFileHeader) + sizeof(uCamIII_BmpV5Header) + ((bits <= 8) ? (1 << (bits+2)) : 0);
+      break;
+    case uCamIII_CONTAINER_PGM:
+    case uCamIII_CONTAINER_PPM:
+      if (bits != ((_container == uCamIII_CONTAINER_PGM) ? 8 : 24)) break;
+      _headerSize = headerChunk(NULL, 0, 0);
+      break;
+  }
+
+  if (!_headerSize) _width = _height = _bits = 0;
+  return _headerSize > 0;
+}
+
+bool uCamIII_Encoder::begin(uCamIII_Converter& converter)
+{
+  int bpp = converter.outputBytesPerPixel();
+  if (!bpp || !converter.outputRowBytes()) return false;
+  return begin(converter.outputRowBytes() / bpp, converter.outputFrameBytes() / converter.outputRowBytes(),
+               bpp * 8, converter.isBottomUp());
+}
+
+int uCamIII_Encoder::header(uint8_t *buf, int len)
+{
+  if (!_headerSize || len < _headerSize) return 0;
+  _headerSent = _headerSize;                                    // the caller sends it, write() doesn't
+  return headerChunk(buf, _headerSize, 0);
+}
+
+long uCamIII_Encoder::writeHeader(const uCamIII_Sink& sink)
+{
+  if (!_headerSize || !sink.isSet()) return uCamIII_SINK_ABORT;
+  return (flushPending(sink) < 0) ? uCamIII_SINK_ABORT : _headerSent;
+}
+
+int uCamIII_Encoder::write(uint8_t *data, int len, const uCamIII_Sink& sink)
+{
+  int padding = getRowPadding();
+  int taken   = 0;
+  int n, r;
+
+  if (!_headerSize || !sink.isSet()) return uCamIII_SINK_ABORT;
+  if ((r = flushPending(sink)) <= 0) return r;                  // header and last row's padding first
+
+  while (len > 0 && _row < _height)
+  {
+    n = (padding && rowBytes() - _col < len) ? rowBytes() - _col : len;   // without padding the slice as is
+    if ((r = sink.write(data, n, _id++)) < 0) return uCamIII_SINK_ABORT;
+    if (r > n) r = n;
+    data  += r;
+    len   -= r;
+    taken += r;
+    _row  += (_col + r) / rowBytes();
+    _col   = (_col + r) % rowBytes();
+    if (r < n) break;                                           // backed up, the caller offers the rest again
+    if (padding && !_col)
+    {
+      _padLeft = padding;
+      if ((r = flushPending(sink)) < 0) return uCamIII_SINK_ABORT;
+      if (!r) break;
+    }
+  }
+  return taken;
+}
+
+int uCamIII_Encoder::bmpHeader(uint8_t *buf, int len, int width, int height, int bits, bool bottomUp)
+{
+  uCamIII_Encoder bmp(uCamIII_CONTAINER_BMP);
+  if (!bmp.begin(width, height, bits, bottomUp)) return 0;
+  return bmp.header(buf, len);
+}
+
+// --- protected ---
+
+// offer what the sink didn't take of the header and the last row's padding: 1 when all of
+// it is out, 0 while the sink is backed up, uCamIII_SINK_ABORT once it gave up
+int uCamIII_Encoder::flushPending(const uCamIII_Sink& sink)
+{
+  static uint8_t zeros[4] = { 0, 0, 0, 0 };
+  uint8_t        piece[64];
+  int            n, r;
+
+  while (_headerSent < _headerSize)
+  {
+    n = headerChunk(piece, sizeof(piece), _headerSent);
+    if ((r = sink.write(piece, n, _id++)) < 0) return uCamIII_SINK_ABORT;
+    if (!r) return 0;
+    _headerSent += (r > n) ? n : r;
+  }
+  while (_padLeft)
+  {
+    if ((r = sink.write(zeros + 4 - _padLeft, _padLeft, _id++)) < 0) return uCamIII_SINK_ABORT;
+    if (!r) return 0;
+    _padLeft -= (r > _padLeft) ? _padLeft : r;
+  }
+  return 1;
+}
+
+// bytes [offset, offset+len) of the header, with buf == NULL only the header size
+int uCamIII_Encoder::headerChunk(uint8_t *buf, int len, long offset)
+{
+  if (_container != uCamIII_CONTAINER_BMP)
+  {
+    char pnm[24];
+    int  size = snprintf(pnm, sizeof(pnm), "P%c\n%d %d\n255\n",
+                         (_container == uCamIII_CONTAINER_PGM) ? '5' : '6', _width, _height);
+    if (!buf) return size;
+    if (len > size - offset) len = size - offset;
+    memcpy(buf, pnm + offset, len);
+    return len;
+  }
+
+  const int fixed = sizeof(uCamIII_BmpFileHeader) + sizeof(uCamIII_BmpV5Header);
+  int       n     = 0;
+
+  if (len > _headerSize - offset) len = _headerSize - offset;
+
+  if (offset < fixed)
+  {
+    uint8_t                hdr[fixed];
+    uCamIII_BmpFileHeader *bmpFileHeader = (uCamIII_BmpFileHeader*)hdr;
+    uCamIII_BmpV5Header   *bmpInfoHeader = (uCamIII_BmpV5Header*)(hdr + sizeof(uCamIII_BmpFileHeader));
+    uint32_t               pixelDataSize = (uint32_t)_height * (rowBytes() + getRowPadding());
+
+    memset(hdr, 0, sizeof(hdr));
+    bmpFileHeader->bfType            = 0x4D42;                                 // magic number "BM"
+    bmpFileHeader->bfSize            = _headerSize + pixelDataSize;
+    bmpFileHeader->bfOffBits         = _headerSize;
+
+    bmpInfoHeader->Size              = sizeof(uCamIII_BmpV5Header);
+    bmpInfoHeader->Width             = _width;
+    bmpInfoHeader->Height            = _bottomUp ? _height : -_height;         // negative height: top row first
+    bmpInfoHeader->Planes            = 1;
+    bmpInfoHeader->BitsPerPixel      = _bits;
+    bmpInfoHeader->Compression       = (_bits == 16) ? 0x03 : 0x00;            // BI_BITFIELDS (3), BI_RGB (0)
+    bmpInfoHeader->SizeOfBitmap      = pixelDataSize;
+    bmpInfoHeader->HorzResolution    = 0x1000;
+    bmpInfoHeader->VertResolution    = 0x1000;
+    bmpInfoHeader->ColorsUsed        =
+    bmpInfoHeader->ColorsImportant   = (_bits <= 8) ? (1 << _bits) : 0;        // <= 8bit use color palette
+    if (_bits == 16)
+    {
+      bmpInfoHeader->RedMask         = 0x0000f800;
+      bmpInfoHeader->GreenMask       = 0x000007e0;
+      bmpInfoHeader->BlueMask        = 0x0000001f;
+    }
+
+    n = (fixed - offset < len) ? fixed - offset : len;
+    memcpy(buf, hdr + offset, n);
+  }
+
+  for (int colors = 1 << _bits; n < len; n++)                   // grayscale color table B G R 0
+  {
+    int p = offset + n - fixed;
+    buf[n] = ((p & 3) == 3) ? 0 : 255 * (p >> 2) / (colors - 1);
+  }
+  return n;
+}
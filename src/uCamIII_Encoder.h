@@ -0,0 +1,81 @@
+/* *************************************************************************************
+
+Streaming image container encoder for raw uCamIII images
+
+`uCamIII_Encoder` produces BMP, PGM (gray8) or PPM (RGB888) files without ever holding
+the whole file: the header (and BMP palette) is emitted first, then the pixel data is
+passed through slice by slice as it comes from the camera, with the row padding BMP
+requires inserted where rows end.
+
+  uCamIII_Encoder bmp(uCamIII_CONTAINER_BMP);
+  bmp.begin(160, 120, 8);                              // gray8 -> 8bit palette BMP
+  bmp.writeHeader(sink);
+  ... bmp.write(slice, len, sink);                     // from the streamRawData() sink
+
+Both follow the sink protocol: write() returns the pixel bytes the sink took (the rest
+has to be offered again), 0 while the sink is backed up and `uCamIII_SINK_ABORT` once it
+gave up. What the sink doesn't take of the header or a row's padding is kept and goes
+out first on the next call, so writeHeader() can be repeated until it returns
+getHeaderSize() or left to the first write() (unless header() put it into a buffer).
+
+The encoder doesn't convert pixels, so the data has to be in the form the container
+expects (see `uCamIII_Converter`): little-endian RGB565 or BGR888 for BMP, gray8 for
+PGM and RGB888 for PPM. BMP rows are written as they come, so the header declares the
+image top-down unless `bottomUp` is set (some browsers ignore top-down BMPs).
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_ENCODER_h_
+#define _UCAMIII_ENCODER_h_
+
+#include "uCamIII.h"
+
+enum uCamIII_CONTAINER
+{ uCamIII_CONTAINER_BMP     = 0x00    // 8bit (gray palette), 16bit (RGB565 bitfields), 24bit (BGR)
+, uCamIII_CONTAINER_PGM     = 0x01    // binary P5, 8bit gray
+, uCamIII_CONTAINER_PPM     = 0x02    // binary P6, 24bit RGB
+};
+
+class uCamIII_Converter;
+
+class uCamIII_Encoder {
+public:
+  uCamIII_Encoder(uCamIII_CONTAINER container = uCamIII_CONTAINER_BMP)
+  : _container(container), _width(0), _height(0), _bits(0), _bottomUp(false), _headerSize(0), _headerSent(0)
+  , _col(0), _row(0), _padLeft(0), _id(0) { }
+
+  inline void       setContainer(uCamIII_CONTAINER container) { _container = container; }
+  bool              begin(int width, int height, int bits, bool bottomUp = false);  // false if the container can't take `bits`
+  bool              begin(uCamIII_Converter& converter);        // geometry/depth of the converter's output (after its begin())
+
+  int               header(uint8_t *buf, int len);              // header (+ palette) into buf, 0 if it doesn't fit
+  long              writeHeader(const uCamIII_Sink& sink);      // the same in small pieces: header bytes out so far
+  int               write(uint8_t *data, int len, const uCamIII_Sink& sink);  // pixel data, adds row padding
+
+  inline int        getHeaderSize()    { return _headerSize; }
+  inline int        getRowPadding()    { return _container == uCamIII_CONTAINER_BMP ? (4 - rowBytes() % 4) % 4 : 0; }
+  inline long       getFileSize()      { return _headerSize + (long)_height * (rowBytes() + getRowPadding()); }
+  inline bool       isComplete()       { return _height && _row >= _height && !_padLeft; }
+
+  // the example sketches' former helper: header + palette for a BMP, returns the pixel data offset
+  static int        bmpHeader(uint8_t *buf, int len, int width, int height, int bits, bool bottomUp = false);
+
+protected:
+  inline int        rowBytes()         { return _width * (_bits / 8); }
+  int               headerChunk(uint8_t *buf, int len, long offset);
+  int               flushPending(const uCamIII_Sink& sink);     // header/padding the sink didn't take yet
+
+  uCamIII_CONTAINER _container;
+  int               _width;
+  int               _height;
+  int               _bits;
+  bool              _bottomUp;
+  int               _headerSize;
+  int               _headerSent;
+  int               _col;                                       // bytes of the current row written
+  int               _row;
+  int               _padLeft;                                   // padding of the last row not taken yet
+  int               _id;                                        // id passed to the sink
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "uCamIII_FramePool.h"
+
+uCamIII_FramePool::uCamIII_FramePool(uint8_t *storage, long slotSize, int slots, const uCamIII_Sink& output)
+: _storage(storage), _slotSize(storage ? slotSize : 0), _slots(slots), _output(output), _seq(0), _overflows(0), _noSlot(0)
+{
+  if (!storage || _slots < 0) _slots = 0;
+  if (_slots > uCamIII_POOL_SLOTS) _slots = uCamIII_POOL_SLOTS;
+  reset();
+}
+
+void uCamIII_FramePool::reset()
+{
+  for (int i = 0; i < _slots; i++)
+  {
+    memset(&_frame[i], 0, sizeof(_frame[i]));
+    _frame[i].data = _storage + i * _slotSize;
+  }
+  _filling = NULL;
+}
+
+uCamIII_Frame* uCamIII_FramePool::begin(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, long size, int packageSize)
+{
+  uCamIII_Frame *slot = NULL;
+
+  end(false);                                                   // a frame still being assembled is given up
+  if (size > _slotSize)
+  {
+    uCamIII_LOG_WARN("image of %ld bytes doesn't fit a %ld byte slot", size, _slotSize);
+    _overflows++;
+    return NULL;
+  }
+  for (int i = 0; i < _slots; i++)                              // a free slot, else the oldest frame nobody holds
+  {
+    uCamIII_Frame *f = &_frame[i];
+    if (f->state == uCamIII_SLOT_FREE)
+    {
+      slot = f;
+      break;
+    }
+    if (!f->leases && (!slot || (int32_t)(f->seq - slot->seq) < 0)) slot = f;
+  }
+  if (!slot)
+  {
+    _noSlot++;
+    return NULL;
+  }
+
+  slot->len        = 0;
+  slot->size       = size;
+  slot->format     = format;
+  slot->resolution = resolution;
+  slot->seq        = _seq++;
+  slot->ms         = millis();
+  slot->leases     = 0;
+  slot->state      = uCamIII_SLOT_FILLING;
+  _filling  = slot;
+  _cursor   = 0;
+  _cursorId = -1;
+  _payload  = (packageSize > 6) ? packageSize - 6 : 0;
+  return slot;
+}
+
+uCamIII_Frame* uCamIII_FramePool::begin(uCamIII_Base& camera)
+{
+  long           size = camera.getOutputSize();
+  uCamIII_Frame *slot;
+
+  if (size <= 0) return NULL;
+  slot = begin(camera.getImageFormat(), camera.getResolution(), size,
+               camera.getImageFormat() == uCamIII_COMP_JPEG ? camera.getPackageSize() : 0);
+  if (slot) slot->ms = camera.getCaptureMs();                   // when it was taken, not when it arrived
+  return slot;
+}
+
+int uCamIII_FramePool::write(uint8_t *data, int len, int id)
+{
+  uint8_t *dst;
+  int      n;
+
+  if (!_filling) return uCamIII_SINK_ABORT;
+  if (_payload && id != _cursorId)                              // a new package: straight to its place
+  {
+    _cursor   = (long)(id - 1) * _payload;
+    _cursorId = id;
+  }
+  if (_cursor < 0 || len > _slotSize - _cursor)
+  {
+    uCamIII_LOG_WARN("frame %lu overflows its slot at %ld + %d bytes", (unsigned long)_filling->seq, _cursor, len);
+    _overflows++;
+    end(false);
+    return uCamIII_SINK_ABORT;
+  }
+
+  dst = _filling->data + _cursor;
+  if (data != dst) memmove(dst, data, len);                     // read in place already -> nothing to copy
+  n = _output.isSet() ? _output.write(dst, len, id) : len;      // the rest is offered again if the output took less
+  if (n < 0) return uCamIII_SINK_ABORT;
+  if (n > len) n = len;
+  _cursor += n;
+  if (_cursor > _filling->len) _filling->len = _cursor;
+  return n;
+}
+
+uCamIII_Frame* uCamIII_FramePool::end(bool ok)
+{
+  uCamIII_Frame *frame = _filling;
+
+  if (!frame) return NULL;
+  _filling = NULL;
+  if (!ok || frame->len != frame->size)
+  {
+    frame->state = uCamIII_SLOT_FREE;
+    return NULL;
+  }
+  frame->state = uCamIII_SLOT_READY;
+  return frame;
+}
+
+uCamIII_Frame* uCamIII_FramePool::end(uCamIII_Base& camera)
+{
+  long size = camera.getOutputSize();
+
+  if (_filling && size > 0 && size < _filling->size)            // e.g. a JPEG parser found EOI before the announced size
+    _filling->size = size;
+  return end();
+}
+
+uCamIII_Frame* uCamIII_FramePool::lease(int age)
+{
+  uCamIII_Frame *pick = NULL;
+
+  for (int k = 0; k <= age; k++)                                // newest, then the newest older than that, ...
+  {
+    uCamIII_Frame *newer = pick;
+
+    pick = NULL;
+    for (int i = 0; i < _slots; i++)
+    {
+      uCamIII_Frame *f = &_frame[i];
+      if (f->state == uCamIII_SLOT_READY
+      && (!newer || (int32_t)(f->seq - newer->seq) < 0)
+      && (!pick  || (int32_t)(f->seq - pick->seq)  > 0))
+        pick = f;
+    }
+    if (!pick) return NULL;
+  }
+  pick->leases++;
+  return pick;
+}
+
+void uCamIII_FramePool::release(uCamIII_Frame *frame)
+{
+  if (frame && frame->leases) frame->leases--;
+}
+
+int uCamIII_FramePool::available()
+{
+  int n = 0;
+
+  for (int i = 0; i < _slots; i++)
+    if (_frame[i].state == uCamIII_SLOT_READY) n++;
+  return n;
+}
+
+int uCamIII_FramePool::input(void *context, uint8_t *buffer, int len, int id)
+{
+  return ((uCamIII_FramePool*)context)->write(buffer, len, id);
+}
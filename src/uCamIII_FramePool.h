@@ -0,0 +1,114 @@
+/* *************************************************************************************
+
+Frame buffer pool for uCamIII
+
+Reading JPEG packages into one sliding buffer either overwrites the buffer's tail once an
+image outgrows it or keeps nothing of the image once it's sent. `uCamIII_FramePool` holds
+a few fixed-size frame slots (storage supplied by the user or owned by a
+`uCamIII_FramePoolBuffer<slots, size>`) and assembles each image in place: JPEG packages
+land at (package id - 1) * (package size - 6), raw slices are appended. An image that
+doesn't fit its slot is refused up front by begin() (or aborts the transfer when the
+camera sends more than announced) instead of being truncated silently.
+
+  uCamIII_FramePoolBuffer<2, 20000> pool;              // two slots of 20000 bytes, no heap
+  ucam.getPicture(uCamIII_TYPE_JPEG);
+  if (pool.begin(ucam))                                // slot for the announced size
+    while (pool.isFilling() && ucam.getJpegData(pool.next(), pool.room(), pool.sink()));
+  uCamIII_Frame *frame = pool.end(ucam);               // NULL unless the image is complete
+
+The blocking calls read straight into the slot via next()/room(), the non-blocking engine
+passes its package buffer and the pool copies each package to its offset. Whatever the pool
+takes is passed on to an optional output sink (e.g. a uCamIII_Pipeline) so a frame can be
+sent while it's being assembled and still be there afterwards.
+
+Finished frames are handed out as leases: lease() marks a frame as in use (e.g. until an
+upload is acknowledged, or for a preview), release() gives it back. begin() reuses a free
+slot or the oldest finished frame nobody holds a lease on and fails when every slot is
+leased, so held frames are never overwritten.
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_FRAMEPOOL_h_
+#define _UCAMIII_FRAMEPOOL_h_
+
+#include "uCamIII.h"
+
+// most slots a pool can manage (the bookkeeping is a fixed array, no heap)
+#ifndef uCamIII_POOL_SLOTS
+ #define uCamIII_POOL_SLOTS 4
+#endif
+
+enum uCamIII_SLOT_STATE
+{ uCamIII_SLOT_FREE         = 0
+, uCamIII_SLOT_FILLING                // an image is being assembled
+, uCamIII_SLOT_READY                  // complete image
+};
+
+struct uCamIII_Frame
+{
+  uint8_t             *data;
+  long                 len;                                     // bytes assembled (contiguous from the start)
+  long                 size;                                    // announced image size
+  uCamIII_IMAGE_FORMAT format;
+  uCamIII_RES          resolution;
+  uint32_t             seq;                                     // per pool, starting at 0
+  uint32_t             ms;                                      // millis() the image was taken (at begin() if not from a camera)
+  uint8_t              leases;                                  // holders that haven't released it yet
+  uint8_t              state;                                   // uCamIII_SLOT_STATE
+};
+
+class uCamIII_FramePool {
+public:
+  uCamIII_FramePool(uint8_t *storage, long slotSize, int slots, const uCamIII_Sink& output = uCamIII_Sink());
+
+  inline void       setOutput(const uCamIII_Sink& output) { _output = output; }
+  inline uCamIII_Sink sink()            { return uCamIII_Sink(input, this); }   // camera side
+
+  uCamIII_Frame*    begin(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, long size,
+                          int packageSize = 0);                 // 0: appended as it comes, otherwise placed by package id
+  uCamIII_Frame*    begin(uCamIII_Base& camera);                // image announced by getPicture()/beginCapture()
+  int               write(uint8_t *data, int len, int id);      // as uCamIII_sinkFunc, uCamIII_SINK_ABORT on overflow
+  uCamIII_Frame*    end(bool ok = true);                        // the finished frame, NULL (and the slot freed) if incomplete
+  uCamIII_Frame*    end(uCamIII_Base& camera);                  // as long as the camera says (a JPEG may end at EOI early)
+  void              reset();                                    // drop all frames, leases included
+
+  inline uint8_t*   next()              { return _filling ? _filling->data + _filling->len : NULL; }  // in place target
+  inline long       room()              { return _filling ? _slotSize - _filling->len : 0; }
+  inline bool       isFilling()         { return _filling && _filling->len < _filling->size; } // wants more data
+
+  uCamIII_Frame*    lease(int age = 0);                         // age-th newest finished frame, NULL if none
+  void              release(uCamIII_Frame *frame);
+  int               available();                                // finished frames
+  inline long       getSlotSize()       { return _slotSize; }
+  inline uint32_t   getOverflows()      { return _overflows; }  // images refused or aborted for not fitting
+  inline uint32_t   getNoSlot()         { return _noSlot; }     // begin() with every slot leased
+
+protected:
+  uint8_t          *_storage;
+  long              _slotSize;
+  int               _slots;
+  uCamIII_Sink      _output;
+  uCamIII_Frame     _frame[uCamIII_POOL_SLOTS];
+  uCamIII_Frame    *_filling;
+  long              _cursor;                                    // where the rest of package _cursorId goes
+  int               _cursorId;
+  int               _payload;                                   // package payload, 0 for appending
+  uint32_t          _seq;
+  uint32_t          _overflows;
+  uint32_t          _noSlot;
+
+  static int        input(void *context, uint8_t *buffer, int len, int id);
+};
+
+// pool that owns its storage, e.g. as a global: uCamIII_FramePoolBuffer<2, 20000> pool;
+template <int SLOTS, long SIZE>
+class uCamIII_FramePoolBuffer : public uCamIII_FramePool {
+public:
+  uCamIII_FramePoolBuffer(const uCamIII_Sink& output = uCamIII_Sink())
+  : uCamIII_FramePool(_buffer[0], SIZE, SLOTS, output) { static_assert(SLOTS <= uCamIII_POOL_SLOTS, "raise uCamIII_POOL_SLOTS"); }
+
+protected:
+  uint8_t           _buffer[SLOTS][SIZE];
+};
+
+#endif
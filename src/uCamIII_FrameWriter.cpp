@@ -0,0 +1,152 @@
+#include "uCamIII_FrameWriter.h"
+#include "uCamIII_Converter.h"
+
+bool uCamIII_FrameWriter::begin(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, uint32_t size,
+                                uint32_t ms, uint8_t flags)
+{
+  if (_failed || flushPending() <= 0) return false;
+
+  _pending[0] = 'u';
+  _pending[1] = 'C';
+  _pending[2] = '3';
+  _pending[3] = 'F';
+  _pending[4] = uCamIII_FRAME_VERSION;
+  _pending[5] = format;
+  _pending[6] = resolution;
+  _pending[7] = flags;
+  put32(&_pending[8],  _seq++);
+  put32(&_pending[12], ms);
+  put32(&_pending[16], size);
+  put32(&_pending[20], crc32(_pending, 20));
+  _pendingOff = 0;
+  _pendingLen = uCamIII_FRAME_HEADER;
+  _remaining  = size;
+  _crc        = 0;
+  _open       = true;
+  flushPending();
+  return true;
+}
+
+bool uCamIII_FrameWriter::begin(uCamIII_Base& camera)
+{
+  long               size = camera.getOutputSize();
+  uCamIII_Converter *conv = camera.getConverter();
+
+  return size > 0
+      && begin(camera.getImageFormat(), camera.getResolution(), size, camera.getCaptureMs(),
+               conv && conv->isActive() ? uCamIII_FRAME_CONVERTED : 0);
+}
+
+int uCamIII_FrameWriter::write(uint8_t *data, int len)
+{
+  int n;
+
+  if (_failed) return uCamIII_SINK_ABORT;
+  if (!_open)
+  {
+    if (!_camera) return uCamIII_SINK_ABORT;                    // begin() wasn't called
+    if ((n = flushPending()) <= 0) return n;                    // last frame's trailer first
+    if (!begin(*_camera)) return uCamIII_SINK_ABORT;            // header from the attached camera
+  }
+  if ((n = flushPending()) <= 0) return n;                      // header first
+  if ((uint32_t)len > _remaining) return uCamIII_SINK_ABORT;    // more than announced
+
+  if ((n = _output.write(data, len, _id++)) < 0)
+  {
+    _failed = true;
+    return uCamIII_SINK_ABORT;
+  }
+  if (n > len) n = len;
+  _crc        = crc32(data, n, _crc);
+  _remaining -= n;
+  if (!_remaining)
+  {
+    put32(_pending, _crc);
+    _pendingOff = 0;
+    _pendingLen = uCamIII_FRAME_TRAILER;
+    _open       = false;
+    _frames++;
+    flushPending();
+  }
+  return n;
+}
+
+bool uCamIII_FrameWriter::flush(uint32_t timeout)
+{
+  uint32_t ms = millis();
+  int      r;
+
+  while ((r = flushPending()) == 0)
+  {
+    if (millis() - ms >= timeout) return false;
+    delay(1);
+  }
+  return r > 0;
+}
+
+bool uCamIII_FrameWriter::end(uint32_t timeout)
+{
+  uint32_t ms = millis();
+  uint8_t  zeros[32];
+  int      n;
+
+  while (_open)
+  {
+    memset(zeros, 0, sizeof(zeros));                            // the output may have used them as scratch
+    if ((n = write(zeros, _remaining < sizeof(zeros) ? _remaining : sizeof(zeros))) < 0) return false;
+    if (n) continue;
+    if (millis() - ms >= timeout) return false;
+    delay(1);
+  }
+  return flush(timeout);
+}
+
+// IEEE CRC-32 with a 16 entry table - 64 bytes of flash, two lookups per byte
+uint32_t uCamIII_FrameWriter::crc32(const uint8_t *data, int len, uint32_t crc)
+{
+  static const uint32_t table[16] =
+  { 0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C
+  , 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  crc = ~crc;
+  while (len--)
+  {
+    crc ^= *data++;
+    crc  = (crc >> 4) ^ table[crc & 0x0F];
+    crc  = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+// ----------------------------------- protected ----------------------------------------
+
+// 1 when nothing is pending (anymore), 0 while the output is backed up, uCamIII_SINK_ABORT
+int uCamIII_FrameWriter::flushPending()
+{
+  while (_pendingOff < _pendingLen)
+  {
+    int n = _output.write(&_pending[_pendingOff], _pendingLen - _pendingOff, _id++);
+    if (n < 0)
+    {
+      _failed = true;
+      return uCamIII_SINK_ABORT;
+    }
+    if (!n) return 0;
+    _pendingOff += (n < _pendingLen - _pendingOff) ? n : _pendingLen - _pendingOff;
+  }
+  return 1;
+}
+
+int uCamIII_FrameWriter::input(void *context, uint8_t *buffer, int len, int id)
+{
+  return ((uCamIII_FrameWriter*)context)->write(buffer, len);
+}
+
+void uCamIII_FrameWriter::put32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
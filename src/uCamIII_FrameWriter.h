@@ -0,0 +1,97 @@
+/* *************************************************************************************
+
+Framed multi-image upload for uCamIII
+
+Instead of one TCP connection per image (the end of the connection marking the end of
+the file), `uCamIII_FrameWriter` puts a small header in front of each image and a CRC
+behind it, so any number of images can follow each other on one connection and the
+receiver (see server/imageReceiver.js) knows what it got and whether it arrived intact.
+
+Frame layout, all fields little-endian:
+
+  offset  size
+     0      4   magic "uC3F"
+     4      1   version (uCamIII_FRAME_VERSION)
+     5      1   uCamIII_IMAGE_FORMAT
+     6      1   uCamIII_RES
+     7      1   flags (uCamIII_FRAME_FLAGS)
+     8      4   sequence number (per writer, starting at 0)
+    12      4   timestamp (millis() when the image was taken)
+    16      4   payload length
+    20      4   CRC-32 of bytes 0..19
+    24      n   payload (JPEG file or raw pixels)
+  24+n      4   CRC-32 of the payload
+
+The payload CRC trails the data because the header goes out before the camera has sent
+the image. CRC-32 is the common IEEE/zlib one (reflected 0xEDB88320).
+
+  uCamIII_FrameWriter frames(pipe.sink());             // or uCamIII_Sink(toTcp, &client)
+  frames.attach(ucam);                                 // header from the camera's format/size
+  ucam.beginCapture(uCamIII_COMP_JPEG, uCamIII_640x480, pkg, 506, frames.sink());
+
+With a camera attached the header is written when the first payload byte arrives (the
+image size is known by then), otherwise begin() has to be called for each image.
+A JPEG that ends at its EOI before the size the camera announced (see setJpegParser())
+leaves the frame open, end() fills it up with zeros - which decoders ignore after EOI.
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_FRAMEWRITER_h_
+#define _UCAMIII_FRAMEWRITER_h_
+
+#include "uCamIII.h"
+
+#define uCamIII_FRAME_VERSION       1
+#define uCamIII_FRAME_HEADER        24
+#define uCamIII_FRAME_TRAILER       4
+
+enum uCamIII_FRAME_FLAGS
+{ uCamIII_FRAME_CONVERTED   = 0x01    // raw pixels have been through a uCamIII_Converter
+, uCamIII_FRAME_BMP         = 0x02    // raw pixels with a BMP header (uCamIII_Encoder::bmpHeader())
+};
+
+class uCamIII_FrameWriter {
+public:
+  uCamIII_FrameWriter(const uCamIII_Sink& output = uCamIII_Sink())
+  : _output(output), _camera(NULL), _seq(0), _frames(0), _id(0), _pendingOff(0), _pendingLen(0), _open(false), _failed(false) { }
+
+  inline void       setOutput(const uCamIII_Sink& output) { _output = output; }
+  inline void       attach(uCamIII_Base& camera)          { _camera = &camera; }
+  inline void       setSequence(uint32_t seq)             { _seq = seq; }        // of the next frame
+  inline uCamIII_Sink sink()            { return uCamIII_Sink(input, this); }   // camera side
+
+  bool              begin(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, uint32_t size,
+                          uint32_t ms, uint8_t flags = 0);     // false while the last trailer is still pending
+  bool              begin(uCamIII_Base& camera);                // format, resolution and size of its current image
+  int               write(uint8_t *data, int len);              // payload, as uCamIII_sinkFunc
+  bool              flush(uint32_t timeout = 5000);             // push out a pending header/trailer
+  bool              end(uint32_t timeout = 5000);               // close a frame short of its length with zeros, then flush()
+  inline void       reset()             { _open = _failed = false; _pendingOff = _pendingLen = 0; }
+
+  inline bool       isOpen()            { return _open; }       // a frame's payload is being written
+  inline bool       isFailed()          { return _failed; }
+  inline uint32_t   getSequence()       { return _seq; }        // of the next frame
+  inline uint32_t   getFrameCount()     { return _frames; }     // frames completed
+
+  static uint32_t   crc32(const uint8_t *data, int len, uint32_t crc = 0);  // zlib style, chainable
+
+protected:
+  uCamIII_Sink      _output;
+  uCamIII_Base     *_camera;
+  uint32_t          _seq;
+  uint32_t          _frames;
+  uint32_t          _remaining;                                 // payload bytes still to come
+  uint32_t          _crc;
+  uint16_t          _id;                                        // id passed to the output
+  uint8_t           _pending[uCamIII_FRAME_HEADER];             // header/trailer not yet taken by the output
+  uint8_t           _pendingOff;
+  uint8_t           _pendingLen;
+  bool              _open;
+  bool              _failed;
+
+  int               flushPending();
+  static int        input(void *context, uint8_t *buffer, int len, int id);
+  static void       put32(uint8_t *p, uint32_t v);
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "uCamIII_JpegParser.h"
+
+void uCamIII_JpegParser::reset()
+{
+  _state      = SOI0;
+  _error      = uCamIII_JPEG_OK;
+  _code       = 0;
+  _left       = 0;
+  _segLen     = 0;
+  _length     = 0;
+  _width      = 0;
+  _height     = 0;
+  _components = 0;
+  _scans      = 0;
+  memset(_sof, 0, sizeof(_sof));
+}
+
+int uCamIII_JpegParser::parse(const uint8_t *data, int len)
+{
+  int i = 0;
+
+  if (_state == BROKEN) return -1;
+  while (i < len && _state != DONE)
+  {
+    uint8_t c = data[i];
+
+    switch (_state)
+    {
+      case SOI0:
+      case SOI1:
+        if (c != (_state == SOI0 ? 0xFF : 0xD8)) return fail(uCamIII_JPEG_NO_SOI);
+        _state = (_state == SOI0) ? SOI1 : MARKER;
+        i++;
+        break;
+
+      case MARKER:
+        if (c != 0xFF) return fail(uCamIII_JPEG_BAD_MARKER);
+        _state = CODE;
+        i++;
+        break;
+
+      case CODE:
+        i++;
+        if (c == 0xFF) break;                                   // fill byte
+        if (!marker(c)) return -1;
+        break;
+
+      case LEN0:
+        _segLen = c << 8;
+        _state  = LEN1;
+        i++;
+        break;
+
+      case LEN1:
+        _segLen |= c;
+        i++;
+        if (_segLen < 2) return fail(uCamIII_JPEG_BAD_LENGTH);
+        _left  = _segLen - 2;
+        _state = BODY;
+        if (!_left && !segment()) return -1;
+        break;
+
+      case BODY:
+      {
+        int n   = (len - i < _left) ? len - i : _left;
+        int got = _segLen - 2 - _left;                          // body bytes before these
+        if (isSof(_code))                                       // keep what's needed of the frame header
+          for (int k = 0; k < n && got + k < (int)sizeof(_sof); k++) _sof[got + k] = data[i + k];
+        i     += n;
+        _left -= n;
+        if (!_left && !segment()) return -1;
+        break;
+      }
+
+      case SCAN:
+      {
+        const uint8_t *ff = (const uint8_t*)memchr(data + i, 0xFF, len - i);
+        if (!ff)
+        {
+          i = len;
+          break;
+        }
+        i      = ff - data + 1;
+        _state = SCAN_FF;
+        break;
+      }
+
+      case SCAN_FF:
+        i++;
+        if (c == 0xFF) break;                                   // fill byte
+        if (c == 0x00 || (c >= 0xD0 && c <= 0xD7))             // stuffed 0xFF or restart marker
+        {
+          _state = SCAN;
+          break;
+        }
+        if (!marker(c)) return -1;                              // end of the scan
+        break;
+    }
+  }
+  _length += i;
+  return i;
+}
+
+bool uCamIII_JpegParser::finish()
+{
+  if (_state == DONE) return true;
+  if (_state != BROKEN) fail(uCamIII_JPEG_TRUNCATED);
+  return false;
+}
+
+// ----------------------------------- protected ----------------------------------------
+
+int uCamIII_JpegParser::fail(uint8_t error)
+{
+  uCamIII_LOG_WARN("broken JPEG (%d) after byte %ld", error, _length);
+  _state = BROKEN;
+  _error = error;
+  return -1;
+}
+
+// marker code after FF (outside a segment body), false if it can't be there
+bool uCamIII_JpegParser::marker(uint8_t code)
+{
+  _code = code;
+  if (code == 0xD9)                                             // EOI
+  {
+    if (!_scans) 
+    {
+      fail(uCamIII_JPEG_NO_FRAME);
+      return false;
+    }
+    _state = DONE;
+    return true;
+  }
+  if (code == 0x00 || code == 0xD8)                             // stuffing outside a scan, second SOI
+  {
+    fail(uCamIII_JPEG_BAD_MARKER);
+    return false;
+  }
+  if (code == 0x01 || (code >= 0xD0 && code <= 0xD7))           // TEM/RST: no length
+  {
+    _state = MARKER;
+    return true;
+  }
+  if (code == 0xDA && !_width)
+  {
+    fail(uCamIII_JPEG_NO_FRAME);
+    return false;
+  }
+  _state = LEN0;
+  return true;
+}
+
+// a segment's body has been read
+bool uCamIII_JpegParser::segment()
+{
+  if (isSof(_code))
+  {
+    _components = _sof[5];
+    _height     = _sof[1] << 8 | _sof[2];
+    _width      = _sof[3] << 8 | _sof[4];
+    if (_segLen < 8 || _segLen != 8 + 3 * _components) 
+    {
+      fail(uCamIII_JPEG_BAD_LENGTH);
+      return false;
+    }
+    if (!_width || !_components)
+    {
+      fail(uCamIII_JPEG_BAD_FRAME);
+      return false;
+    }
+  }
+  if (_code == 0xDA)                                            // SOS: entropy coded data follows
+  {
+    _scans++;
+    _state = SCAN;
+    return true;
+  }
+  _state = MARKER;
+  return true;
+}
+
+// SOF0..SOF15 without DHT (C4), JPG (C8) and DAC (CC)
+bool uCamIII_JpegParser::isSof(uint8_t code)
+{
+  return code >= 0xC0 && code <= 0xCF && code != 0xC4 && code != 0xC8 && code != 0xCC;
+}
@@ -0,0 +1,87 @@
+/* *************************************************************************************
+
+Incremental JPEG marker parser for uCamIII
+
+The camera announces a JPEG's size up front and the transfer ends after that many bytes,
+whatever they contain. `uCamIII_JpegParser` walks the marker structure of the package
+payloads as they arrive (a few comparisons per segment, memchr() through the entropy coded
+data) so that
+
+ - the transfer ends with the EOI marker - bytes the camera pads the image with after it
+   are neither requested nor passed on
+ - a structurally broken image (no SOI, garbage where a marker has to be, impossible
+   segment lengths, a scan without a frame header, no EOI by the announced end) is
+   flagged with the package it shows in, so it can be captured again before it's uploaded
+ - width, height and components are known from the SOF header early in the transfer
+
+Attached via `uCamIII_Base::setJpegParser()` it is reset for each image and applied by
+`getJpegData()` and the `poll()` engine; the camera's getLastError() is then
+uCamIII_ERROR_JPEG_BROKEN for an image given up by the parser. It can as well be fed
+directly:
+
+  uCamIII_JpegParser jpeg;
+  ucam.setJpegParser(&jpeg);
+  ...
+  if (jpeg.isDone()) Log.info("%dx%d, %ld bytes", jpeg.getWidth(), jpeg.getHeight(), jpeg.getLength());
+
+Fill bytes (0xFF) before a marker and byte stuffing/restart markers within entropy coded
+data are skipped, progressive images (several scans) are followed from scan to scan.
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_JPEGPARSER_h_
+#define _UCAMIII_JPEGPARSER_h_
+
+#include "uCamIII.h"
+
+enum uCamIII_JPEG_ERROR
+{ uCamIII_JPEG_OK           = 0x00
+, uCamIII_JPEG_NO_SOI                 // doesn't start with FF D8
+, uCamIII_JPEG_BAD_MARKER             // no marker where one has to be, or one that can't be there
+, uCamIII_JPEG_BAD_LENGTH             // segment length below 2 or not matching its content
+, uCamIII_JPEG_BAD_FRAME              // SOF with 0 width or components
+, uCamIII_JPEG_NO_FRAME               // scan (or EOI) before any SOF
+, uCamIII_JPEG_TRUNCATED              // ended without EOI
+};
+
+class uCamIII_JpegParser {
+public:
+  uCamIII_JpegParser() { reset(); }
+
+  void              reset();                                    // a new image follows
+  // bytes of data that belong to the image (all of them until EOI, up to and including it
+  // then, 0 after it), -1 once it's broken
+  int               parse(const uint8_t *data, int len);
+  bool              finish();                                   // end of data: true if the image is complete
+
+  inline bool       isDone()            { return _state == DONE; }
+  inline bool       isBroken()          { return _state == BROKEN; }
+  inline uint8_t    getError()          { return _error; }      // uCamIII_JPEG_ERROR
+  inline long       getLength()         { return _length; }     // bytes so far, the whole image once done
+  inline int        getWidth()          { return _width; }      // 0 until SOF
+  inline int        getHeight()         { return _height; }
+  inline int        getComponents()     { return _components; }
+  inline int        getScans()          { return _scans; }
+
+protected:
+  enum { SOI0, SOI1, MARKER, CODE, LEN0, LEN1, BODY, SCAN, SCAN_FF, DONE, BROKEN };
+
+  uint8_t           _state;
+  uint8_t           _error;
+  uint8_t           _code;                                      // marker of the segment being read
+  uint16_t          _left;                                      // segment body bytes still to come
+  uint16_t          _segLen;
+  uint8_t           _sof[6];                                    // precision, height, width, components
+  long              _length;
+  int               _width;
+  int               _height;
+  int               _components;
+  int               _scans;
+
+  int               fail(uint8_t error);
+  bool              marker(uint8_t code);                       // false if it's broken
+  bool              segment();                                  // body complete
+  static bool       isSof(uint8_t code);
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "uCamIII_Motion.h"
+
+#if defined(__SSE2__)
+ #include <emmintrin.h>
+#endif
+
+static inline uint32_t load32(const uint8_t *p)
+{
+  uint32_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+uCamIII_Motion::uCamIII_Motion(uint8_t *background, uCamIII_RES resolution, int blockSize)
+: _background(background), _resolution(resolution), _width(0), _height(0)
+, _block(blockSize < 2 ? 2 : (blockSize > 16 ? 16 : blockSize)), _cols(0)
+, _level(12), _minBlocks(1), _learn(1), _primed(false), _filling(false), _motion(false), _pos(0), _changed(0)
+, _boxLeft(0), _boxTop(0), _boxRight(-1), _boxBottom(-1), _probes(0), _triggers(0), _failures(0)
+{
+  if (background) uCamIII_Base::dimensions(uCamIII_RAW_8BIT, resolution, _width, _height);
+  while ((_width + _block - 1) / _block > uCamIII_MOTION_COLS) _block++;       // accumulators for one block row
+  _cols = (_width + _block - 1) / _block;
+}
+
+bool uCamIII_Motion::check(uCamIII_Base& camera)
+{
+  uCamIII_LOG_TRACE(__FUNCTION__);
+
+  uCamIII_Converter *converter = camera.getConverter();
+  uint8_t            row[80];
+  bool               snapped, ok;
+
+  camera.setConverter(NULL);                                    // gray8 as the camera sends it
+  snapped = camera.ensureSync()
+         && camera.setImageFormat(uCamIII_RAW_8BIT, _resolution)
+         && camera.takeSnapshot(uCamIII_SNAP_RAW)
+         && camera.getPicture(uCamIII_TYPE_SNAPSHOT);
+  ok      = snapped && begin(camera);
+  if (ok)
+    ok = camera.streamRawData(row, sizeof(row), sink()) == (long)_width * _height;
+  else if (snapped)
+    camera.skipImage();                                         // not a probe - its bytes mustn't meet the next command
+  camera.setConverter(converter);
+  if (!snapped)
+  {
+    _failures++;
+    return _motion = false;
+  }
+  return end(ok);
+}
+
+bool uCamIII_Motion::begin()
+{
+  if (!_width) return false;
+  _filling  = true;
+  _motion   = false;
+  _pos      = 0;
+  _changed  = 0;
+  _boxLeft  = _cols;
+  _boxTop   = _height;
+  _boxRight = _boxBottom = -1;
+  memset(_acc, 0, sizeof(_acc));
+  _probes++;
+  return true;
+}
+
+bool uCamIII_Motion::begin(uCamIII_Base& camera)
+{
+  if (camera.getImageFormat() != uCamIII_RAW_8BIT || camera.getResolution() != _resolution
+  ||  camera.getOutputSize() != (long)_width * _height)
+  {
+    uCamIII_LOG_WARN("image of %ld bytes isn't a probe of %dx%d gray8", camera.getOutputSize(), _width, _height);
+    _failures++;
+    return false;
+  }
+  return begin();
+}
+
+int uCamIII_Motion::write(uint8_t *data, int len, int id)
+{
+  long total = (long)_width * _height;
+  int  left  = len;
+
+  if (!_filling) return uCamIII_SINK_ABORT;
+  if (len > total - _pos)
+  {
+    end(false);
+    return uCamIII_SINK_ABORT;
+  }
+
+  while (left > 0)                                              // row by row, a slice may end anywhere
+  {
+    int      x   = _pos % _width;
+    int      y   = _pos / _width;
+    int      run = (left < _width - x) ? left : _width - x;
+    uint8_t *bg  = _background + _pos;
+
+    if (_primed)
+    {
+      int rows = _height - y / _block * _block;
+
+      if (rows > _block) rows = _block;
+      for (int from = x, to; from < x + run; from = to)         // SAD per block the run touches
+      {
+        int col   = from / _block;
+        int cols  = _width - col * _block;
+
+        to = (col + 1) * _block;
+        if (to > x + run) to = x + run;
+        if (cols > _block) cols = _block;
+        _acc[col] += sad(data + from - x, bg + from - x, to - from);
+        if (_acc[col] > (uint32_t)_level * rows * cols)         // changed already: take the rest over as it is
+          memcpy(bg + from - x, data + from - x, to - from);    // so it triggers once, not until it's blended in
+        else
+          blend(bg + from - x, data + from - x, to - from, _learn);
+      }
+    }
+    else
+      memcpy(bg, data, run);                                    // first frame is the background
+
+    data += run;
+    left -= run;
+    _pos += run;
+    if (x + run == _width && (y % _block == _block - 1 || y == _height - 1))
+      blockRow(y / _block);
+  }
+  return len;
+}
+
+// a block row is complete: mark the blocks whose SAD exceeds the level for their pixel count
+void uCamIII_Motion::blockRow(int row)
+{
+  int rows = _height - row * _block;
+
+  if (rows > _block) rows = _block;
+  for (int col = 0; col < _cols; col++)
+  {
+    int cols = _width - col * _block;
+    if (cols > _block) cols = _block;
+    if (_primed && _acc[col] > (uint32_t)_level * rows * cols)
+    {
+      _changed++;
+      if (col < _boxLeft)    _boxLeft   = col;
+      if (col > _boxRight)   _boxRight  = col;
+      if (row < _boxTop)     _boxTop    = row;
+      if (row > _boxBottom)  _boxBottom = row;
+    }
+    _acc[col] = 0;
+  }
+}
+
+bool uCamIII_Motion::end(bool ok)
+{
+  if (!_filling) return false;
+  _filling = false;
+  _motion  = false;
+  if (!ok || _pos != (long)_width * _height)
+  {
+    _failures++;                                                // a partly learnt background is learnt again
+    return false;
+  }
+  if (!_primed)
+  {
+    _primed = true;
+    return false;
+  }
+  _motion = (_changed >= _minBlocks);
+  if (_motion) _triggers++;
+  return _motion;
+}
+
+bool uCamIII_Motion::getBox(int& x, int& y, int& width, int& height, int toWidth, int toHeight)
+{
+  int right, bottom;
+
+  if (!_changed) return false;
+  if (toWidth  <= 0) toWidth  = _width;
+  if (toHeight <= 0) toHeight = _height;
+  right  = (_boxRight  + 1) * _block;
+  bottom = (_boxBottom + 1) * _block;
+  if (right  > _width)  right  = _width;
+  if (bottom > _height) bottom = _height;
+  x      = (long)_boxLeft * _block * toWidth  / _width;
+  y      = (long)_boxTop  * _block * toHeight / _height;
+  width  = (long)right  * toWidth  / _width  - x;
+  height = (long)bottom * toHeight / _height - y;
+  return true;
+}
+
+uint32_t uCamIII_Motion::sad(const uint8_t *a, const uint8_t *b, int n)
+{
+  uint32_t sum = 0;
+
+#if defined(__SSE2__)
+  __m128i  acc = _mm_setzero_si128();
+  for (; n >= 16; n -= 16, a += 16, b += 16)                    // PSADBW: two sums of 8 per instruction
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)a), _mm_loadu_si128((const __m128i*)b)));
+  for (; n >= 8; n -= 8, a += 8, b += 8)
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadl_epi64((const __m128i*)a), _mm_loadl_epi64((const __m128i*)b)));
+  sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+#if defined(__ARM_FEATURE_DSP)
+  for (; n >= 4; n -= 4, a += 4, b += 4)                        // USAD8 on Cortex-M4/M33
+  {
+    uint32_t d;
+    __asm__ ("usad8 %0, %1, %2" : "=r" (d) : "r" (load32(a)), "r" (load32(b)));
+    sum += d;
+  }
+#else
+  for (; n >= 4; n -= 4, a += 4, b += 4)                        // 4 pixels per word in two 16-bit lanes each
+  {
+    uint32_t wa = load32(a), wb = load32(b);
+    uint32_t e  = (wa & 0x00FF00FF) + 0x01000100 - (wb & 0x00FF00FF);         // 256 + a - b, no borrow
+    uint32_t o  = ((wa >> 8) & 0x00FF00FF) + 0x01000100 - ((wb >> 8) & 0x00FF00FF);
+    uint32_t le = ((e >> 8) & 0x00010001) ^ 0x00010001;        // 1 in lanes where a < b
+    uint32_t lo = ((o >> 8) & 0x00010001) ^ 0x00010001;
+    uint32_t s  = (((e & 0x00FF00FF) ^ (le * 0xFF)) + le)      // |a - b|: low byte, negated where a < b
+                + (((o & 0x00FF00FF) ^ (lo * 0xFF)) + lo);
+    sum += (s & 0xFFFF) + (s >> 16);
+  }
+#endif
+  for (; n > 0; n--)
+  {
+    int d = *a++ - *b++;
+    sum += (d < 0) ? -d : d;
+  }
+  return sum;
+}
+
+void uCamIII_Motion::blend(uint8_t *bg, const uint8_t *cur, int n, int shift)
+{
+  if (!shift)
+  {
+    memcpy(bg, cur, n);
+    return;
+  }
+  for (; n > 0; n--, bg++, cur++)                               // at least one step towards cur, so it settles
+  {
+    int d = *cur - *bg;
+    *bg += (d > 0) ? (d + (1 << shift) - 1) >> shift : -((-d + (1 << shift) - 1) >> shift);
+  }
+}
+
+int uCamIII_Motion::input(void *context, uint8_t *buffer, int len, int id)
+{
+  return ((uCamIII_Motion*)context)->write(buffer, len, id);
+}
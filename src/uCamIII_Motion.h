@@ -0,0 +1,98 @@
+/* *************************************************************************************
+
+Change detection for uCamIII
+
+Most captures of a quiet scene show nothing new, yet each costs a full JPEG download and
+upload. `uCamIII_Motion` gates them with a cheap probe: an 80x60 gray8 snapshot (4800
+bytes instead of tens of kB) is compared block by block against a running background
+and only when enough blocks changed is the expensive capture worth taking.
+
+  uint8_t        background[80 * 60];
+  uCamIII_Motion motion(background);                   // 80x60, 8x8 pixel blocks
+  motion.setThreshold(12, 2);                          // mean difference per pixel, blocks
+  if (motion.check(ucam))                              // probe, true when something moved
+  {
+    motion.getBox(x, y, w, h, 640, 480);               // changed area scaled to the JPEG
+    ...                                                // take the JPEG as usual
+  }
+
+The comparison runs on the rows as they stream from the camera (any sink based read works,
+e.g. streamRawData() or the non-blocking engine between begin() and end()), so nothing but
+the background is stored: per block the sum of absolute differences (SAD) to the background
+is accumulated, 4 pixels per 32-bit word (16 with SSE2 on host builds, USAD8 on Cortex-M4),
+and a block counts as changed when its SAD exceeds level x pixels. The background follows
+the scene by 1/2^learn (default 1/2) of the difference per probe, blocks that changed are
+taken over as they are - so a scene that changed and stays so triggers once. The first
+probe only learns the background.
+
+A converter attached to the camera is detached for the probe.
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_MOTION_h_
+#define _UCAMIII_MOTION_h_
+
+#include "uCamIII.h"
+
+// most block columns (image width / block size) the accumulators are kept for
+#ifndef uCamIII_MOTION_COLS
+ #define uCamIII_MOTION_COLS 40
+#endif
+
+class uCamIII_Motion {
+public:
+  // background holds width x height bytes of the resolution's gray8 image, blocks of 2..16 pixels
+  uCamIII_Motion(uint8_t *background, uCamIII_RES resolution = uCamIII_80x60, int blockSize = 8);
+
+  inline void       setThreshold(uint8_t level, int blocks = 1) { _level = level; _minBlocks = blocks > 0 ? blocks : 1; }
+  inline void       setLearning(uint8_t shift)  { _learn = shift > 7 ? 7 : shift; }   // 0: background = last probe
+  inline uCamIII_Sink sink()                    { return uCamIII_Sink(input, this); }
+
+  bool              check(uCamIII_Base& camera);                // probe snapshot, true if it shows motion
+  bool              begin();                                    // frame to compare follows (via write()/sink())
+  bool              begin(uCamIII_Base& camera);                //   if the image announced is the probe's
+  int               write(uint8_t *data, int len, int id);      // as uCamIII_sinkFunc
+  bool              end(bool ok = true);                        // true if the frame showed motion
+  inline void       reset()                     { _primed = false; _filling = false; }  // learn the background anew
+
+  inline bool       isMotion()                  { return _motion; }
+  inline int        getChanged()                { return _changed; }    // blocks over the threshold in the last frame
+  // bounding box of the changed blocks in probe pixels, or scaled to toWidth x toHeight
+  bool              getBox(int& x, int& y, int& width, int& height, int toWidth = 0, int toHeight = 0);
+  inline int        getWidth()                  { return _width; }
+  inline int        getHeight()                 { return _height; }
+  inline uint32_t   getProbes()                 { return _probes; }
+  inline uint32_t   getTriggers()               { return _triggers; }
+  inline uint32_t   getFailures()               { return _failures; }
+
+  // sum of absolute differences of n bytes
+  static uint32_t   sad(const uint8_t *a, const uint8_t *b, int n);
+  // move n bytes of bg 1/2^shift of the way towards cur
+  static void       blend(uint8_t *bg, const uint8_t *cur, int n, int shift);
+
+protected:
+  uint8_t          *_background;
+  uCamIII_RES       _resolution;
+  int               _width;
+  int               _height;
+  int               _block;
+  int               _cols;
+  uint8_t           _level;
+  int               _minBlocks;
+  uint8_t           _learn;
+  bool              _primed;                                    // background learnt
+  bool              _filling;
+  bool              _motion;
+  long              _pos;                                       // pixels of the current frame seen
+  uint32_t          _acc[uCamIII_MOTION_COLS];                  // SAD per block of the current block row
+  int               _changed;
+  int               _boxLeft, _boxTop, _boxRight, _boxBottom;   // changed blocks, inclusive
+  uint32_t          _probes;
+  uint32_t          _triggers;
+  uint32_t          _failures;
+
+  void              blockRow(int row);
+  static int        input(void *context, uint8_t *buffer, int len, int id);
+};
+
+#endif
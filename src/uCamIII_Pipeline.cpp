@@ -0,0 +1,81 @@
+#include "uCamIII_Pipeline.h"
+
+void uCamIII_Pipeline::reset()
+{
+  _head       = 0;
+  _count      = 0;
+  _highWater  = 0;
+  _fullStalls = 0;
+  _id         = 0;
+  _failed     = false;
+}
+
+int uCamIII_Pipeline::write(uint8_t *data, int len)
+{
+  int n;
+
+  if (_failed) return uCamIII_SINK_ABORT;
+  if (len > space() && pump() < 0) return uCamIII_SINK_ABORT;  // make room first
+
+  n = (len < space()) ? len : space();
+  if (n > 0)
+  {
+    int tail  = (_head + _count) % _size;
+    int first = (n < _size - tail) ? n : _size - tail;          // up to the end of the ring, the rest wraps
+    memcpy(&_ring[tail], data, first);
+    memcpy(_ring, data + first, n - first);
+    _count += n;
+    if (_count > _highWater) _highWater = _count;
+  }
+  if (n < len) _fullStalls++;
+  if (pump() < 0) return uCamIII_SINK_ABORT;                    // keep the output busy right away
+  return n;
+}
+
+int uCamIII_Pipeline::pump()
+{
+  int moved = 0;
+
+  if (_failed) return uCamIII_SINK_ABORT;
+  if (!_output.isSet()) return 0;
+  while (_count > 0)
+  {
+    int chunk = (_count < _size - _head) ? _count : _size - _head;
+    int n     = _output.write(&_ring[_head], chunk, _id);
+
+    if (n < 0)
+    {
+      _failed = true;
+      return uCamIII_SINK_ABORT;
+    }
+    if (!n) break;                                              // output backed up
+    if (n > chunk) n = chunk;
+    _id++;
+    _head   = (_head + n) % _size;
+    _count -= n;
+    moved  += n;
+    if (n < chunk) break;
+  }
+  if (!_count) _head = 0;                                       // keep the next frame contiguous
+  return moved;
+}
+
+bool uCamIII_Pipeline::flush(uint32_t timeout)
+{
+  uint32_t ms = millis();
+  int      n;
+
+  while (_count > 0)
+  {
+    if ((n = pump()) < 0) return false;
+    if (n) ms = millis();
+    else if (millis() - ms >= timeout) return false;
+    else delay(1);
+  }
+  return true;
+}
+
+int uCamIII_Pipeline::input(void *context, uint8_t *buffer, int len, int id)
+{
+  return ((uCamIII_Pipeline*)context)->write(buffer, len);
+}
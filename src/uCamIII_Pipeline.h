@@ -0,0 +1,63 @@
+/* *************************************************************************************
+
+Camera-to-network pipeline stage for uCamIII
+
+Passing each JPEG package straight from `getJpegData()` to a TCP client serialises the
+two links: the camera waits while the network drains and the network idles while the
+camera sends. `uCamIII_Pipeline` puts a fixed ring buffer between them. Its `sink()`
+takes packages from the camera as long as there is room (and holds the camera off via
+backpressure when there isn't), `pump()` passes buffered bytes on to the output sink as
+far as it takes them - so the next package is already being received while the previous
+one is still being sent and a frame takes about max(camera, network) instead of the sum.
+
+  uint8_t          ring[4096];
+  uCamIII_Pipeline pipe(ring, sizeof(ring), uCamIII_Sink(toTcp, &client));
+  ucam.beginCapture(uCamIII_COMP_JPEG, uCamIII_640x480, pkg, 506, pipe.sink());
+  while (ucam.isBusy()) { ucam.poll(); pipe.pump(); }
+  pipe.flush();                                        // rest of the frame
+
+Each write into the ring pumps as well, so with the blocking calls the network is kept
+busy between packages too. The output returns what it took, `uCamIII_SINK_BUSY` while
+it's backed up (e.g. TCPClient::write() returning -16) or `uCamIII_SINK_ABORT`, which
+makes the camera side abort as well.
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_PIPELINE_h_
+#define _UCAMIII_PIPELINE_h_
+
+#include "uCamIII.h"
+
+class uCamIII_Pipeline {
+public:
+  uCamIII_Pipeline(uint8_t *ring, int size, const uCamIII_Sink& output = uCamIII_Sink())
+  : _ring(ring), _size(ring ? size : 0), _output(output) { reset(); }
+
+  inline void       setOutput(const uCamIII_Sink& output) { _output = output; }
+  inline uCamIII_Sink sink()            { return uCamIII_Sink(input, this); }   // camera side
+  int               write(uint8_t *data, int len);              // bytes buffered, uCamIII_SINK_ABORT once the output failed
+  int               pump();                                     // bytes passed on, uCamIII_SINK_ABORT once the output failed
+  bool              flush(uint32_t timeout = 5000);             // pump until empty, false on failure or no progress
+  void              reset();                                    // drop what's buffered and a failure
+
+  inline int        available()         { return _count; }
+  inline int        space()             { return _size - _count; }
+  inline bool       isFailed()          { return _failed; }
+  inline int        getHighWater()      { return _highWater; }  // most bytes buffered at once (for sizing the ring)
+  inline uint32_t   getFullStalls()     { return _fullStalls; } // writes the ring couldn't take completely
+
+protected:
+  uint8_t          *_ring;
+  int               _size;
+  uCamIII_Sink      _output;
+  int               _head;                                      // next byte to pass on
+  int               _count;
+  int               _highWater;
+  uint32_t          _fullStalls;
+  uint16_t          _id;                                        // id passed to the output
+  bool              _failed;
+
+  static int        input(void *context, uint8_t *buffer, int len, int id);
+};
+
+#endif
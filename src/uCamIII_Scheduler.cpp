@@ -0,0 +1,81 @@
+#include "uCamIII_Scheduler.h"
+
+int uCamIII_Scheduler::add(uCamIII_Base& camera)
+{
+  if (_count >= uCamIII_MAX_CAMERAS) return -1;
+  _cameras[_count] = &camera;
+  _events[_count]  = uCamIII_EVENT_NONE;
+  return _count++;
+}
+
+bool uCamIII_Scheduler::capture(int index, uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution,
+                                uint8_t *buffer, int len, const uCamIII_Sink& sink, bool triggered,
+                                uCamIII_PIC_TYPE type, uint16_t packageSize)
+{
+  if (index < 0 || index >= _count) return false;
+
+  uCamIII_Base& cam = *_cameras[index];
+  cam.setExternalTrigger(triggered);
+  _events[index] = uCamIII_EVENT_NONE;
+  return cam.beginCapture(format, resolution, buffer, len, sink, type, packageSize);
+}
+
+void uCamIII_Scheduler::trigger()
+{
+  _triggerPending = true;
+  release();                                                    // all armed already - fire right away
+}
+
+bool uCamIII_Scheduler::poll()
+{
+  for (int n = 0; n < _count; n++)
+  {
+    int           i   = (_next + n) % _count;
+    uCamIII_Base& cam = *_cameras[i];
+
+    if (!cam.isBusy()) continue;                                 // armed ones too: they time out once asleep
+    uCamIII_EVENT event = cam.poll();
+    if (event == uCamIII_EVENT_NONE) continue;
+    _events[i] = event;
+    if (_callback) _callback(i, event);
+  }
+  if (_count) _next = (_next + 1) % _count;
+  release();
+  return isBusy();
+}
+
+bool uCamIII_Scheduler::isBusy()
+{
+  for (int i = 0; i < _count; i++)
+    if (_cameras[i]->isBusy()) return true;
+  return false;
+}
+
+void uCamIII_Scheduler::abort()
+{
+  for (int i = 0; i < _count; i++)
+    if (_cameras[i]->isBusy()) _cameras[i]->abort();
+  _triggerPending = false;
+}
+
+// --- protected ---
+
+// once no camera is still being configured the armed ones snap back to back
+void uCamIII_Scheduler::release()
+{
+  if (!_triggerPending || configuring()) return;
+  for (int i = 0; i < _count; i++)
+    _cameras[i]->trigger();
+  _triggerPending = false;
+}
+
+// a camera still on its way to ARMED (sync, format, package size)
+bool uCamIII_Scheduler::configuring()
+{
+  for (int i = 0; i < _count; i++)
+  {
+    uCamIII_STATE s = _cameras[i]->getState();
+    if (s == uCamIII_STATE_SYNC || s == uCamIII_STATE_FORMAT || s == uCamIII_STATE_PACKAGE_SIZE) return true;
+  }
+  return false;
+}
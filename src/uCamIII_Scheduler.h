@@ -0,0 +1,72 @@
+/* *************************************************************************************
+
+Cooperative scheduler for several uCamIII cameras
+
+Each `uCamIII` instance already has a non-blocking capture engine (`beginCapture()`/
+`poll()`), `uCamIII_Scheduler` drives several of them from one loop: every `poll()`
+gives each busy camera one turn (starting with a different one each round), so one
+camera's snapshot processing overlaps with another one's data transfer and the total
+rate approaches the sum of the links.
+
+  uCamIII<USARTSerial>        cam1(Serial1);
+  uCamIII<USARTSerial>        cam2(Serial2);
+  uCamIII_Scheduler           cams(onEvent);           // void onEvent(int camera, uCamIII_EVENT event)
+  cams.add(cam1);
+  cams.add(cam2);
+  cams.capture(0, uCamIII_COMP_JPEG, uCamIII_640x480, buf1, 506, sink1, true);
+  cams.capture(1, uCamIII_COMP_JPEG, uCamIII_640x480, buf2, 506, sink2, true);
+  cams.trigger();                                      // both snap once both are configured
+  while (cams.poll()) { ... }
+
+Captures started with `triggered` stop in `uCamIII_STATE_ARMED` after the configuration
+and `trigger()` releases them all at once (back to back on the wire) as soon as none
+of the cameras is still being configured. Armed cameras are polled as well: one that
+falls asleep before the trigger comes reports uCamIII_EVENT_ERROR (a timeout).
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_SCHEDULER_h_
+#define _UCAMIII_SCHEDULER_h_
+
+#include "uCamIII.h"
+
+#ifndef uCamIII_MAX_CAMERAS
+ #define uCamIII_MAX_CAMERAS 4
+#endif
+
+typedef void (*uCamIII_eventCallback)(int camera, uCamIII_EVENT event);
+
+class uCamIII_Scheduler {
+public:
+  uCamIII_Scheduler(uCamIII_eventCallback callback = NULL)
+  : _callback(callback), _count(0), _next(0), _triggerPending(false) { }
+
+  int               add(uCamIII_Base& camera);                  // index of the camera, -1 if full
+  inline int        getCount()                         { return _count; }
+  inline uCamIII_Base& camera(int index)               { return *_cameras[index]; }
+  inline uCamIII_EVENT getEvent(int index)             { return _events[index]; }   // last event other than NONE
+  inline void       setEventCallback(uCamIII_eventCallback callback)
+                    { _callback = callback; }
+
+  // beginCapture() on camera `index`, with `triggered` it waits for trigger() once configured
+  bool              capture(int index, uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution,
+                            uint8_t *buffer, int len, const uCamIII_Sink& sink, bool triggered = false,
+                            uCamIII_PIC_TYPE type = uCamIII_TYPE_SNAPSHOT, uint16_t packageSize = 512);
+  void              trigger();                                  // release all armed cameras together
+  bool              poll();                                     // one turn per camera, true while any is busy
+  bool              isBusy();
+  void              abort();
+
+protected:
+  uCamIII_eventCallback _callback;
+  uCamIII_Base     *_cameras[uCamIII_MAX_CAMERAS];
+  uCamIII_EVENT     _events[uCamIII_MAX_CAMERAS];
+  int               _count;
+  int               _next;                                      // camera to get the first turn
+  bool              _triggerPending;
+
+  bool              configuring();
+  void              release();
+};
+
+#endif
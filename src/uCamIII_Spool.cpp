@@ -0,0 +1,412 @@
+#include "uCamIII_Spool.h"
+#include "uCamIII_Converter.h"
+
+#if uCamIII_SPOOL_POSIX
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// len bytes at file position pos, all or nothing
+static bool fileIo(int fd, uint32_t pos, uint8_t *data, uint32_t len, bool writing)
+{
+  if (lseek(fd, pos, SEEK_SET) != (off_t)pos) return false;
+  while (len)
+  {
+    ssize_t n = writing ? ::write(fd, data, len) : ::read(fd, data, len);
+    if (n <= 0) return false;
+    data += n;
+    len  -= n;
+  }
+  return true;
+}
+
+uCamIII_Spool::uCamIII_Spool(uint32_t capacity, uint32_t maxAge)
+: _fd(-1), _capacity(capacity), _maxAge(maxAge), _now(uptime), _camera(NULL)
+, _head(0), _used(0), _count(0), _seq(0), _written(0), _sent(0), _open(false), _draining(false)
+, _stored(0), _forwarded(0), _dropped(0), _refused(0), _corrupt(0)
+{
+  memset(&_in,  0, sizeof(_in));
+  memset(&_out, 0, sizeof(_out));
+}
+
+bool uCamIII_Spool::open(const char *path)
+{
+  uint8_t h[uCamIII_SPOOL_HEADER];
+  off_t   size;
+
+  close();
+  if ((_fd = ::open(path, O_RDWR | O_CREAT, 0644)) < 0)
+  {
+    uCamIII_LOG_WARN("can't open spool %s", path);
+    return false;
+  }
+  size = lseek(_fd, 0, SEEK_END);
+  if (fileIo(_fd, 0, h, sizeof(h), false)
+  &&  !memcmp(h, "uC3S", 4) && h[4] == uCamIII_SPOOL_VERSION && get32(&h[8]) == _capacity
+  &&  get32(&h[28]) == uCamIII_FrameWriter::crc32(h, 28)
+  &&  get32(&h[12]) < _capacity && get32(&h[16]) <= _capacity)
+  {
+    _head  = get32(&h[12]);
+    _used  = get32(&h[16]);
+    _count = get32(&h[20]);
+    _seq   = get32(&h[24]);
+    uCamIII_LOG_INFO("spool %s: %lu records, %lu of %lu bytes", path, (unsigned long)_count,
+                     (unsigned long)_used, (unsigned long)_capacity);
+    return true;
+  }
+  if (size > 0) uCamIII_LOG_WARN("%s isn't a spool of %lu bytes, starting empty", path, (unsigned long)_capacity);
+  return clear();
+}
+
+void uCamIII_Spool::close()
+{
+  if (_fd >= 0) ::close(_fd);
+  _fd       = -1;
+  _open     = false;
+  _draining = false;
+}
+
+bool uCamIII_Spool::clear()
+{
+  _head     = 0;
+  _used     = 0;
+  _count    = 0;
+  _open     = false;
+  _draining = false;
+  return saveHeader();
+}
+
+bool uCamIII_Spool::begin(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, uint32_t size,
+                          uint32_t ms, uint8_t flags)
+{
+  uint32_t need = uCamIII_SPOOL_INDEX + size;
+  bool     made = false;
+
+  if (_fd < 0) return false;
+  _open = false;                                                // one that was never ended is dropped
+  if (!size || need > _capacity)
+  {
+    uCamIII_LOG_WARN("%lu bytes don't fit a spool of %lu", (unsigned long)size, (unsigned long)_capacity);
+    _refused++;
+    return false;
+  }
+  expire();
+  while (_capacity - _used < need)                              // the oldest give way
+  {
+    uCamIII_SpoolRecord old;
+
+    if (_draining)                                              // can't pull it from under the writer
+    {
+      _refused++;
+      if (made) saveHeader();
+      return false;
+    }
+    if (!loadIndex(_head, old))
+    {
+      if (_used) return false;
+      break;                                                    // cleared as corrupt, room enough now
+    }
+    dropHead(old.len);
+    _dropped++;
+    made = true;
+  }
+  if (made && !saveHeader()) return false;                      // before their space is overwritten
+
+  _in.seq        = _seq;
+  _in.format     = format;
+  _in.resolution = resolution;
+  _in.flags      = flags;
+  _in.stored     = _now();
+  _in.ms         = ms;
+  _in.len        = size;
+  _in.crc        = 0;
+  _written       = 0;
+  _open          = true;
+  return true;
+}
+
+bool uCamIII_Spool::begin(uCamIII_Base& camera)
+{
+  long               size = camera.getOutputSize();
+  uCamIII_Converter *conv = camera.getConverter();
+
+  return size > 0
+      && begin(camera.getImageFormat(), camera.getResolution(), size, camera.getCaptureMs(),
+               conv && conv->isActive() ? uCamIII_FRAME_CONVERTED : 0);
+}
+
+int uCamIII_Spool::write(uint8_t *data, int len)
+{
+  if (!_open && (!_camera || !begin(*_camera))) return uCamIII_SINK_ABORT;
+  if ((uint32_t)len > _in.len - _written
+  ||  !io((_head + _used + uCamIII_SPOOL_INDEX + _written) % _capacity, data, len, true))
+  {
+    end(false);
+    return uCamIII_SINK_ABORT;
+  }
+  _in.crc   = uCamIII_FrameWriter::crc32(data, len, _in.crc);
+  _written += len;
+  if (_written == _in.len && !commit()) return uCamIII_SINK_ABORT;
+  return len;
+}
+
+bool uCamIII_Spool::end(bool ok)
+{
+  if (!_open) return ok;
+  if (!ok || !_written)
+  {
+    _open = false;
+    return false;
+  }
+  _in.len = _written;                                           // JPEG that ended at its EOI
+  return commit();
+}
+
+bool uCamIII_Spool::store(const uint8_t *data, uint32_t len, uCamIII_IMAGE_FORMAT format,
+                          uCamIII_RES resolution, uint32_t ms, uint8_t flags)
+{
+  if (!begin(format, resolution, len, ms, flags)) return false;
+  if (!io((_head + _used + uCamIII_SPOOL_INDEX) % _capacity, (uint8_t*)data, len, true))
+  {
+    _open = false;
+    return false;
+  }
+  _in.crc  = uCamIII_FrameWriter::crc32(data, len);
+  _written = len;
+  return commit();
+}
+
+int uCamIII_Spool::drain(uCamIII_FrameWriter& out, int maxFrames, uCamIII_Pipeline *via)
+{
+  uint8_t buf[uCamIII_SPOOL_CHUNK];
+  int     done = 0;
+
+  if (_fd < 0) return 0;
+  if (out.isFailed())
+  {
+    _draining = false;
+    return -1;
+  }
+  while (!maxFrames || done < maxFrames)
+  {
+    if (!_draining)
+    {
+      expire();
+      if (!_count || !loadIndex(_head, _out)) break;
+      if (!verify(_out))
+      {
+        uCamIII_LOG_WARN("spooled frame %lu is corrupt, dropped", (unsigned long)_out.seq);
+        _corrupt++;
+        dropHead(_out.len);
+        saveHeader();
+        continue;
+      }
+      out.setSequence(_out.seq);
+      if (!out.begin((uCamIII_IMAGE_FORMAT)_out.format, (uCamIII_RES)_out.resolution, _out.len, _out.ms, _out.flags))
+        return out.isFailed() ? -1 : done;                      // last trailer still pending
+      _draining = true;
+      _sent     = 0;
+    }
+    while (_sent < _out.len)
+    {
+      uint32_t n = (_out.len - _sent < sizeof(buf)) ? _out.len - _sent : sizeof(buf);
+      int      r;
+
+      if (!io((_head + uCamIII_SPOOL_INDEX + _sent) % _capacity, buf, n, false))
+      {
+        _draining = false;
+        return -1;                                              // the frame is broken off
+      }
+      if ((r = out.write(buf, n)) < 0)
+      {
+        _draining = false;
+        return -1;
+      }
+      if (!r) return done;                                      // out is backed up, resume from here
+      _sent += r;
+    }
+    if (!out.flush(0))                                          // trailer not taken yet
+    {
+      if (!out.isFailed()) return done;
+      _draining = false;
+      return -1;
+    }
+    if (via && (via->pump() < 0 || via->isFailed()))
+    {
+      _draining = false;
+      return -1;
+    }
+    if (via && via->available()) return done;                   // still in the ring, keep the record
+    _draining = false;
+    dropHead(_out.len);
+    saveHeader();
+    _forwarded++;
+    done++;
+  }
+  return done;
+}
+
+bool uCamIII_Spool::peek(uCamIII_SpoolRecord& record)
+{
+  return _fd >= 0 && _count && loadIndex(_head, record);
+}
+
+// ----------------------------------- protected ----------------------------------------
+
+bool uCamIII_Spool::io(uint32_t offset, uint8_t *data, uint32_t len, bool writing)
+{
+  while (len)
+  {
+    uint32_t n = (_capacity - offset < len) ? _capacity - offset : len;
+
+    if (!fileIo(_fd, uCamIII_SPOOL_HEADER + offset, data, n, writing))
+    {
+      uCamIII_LOG_WARN("spool %s failed at %lu", writing ? "write" : "read", (unsigned long)offset);
+      return false;
+    }
+    data  += n;
+    len   -= n;
+    offset = 0;
+  }
+  return true;
+}
+
+bool uCamIII_Spool::saveHeader()
+{
+  uint8_t h[uCamIII_SPOOL_HEADER];
+
+  if (_fd < 0) return false;
+  memset(h, 0, sizeof(h));
+  memcpy(h, "uC3S", 4);
+  h[4] = uCamIII_SPOOL_VERSION;
+  put32(&h[8],  _capacity);
+  put32(&h[12], _head);
+  put32(&h[16], _used);
+  put32(&h[20], _count);
+  put32(&h[24], _seq);
+  put32(&h[28], uCamIII_FrameWriter::crc32(h, 28));
+  if (!fileIo(_fd, 0, h, sizeof(h), true)) return false;
+  fsync(_fd);                                                   // the records it counts are on flash
+  return true;
+}
+
+bool uCamIII_Spool::loadIndex(uint32_t offset, uCamIII_SpoolRecord& record)
+{
+  uint8_t x[uCamIII_SPOOL_INDEX];
+
+  if (!io(offset, x, sizeof(x), false)) return false;
+  if (get32(&x[24]) != uCamIII_FrameWriter::crc32(x, 24) || uCamIII_SPOOL_INDEX + get32(&x[16]) > _used)
+  {
+    uCamIII_LOG_WARN("spool index at %lu is corrupt, %lu records lost", (unsigned long)offset, (unsigned long)_count);
+    _corrupt += _count;                                         // where the next one starts isn't known anymore
+    clear();
+    return false;
+  }
+  record.seq        = get32(&x[0]);
+  record.format     = x[4];
+  record.resolution = x[5];
+  record.flags      = x[6];
+  record.stored     = get32(&x[8]);
+  record.ms         = get32(&x[12]);
+  record.len        = get32(&x[16]);
+  record.crc        = get32(&x[20]);
+  return true;
+}
+
+bool uCamIII_Spool::saveIndex(uint32_t offset, const uCamIII_SpoolRecord& record)
+{
+  uint8_t x[uCamIII_SPOOL_INDEX];
+
+  memset(x, 0, sizeof(x));
+  put32(&x[0], record.seq);
+  x[4] = record.format;
+  x[5] = record.resolution;
+  x[6] = record.flags;
+  put32(&x[8],  record.stored);
+  put32(&x[12], record.ms);
+  put32(&x[16], record.len);
+  put32(&x[20], record.crc);
+  put32(&x[24], uCamIII_FrameWriter::crc32(x, 24));
+  return io(offset, x, sizeof(x), true);
+}
+
+// payload read back against its CRC
+bool uCamIII_Spool::verify(const uCamIII_SpoolRecord& record)
+{
+  uint8_t  buf[uCamIII_SPOOL_CHUNK];
+  uint32_t crc = 0;
+
+  for (uint32_t pos = 0; pos < record.len; )
+  {
+    uint32_t n = (record.len - pos < sizeof(buf)) ? record.len - pos : sizeof(buf);
+    if (!io((_head + uCamIII_SPOOL_INDEX + pos) % _capacity, buf, n, false)) return false;
+    crc  = uCamIII_FrameWriter::crc32(buf, n, crc);
+    pos += n;
+  }
+  return crc == record.crc;
+}
+
+// payload is in place behind the last record: index it and count it in
+bool uCamIII_Spool::commit()
+{
+  uint32_t tail = (_head + _used) % _capacity;
+
+  _open = false;
+  if (!saveIndex(tail, _in)) return false;
+  _used += uCamIII_SPOOL_INDEX + _in.len;
+  _count++;
+  _seq++;
+  _stored++;
+  return saveHeader();
+}
+
+void uCamIII_Spool::dropHead(uint32_t len)
+{
+  _head  = (_head + uCamIII_SPOOL_INDEX + len) % _capacity;
+  _used -= uCamIII_SPOOL_INDEX + len;
+  if (!--_count && !_open) _head = 0;                           // empty: start over at the ring's beginning
+}
+
+// records older than maxAge leave, except the one being forwarded
+void uCamIII_Spool::expire()
+{
+  uint32_t            now  = _now();
+  bool                made = false;
+  uCamIII_SpoolRecord old;
+
+  if (!_maxAge) return;
+  while (_count && !_draining && loadIndex(_head, old))
+  {
+    if (old.stored > now || now - old.stored <= _maxAge) break; // clock set back: keep it
+    dropHead(old.len);
+    _dropped++;
+    made = true;
+  }
+  if (made) saveHeader();
+}
+
+int uCamIII_Spool::input(void *context, uint8_t *buffer, int len, int id)
+{
+  return ((uCamIII_Spool*)context)->write(buffer, len);
+}
+
+// seconds since boot: only good for ages within one boot, see setClock()
+uint32_t uCamIII_Spool::uptime()
+{
+  return millis() / 1000;
+}
+
+void uCamIII_Spool::put32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+uint32_t uCamIII_Spool::get32(const uint8_t *p)
+{
+  return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/* *************************************************************************************
+
+Store-and-forward frame spool for uCamIII
+
+On an intermittent uplink the connection is often down when a capture fires and the
+image is lost after its transfer from the camera has already been paid for.
+`uCamIII_Spool` takes captures through the usual sink interface (or as a finished buffer)
+and appends them to a log file, then forwards them oldest first through a
+`uCamIII_FrameWriter` once the uplink is back - so the capture rate no longer depends on
+the uplink being available, and nothing has to be captured twice.
+
+  uCamIII_Spool spool(256 * 1024, 24 * 3600);          // 256 kB of frames, none older than a day
+  spool.setClock(wallClock);                           // ages across a reset, e.g. returns Time.now()
+  spool.open("/spool.bin");                            // survives a reset
+  spool.attach(ucam);                                  // index from the camera's format/size
+  ucam.beginCapture(uCamIII_COMP_JPEG, uCamIII_640x480, pkg, 506, spool.sink());
+  ...
+  if (client.connected()) spool.drain(netFrames, 4);   // non-blocking, up to 4 frames per call
+
+The file is a ring of `capacity` bytes behind a 32 byte header, all fields little-endian:
+
+  offset  size    file header
+     0      4     magic "uC3S"
+     4      1     version (uCamIII_SPOOL_VERSION)
+     8      4     capacity
+    12      4     head: ring offset of the oldest record
+    16      4     bytes used by records
+    20      4     records
+    24      4     sequence number of the next record
+    28      4     CRC-32 of bytes 0..27
+
+  offset  size    record index, followed by the payload (wrapping at the ring's end)
+     0      4     sequence number
+     4      1     uCamIII_IMAGE_FORMAT
+     5      1     uCamIII_RES
+     6      1     flags (uCamIII_FRAME_FLAGS)
+     8      4     time stored, seconds of the spool clock (see setClock())
+    12      4     millis() when the camera took the image (getCaptureMs())
+    16      4     payload length
+    20      4     CRC-32 of the payload
+    24      4     CRC-32 of bytes 0..23
+
+A record is written behind the last one and only counts once the file header has been
+updated, so a capture cut short (or a reset halfway) leaves the log as it was. The
+quotas are enforced when a capture begins: the oldest records give way until it fits,
+records older than `maxAge` seconds are dropped before anything is forwarded. Ages are
+taken from the spool clock, by default seconds since boot: that starts over with a reset
+(and after 49 days), so records carried over one are kept too long rather than dropped -
+a non-zero `maxAge` wants a wall clock through setClock() (e.g. Time.now()). A record is
+checked against its CRC before it goes out (flash can fail too) and removed only after
+the frame writer has taken its trailer - or, with the pipeline between the writer and the
+uplink passed to drain(), once that has passed it on. The writer's sequence number is
+set to the record's, so gaps at the receiver show what the quotas dropped. After
+resetting the writer (new connection) rewind() starts the record being forwarded over.
+
+Needs the POSIX file API: Linux hosts and Particle devices with a file system (Gen3,
+Device OS 2.0 and up).
+
+************************************************************************************* */
+
+#ifndef _UCAMIII_SPOOL_h_
+#define _UCAMIII_SPOOL_h_
+
+#include "uCamIII.h"
+#include "uCamIII_FrameWriter.h"
+#include "uCamIII_Pipeline.h"
+
+#ifndef uCamIII_SPOOL_POSIX
+ #if (defined(PARTICLE) && defined(HAL_PLATFORM_FILESYSTEM) && HAL_PLATFORM_FILESYSTEM) \
+  || (!defined(PARTICLE) && (defined(__unix__) || defined(__APPLE__)))
+  #define uCamIII_SPOOL_POSIX 1
+ #else
+  #define uCamIII_SPOOL_POSIX 0
+ #endif
+#endif
+
+#if uCamIII_SPOOL_POSIX
+
+#define uCamIII_SPOOL_VERSION       1
+#define uCamIII_SPOOL_HEADER        32
+#define uCamIII_SPOOL_INDEX         28
+
+// bytes read from the file per step while checking and forwarding a record (on the stack)
+#ifndef uCamIII_SPOOL_CHUNK
+ #define uCamIII_SPOOL_CHUNK        256
+#endif
+
+struct uCamIII_SpoolRecord
+{
+  uint32_t          seq;
+  uint8_t           format;                                     // uCamIII_IMAGE_FORMAT
+  uint8_t           resolution;                                 // uCamIII_RES
+  uint8_t           flags;                                      // uCamIII_FRAME_FLAGS
+  uint32_t          stored;                                     // spool clock
+  uint32_t          ms;
+  uint32_t          len;
+  uint32_t          crc;
+};
+
+class uCamIII_Spool {
+public:
+  // capacity: bytes of the ring (records incl. their index), maxAge: seconds of the spool
+  // clock, 0 = no limit - set a wall clock with setClock() for ages to hold across a reset
+  uCamIII_Spool(uint32_t capacity, uint32_t maxAge = 0);
+  ~uCamIII_Spool()                      { close(); }
+
+  bool              open(const char *path);                     // keeps what the file holds if it's a spool of this capacity
+  void              close();
+  bool              clear();                                    // drop all records
+  inline void       setMaxAge(uint32_t seconds)   { _maxAge = seconds; }
+  inline void       setClock(uint32_t (*now)())   { _now = now ? now : uptime; }   // seconds, e.g. Time.now()
+  inline void       attach(uCamIII_Base& camera)  { _camera = &camera; }
+  inline uCamIII_Sink sink()            { return uCamIII_Sink(input, this); }   // camera side
+
+  bool              begin(uCamIII_IMAGE_FORMAT format, uCamIII_RES resolution, uint32_t size,
+                          uint32_t ms, uint8_t flags = 0);     // false if it can't be made to fit
+  bool              begin(uCamIII_Base& camera);                // format, resolution and size of its current image
+  int               write(uint8_t *data, int len);              // payload, as uCamIII_sinkFunc
+  bool              end(bool ok = true);                        // store a record short of its length (EOI), or drop it
+  bool              store(const uint8_t *data, uint32_t len, uCamIII_IMAGE_FORMAT format,
+                          uCamIII_RES resolution, uint32_t ms, uint8_t flags = 0);
+
+  // forward up to maxFrames records (0: all) through out, returns the number completed, -1
+  // once out has failed or a frame had to be broken off - what out doesn't take now is
+  // offered again on the next call. With `via`, the pipeline out writes into, a record is
+  // only removed once via has passed all of it on (pumped here, never blocking)
+  int               drain(uCamIII_FrameWriter& out, int maxFrames = 1, uCamIII_Pipeline *via = NULL);
+  inline void       rewind()            { _draining = false; }  // out was reset, start the record over
+  inline bool       isForwarding()      { return _draining; }   // a record is part way out
+  bool              peek(uCamIII_SpoolRecord& record);          // oldest record, false if none
+
+  inline bool       isOpen()            { return _fd >= 0; }
+  inline bool       isWriting()         { return _open; }       // a record's payload is being written
+  inline uint32_t   getCapacity()       { return _capacity; }
+  inline uint32_t   getUsed()           { return _used; }       // bytes incl. index
+  inline uint32_t   getCount()          { return _count; }      // records waiting
+  inline uint32_t   getSequence()       { return _seq; }        // of the next record
+  inline uint32_t   getStored()         { return _stored; }     // records added (since construction)
+  inline uint32_t   getForwarded()      { return _forwarded; }
+  inline uint32_t   getDropped()        { return _dropped; }    // to the size or age quota
+  inline uint32_t   getRefused()        { return _refused; }    // too big, or no room while the oldest is forwarded
+  inline uint32_t   getCorrupt()        { return _corrupt; }    // failed their CRC
+
+protected:
+  int               _fd;
+  uint32_t          _capacity;
+  uint32_t          _maxAge;
+  uint32_t        (*_now)();
+  uCamIII_Base     *_camera;
+  uint32_t          _head;                                      // ring offset of the oldest record
+  uint32_t          _used;
+  uint32_t          _count;
+  uint32_t          _seq;                                       // of the next record
+  uCamIII_SpoolRecord _in;                                      // being written behind the last record
+  uCamIII_SpoolRecord _out;                                     // being forwarded (the oldest)
+  uint32_t          _written;                                   // payload bytes of _in
+  uint32_t          _sent;                                      // payload bytes of _out
+  bool              _open;
+  bool              _draining;
+  uint32_t          _stored;
+  uint32_t          _forwarded;
+  uint32_t          _dropped;
+  uint32_t          _refused;
+  uint32_t          _corrupt;
+
+  bool              io(uint32_t offset, uint8_t *data, uint32_t len, bool writing);   // ring offset, wraps
+  bool              saveHeader();
+  bool              loadIndex(uint32_t offset, uCamIII_SpoolRecord& record);
+  bool              saveIndex(uint32_t offset, const uCamIII_SpoolRecord& record);
+  bool              verify(const uCamIII_SpoolRecord& record);
+  bool              commit();
+  void              dropHead(uint32_t len);
+  void              expire();
+  static int        input(void *context, uint8_t *buffer, int len, int id);
+  static uint32_t   uptime();                                   // default clock: seconds since boot
+  static void       put32(uint8_t *p, uint32_t v);
+  static uint32_t   get32(const uint8_t *p);
+};
+
+#endif
+#endif